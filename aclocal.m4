@@ -29,3 +29,24 @@ AC_DEFUN([ENABLE_DEFAULT_UNLOAD], [
 	#trap '' DEBUG
 ])
 
+AC_DEFUN([ENABLE_IO_URING], [
+	AC_ARG_ENABLE(io-uring,
+		AS_HELP_STRING([--enable-io-uring],[Build the io_uring transport for direct channels, needs liburing >= 2.4 (default: if found)]),
+		[io_uring_ok=$enableval], [io_uring_ok=auto])
+
+	have_liburing=no
+	if test "$io_uring_ok" != "no"; then
+		AC_CHECK_HEADER([liburing.h], [
+			AC_CHECK_LIB([uring], [io_uring_setup_buf_ring], [have_liburing=yes])
+		])
+	fi
+	if test "$have_liburing" = "yes"; then
+		AC_DEFINE([HAVE_LIBURING], [1], [Build the io_uring transport?])
+		TEA_ADD_LIBS([-luring])
+	elif test "$io_uring_ok" = "yes"; then
+		AC_MSG_ERROR([--enable-io-uring given, but liburing >= 2.4 was not found])
+	fi
+	AC_MSG_CHECKING([whether to build the io_uring transport])
+	AC_MSG_RESULT([$have_liburing])
+])
+
@@ -0,0 +1,232 @@
+# Connection churn soak: opens and closes many loopback TLS connections
+# through s2n::push and s2n::socket, and reports memory as it goes, so that
+# per-connection memory and leaks show up as numbers.  A server thread
+# accepts with s2n::listener and echoes; the main thread drives blocking
+# clients, each of which does a handshake and a one byte round trip.  Like
+# s2n.bench, each measurement is printed as a JSON object on its own line:
+#
+#	live	- memory held per open connection (client and server ends
+#			  together, since both are in this process), from holding
+#			  S2N_SOAK_LIVE connections open at once
+#	sample	- after every S2N_SOAK_BATCH connections: RSS, the bytes s2n
+#			  has allocated (s2n::memory in_use), the number of blocks s2n
+#			  holds (allocs - frees), and open channels
+#	growth	- RSS, in_use and block growth per 1000 connections from the end
+#			  of the first batch (when pools and caches have warmed up) to
+#			  the end
+#
+# in_use counts the size of each block handed to s2n, whatever size s2n
+# passes when it frees it, so it and the block count agree on leaks; RSS
+# also sees memory that doesn't go through s2n's allocator.
+#
+# Tuning through the environment:
+#	S2N_SOAK_CONNECTIONS	- connections per channel type (default 200000)
+#	S2N_SOAK_BATCH			- connections between samples (default 10000)
+#	S2N_SOAK_LIVE			- connections held open for the live measurement (default 1000)
+#
+# Run with "make soak", or "make soak-valgrind" for fewer connections under
+# valgrind with the same options as "make valgrind".
+
+package require Thread
+
+namespace eval ::s2nsoak {
+	proc env {name default} {expr {[info exists ::env($name)] ? $::env($name) : $default}}
+
+	variable connections	[env S2N_SOAK_CONNECTIONS 200000]
+	variable batch			[env S2N_SOAK_BATCH 10000]
+	variable live			[env S2N_SOAK_LIVE 1000]
+
+	variable server_script {
+		proc accept {chan args} { #<<<
+			chan configure $chan -translation binary -buffering none
+			chan event $chan readable [list echo $chan]
+		}
+
+		#>>>
+		proc echo chan { #<<<
+			set data	[read $chan]
+			if {[eof $chan]} {
+				close $chan
+				return
+			}
+			if {$data ne ""} {puts -nonewline $chan $data}
+		}
+
+		#>>>
+		proc listen config { #<<<
+			set l	[s2n::listener open -config $config -myaddr 127.0.0.1 accept 0]
+			dict get [s2n::listener stats $l] port
+		}
+
+		#>>>
+	}
+}
+
+proc s2nsoak::json d { #<<<
+	set fields	[lmap {k v} $d {
+		if {[string is double -strict $v]} {
+			format {"%s": %s} $k $v
+		} else {
+			format {"%s": "%s"} $k [string map {\\ \\\\ \" \\\"} $v]
+		}
+	}]
+	return "{[join $fields {, }]}"
+}
+
+#>>>
+proc s2nsoak::report {bench args} { #<<<
+	puts [json [list bench $bench {*}$args]]
+	flush stdout
+}
+
+#>>>
+proc s2nsoak::rss_kb {} { #<<<
+	set h	[open /proc/self/status]
+	try {
+		regexp -line {^VmRSS:\s+(\d+)} [read $h] - kb
+	} finally {
+		close $h
+	}
+	set kb
+}
+
+#>>>
+proc s2nsoak::in_use {} { #<<<
+	dict get [s2n::memory] in_use
+}
+
+#>>>
+proc s2nsoak::blocks {} { #<<<
+	set m	[s2n::memory]
+	expr {[dict get $m allocs] - [dict get $m frees]}
+}
+
+#>>>
+proc s2nsoak::gen_cert dir { #<<<
+	exec openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes \
+		-keyout [file join $dir key.pem] -out [file join $dir cert.pem] -days 1 \
+		-subj /CN=localhost -addext subjectAltName=DNS:localhost 2>@1
+	lmap f {cert.pem key.pem} {
+		set h	[open [file join $dir $f]]
+		try {read $h} finally {close $h}
+	}
+}
+
+#>>>
+proc s2nsoak::start_server server_config { #<<<
+	variable server_script
+
+	set tid	[thread::create -preserved]
+	thread::send $tid [list set ::auto_path $::auto_path]
+	thread::send $tid [list tcl::tm::path add {*}[lreverse [tcl::tm::path list]]]
+	set ver	[package present s2n]
+	thread::send $tid [list package ifneeded s2n $ver [package ifneeded s2n $ver]]
+	thread::send $tid {package require s2n}
+	thread::send $tid $server_script
+
+	list $tid [thread::send $tid [list listen $server_config]]
+}
+
+#>>>
+proc s2nsoak::connect {chantype port config} { #<<<
+	switch -- $chantype {
+		direct {
+			set chan	[s2n::socket -config $config -servername localhost 127.0.0.1 $port]
+		}
+		stacked {
+			set chan	[socket 127.0.0.1 $port]
+			s2n::push $chan -config $config -servername localhost
+		}
+	}
+	chan configure $chan -translation binary -buffering none
+	puts -nonewline $chan x
+	if {[read $chan 1] ne "x"} {error "echo failed"}
+	set chan
+}
+
+#>>>
+proc s2nsoak::live {chantype port config} { #<<<
+	variable live
+
+	set rss_before		[rss_kb]
+	set in_use_before	[in_use]
+	set blocks_before	[blocks]
+	set chans	{}
+	for {set i 0} {$i < $live} {incr i} {
+		lappend chans [connect $chantype $port $config]
+	}
+	after 100		;# Let the server thread finish with the last few
+	set rss_open	[rss_kb]
+	set in_use_open	[in_use]
+	set blocks_open	[blocks]
+	foreach chan $chans {close $chan}
+	after 100
+	report live chantype $chantype connections $live \
+		rss_bytes_per_conn		[expr {($rss_open - $rss_before) * 1024.0 / $live}] \
+		in_use_bytes_per_conn	[expr {($in_use_open - $in_use_before) / double($live)}] \
+		blocks_per_conn			[expr {($blocks_open - $blocks_before) / double($live)}] \
+		in_use_leftover			[expr {[in_use] - $in_use_before}] \
+		blocks_leftover			[expr {[blocks] - $blocks_before}]
+}
+
+#>>>
+proc s2nsoak::churn {chantype port config} { #<<<
+	variable connections
+	variable batch
+
+	set start	[clock microseconds]
+	for {set n 1} {$n <= $connections} {incr n} {
+		close [connect $chantype $port $config]
+		if {$n % $batch == 0 || $n == $connections} {
+			set rss		[rss_kb]
+			set used	[in_use]
+			set held	[blocks]
+			if {![info exists first]} {
+				set first	[list $n $rss $used $held]
+			}
+			report sample chantype $chantype connections $n rss_kb $rss in_use $used blocks $held \
+				channels [llength [chan names]] \
+				conn_per_sec [expr {$n / (([clock microseconds] - $start) / 1e6)}]
+		}
+	}
+
+	lassign $first first_n first_rss first_used first_held
+	set kconns	[expr {($connections - $first_n) / 1000.0}]
+	if {$kconns > 0} {
+		report growth chantype $chantype connections $connections \
+			rss_bytes_per_kconn		[expr {($rss - $first_rss) * 1024.0 / $kconns}] \
+			in_use_bytes_per_kconn	[expr {($used - $first_used) / $kconns}] \
+			blocks_per_kconn		[expr {($held - $first_held) / $kconns}]
+	}
+}
+
+#>>>
+
+proc main argv { #<<<
+	# -load script: how to load the package, as for tests/all.tcl
+	if {[dict exists $argv -load]} {
+		uplevel #0 [dict get $argv -load]
+	}
+	package require s2n
+
+	set tmpdir	[file tempdir s2nsoak]
+	try {
+		lassign [s2nsoak::gen_cert $tmpdir] cert key
+		lassign [s2nsoak::start_server [dict create certificates [list [list $cert $key]]]] tid port
+		set client_config	[dict create trust_pem $cert]
+
+		foreach chantype {stacked direct} {
+			s2nsoak::live	$chantype $port $client_config
+			s2nsoak::churn	$chantype $port $client_config
+		}
+	} finally {
+		if {[info exists tid]} {thread::release $tid}
+		file delete -force $tmpdir
+	}
+}
+
+#>>>
+
+main $argv
+
+# vim: ft=tcl foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
@@ -0,0 +1,306 @@
+#include "s2nInt.h"
+
+// Handshake admission control for connections accepted by listeners.  The
+// handshakes in progress in a thread share its CPU, so during a connection
+// storm starting one for every accepted socket makes all of them (and the
+// established connections) slow.  With a limit set, connections accepted
+// while the thread already has max_handshakes in progress wait in a FIFO
+// without being negotiated, and are started as earlier handshakes finish
+// (or their channels are closed).  Connections that can't join the queue
+// because it's full are closed as soon as they're accepted, and those that
+// wait longer than max_queue_age are shut down and see EOF.  So that clients
+// that stall mid-handshake can't hold the slots for ever, counted handshakes
+// that take longer than max_handshake_time are shut down the same way.  Both
+// lists are in the order their deadlines fall.  The state is per thread, like
+// the event loop that drives the handshakes.
+
+struct admission {
+	int				max_handshakes;		// 0 for no limit
+	int				max_queued;			// Waiting connections beyond this are rejected
+	int				max_queue_age;		// Milliseconds a connection may wait, 0 for no limit
+	int				max_handshake_time;	// Milliseconds a counted handshake may take, 0 for no limit
+	int				in_progress;		// Counted handshakes not yet done
+	int				waiting;			// Connections in the queue
+	struct con_cx*	head;
+	struct con_cx*	tail;
+	struct con_cx*	active_head;		// Counted handshakes, oldest first
+	struct con_cx*	active_tail;
+	Tcl_TimerToken	timer;				// For the earliest deadline
+	int				pumping;
+	uint64_t		queued;				// Connections that had to wait
+	uint64_t		rejected;			// Closed because the queue was full
+	uint64_t		expired;			// Shut down after waiting max_queue_age
+	uint64_t		timed_out;			// Shut down after max_handshake_time
+};
+
+#define ADMISSION_DEFAULT_MAX_QUEUED	1024
+#define ADMISSION_DEFAULT_MAX_AGE		5000
+#define ADMISSION_DEFAULT_MAX_HANDSHAKE	10000
+
+static _Thread_local struct admission	t_adm = {
+	.max_queued			= ADMISSION_DEFAULT_MAX_QUEUED,
+	.max_queue_age		= ADMISSION_DEFAULT_MAX_AGE,
+	.max_handshake_time	= ADMISSION_DEFAULT_MAX_HANDSHAKE,
+};
+
+static void link_tail(struct con_cx** head, struct con_cx** tail, struct con_cx* con_cx) //<<<
+{
+	con_cx->admission_usec = mono_usec();
+	con_cx->queue_prev = *tail;
+	con_cx->queue_next = NULL;
+	if (*tail) (*tail)->queue_next = con_cx; else *head = con_cx;
+	*tail = con_cx;
+}
+
+//>>>
+static void unlink_con(struct con_cx** head, struct con_cx** tail, struct con_cx* con_cx) //<<<
+{
+	if (con_cx->queue_prev) con_cx->queue_prev->queue_next = con_cx->queue_next; else *head = con_cx->queue_next;
+	if (con_cx->queue_next) con_cx->queue_next->queue_prev = con_cx->queue_prev; else *tail = con_cx->queue_prev;
+	con_cx->queue_next = con_cx->queue_prev = NULL;
+}
+
+//>>>
+static void unlink_queued(struct con_cx* con_cx) //<<<
+{
+	unlink_con(&t_adm.head, &t_adm.tail, con_cx);
+	con_cx->admission = ADM_NONE;
+	t_adm.waiting--;
+}
+
+//>>>
+static void unlink_active(struct con_cx* con_cx) //<<<
+{
+	unlink_con(&t_adm.active_head, &t_adm.active_tail, con_cx);
+	con_cx->admission = ADM_NONE;
+	t_adm.in_progress--;
+}
+
+//>>>
+static void start(struct con_cx* con_cx) //<<<
+{
+	con_cx->admission = ADM_ACTIVE;
+	link_tail(&t_adm.active_head, &t_adm.active_tail, con_cx);
+	t_adm.in_progress++;
+}
+
+//>>>
+static void pump(void);
+
+static void timer_cb(ClientData cdata) //<<<
+{
+	t_adm.timer = NULL;
+	pump();
+}
+
+//>>>
+static void expire(void) //<<<
+{
+	const int64_t	now = mono_usec();
+
+	if (t_adm.max_queue_age > 0) {
+		const int64_t	cutoff = now - (int64_t)t_adm.max_queue_age * 1000;
+		while (t_adm.head && t_adm.head->admission_usec <= cutoff) {
+			struct con_cx*	con_cx = t_adm.head;
+			unlink_queued(con_cx);
+			t_adm.expired++;
+			direct_chan_refuse(con_cx);
+		}
+	}
+
+	if (t_adm.max_handshake_time > 0) {
+		const int64_t	cutoff = now - (int64_t)t_adm.max_handshake_time * 1000;
+		while (t_adm.active_head && t_adm.active_head->admission_usec <= cutoff) {
+			struct con_cx*	con_cx = t_adm.active_head;
+			unlink_active(con_cx);
+			t_adm.timed_out++;
+			direct_chan_refuse(con_cx);
+		}
+	}
+}
+
+//>>>
+static void schedule(void) //<<<
+{
+	// Set the timer for whichever deadline comes first
+	int64_t		due = INT64_MAX;
+
+	if (t_adm.timer) {
+		Tcl_DeleteTimerHandler(t_adm.timer);
+		t_adm.timer = NULL;
+	}
+	if (t_adm.head && t_adm.max_queue_age > 0)
+		due = t_adm.head->admission_usec + (int64_t)t_adm.max_queue_age * 1000;
+	if (t_adm.active_head && t_adm.max_handshake_time > 0) {
+		const int64_t	hs_due = t_adm.active_head->admission_usec + (int64_t)t_adm.max_handshake_time * 1000;
+		if (hs_due < due) due = hs_due;
+	}
+	if (due == INT64_MAX) return;
+
+	const int64_t	due_ms = (due - mono_usec()) / 1000 + 1;
+	t_adm.timer = Tcl_CreateTimerHandler(due_ms > 0 ? (int)due_ms : 0, timer_cb, NULL);
+}
+
+//>>>
+static void pump(void) //<<<
+{
+	// Start queued handshakes while there's room, oldest first
+	if (t_adm.pumping) return;		// Handshakes completing as they start come back here
+	t_adm.pumping = 1;
+
+	expire();
+	while (t_adm.head && (t_adm.max_handshakes == 0 || t_adm.in_progress < t_adm.max_handshakes)) {
+		struct con_cx*	con_cx = t_adm.head;
+		unlink_queued(con_cx);
+		start(con_cx);
+		direct_chan_ready(con_cx, 0);	// Drives the handshake as far as it will go
+	}
+	schedule();
+
+	t_adm.pumping = 0;
+}
+
+//>>>
+int admission_decide(void) //<<<
+{
+	// For a newly accepted connection: ADM_ACTIVE to start its handshake now,
+	// ADM_QUEUED to wait, or -1 to reject it
+	if (t_adm.max_handshakes == 0) return ADM_NONE;		// Not counted
+
+	expire();
+	if (t_adm.waiting == 0 && t_adm.in_progress < t_adm.max_handshakes) return ADM_ACTIVE;
+	if (t_adm.waiting < t_adm.max_queued) return ADM_QUEUED;
+	t_adm.rejected++;
+	return -1;
+}
+
+//>>>
+void admission_enter(struct con_cx* con_cx, int state) //<<<
+{
+	con_cx->admission = state;
+	switch (state) {
+		case ADM_ACTIVE:
+			start(con_cx);
+			if (t_adm.active_head == con_cx) schedule();	// Later entries' deadlines come after the head's
+			break;
+
+		case ADM_QUEUED:
+			link_tail(&t_adm.head, &t_adm.tail, con_cx);
+			t_adm.waiting++;
+			t_adm.queued++;
+			if (t_adm.head == con_cx) schedule();
+			break;
+
+		default: break;
+	}
+}
+
+//>>>
+void admission_leave(struct con_cx* con_cx) //<<<
+{
+	// The handshake is done, or the connection is going away
+	switch (con_cx->admission) {
+		case ADM_ACTIVE:
+			unlink_active(con_cx);
+			if (!g_unloading) pump();		// Not while every channel is being closed
+			break;
+
+		case ADM_QUEUED:
+			unlink_queued(con_cx);
+			break;
+
+		default: break;
+	}
+}
+
+//>>>
+void admission_thread_remove(struct con_cx* con_cx) //<<<
+{
+	// The channel is moving to another thread, whose admission state is its own
+	if (con_cx->admission == ADM_QUEUED) {
+		unlink_queued(con_cx);
+		con_cx->admission = ADM_MOVED;
+	} else {
+		admission_leave(con_cx);
+	}
+}
+
+//>>>
+void admission_thread_insert(struct con_cx* con_cx) //<<<
+{
+	// A connection taken out of another thread's queue waits its turn in this one
+	if (con_cx->admission != ADM_MOVED) return;
+
+	con_cx->admission = ADM_NONE;
+	const int	state = admission_decide();
+	if (state == -1) {
+		direct_chan_refuse(con_cx);
+		return;
+	}
+	admission_enter(con_cx, state);
+	if (state != ADM_QUEUED) direct_chan_ready(con_cx, 0);
+}
+
+//>>>
+OBJCMD(admission_cmd) //<<<
+{
+	int			code = TCL_OK;
+	static const char* opts[] = {
+		"-max_handshakes",
+		"-max_queued",
+		"-max_queue_age",
+		"-max_handshake_time",
+		NULL
+	};
+	enum opt {
+		OPT_MAX_HANDSHAKES,
+		OPT_MAX_QUEUED,
+		OPT_MAX_QUEUE_AGE,
+		OPT_MAX_HANDSHAKE_TIME,
+	};
+	Tcl_Obj*	res = NULL;
+
+	if ((objc-1) % 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "?-opt val ...?");
+		code = TCL_ERROR;
+		goto finally;
+	}
+
+	for (int i=1; i<objc; i+=2) {
+		int		optint, v;
+		TEST_OK_LABEL(finally, code, Tcl_GetIndexFromObj(interp, objv[i], opts, "option", 0, &optint));
+		TEST_OK_LABEL(finally, code, Tcl_GetIntFromObj(interp, objv[i+1], &v));
+		if (v < 0) THROW_PRINTF_LABEL(finally, code, "%s can't be negative", opts[optint]);
+		switch ((enum opt)optint) {
+			case OPT_MAX_HANDSHAKES:	t_adm.max_handshakes = v;	break;
+			case OPT_MAX_QUEUED:		t_adm.max_queued = v;		break;
+			case OPT_MAX_QUEUE_AGE:		t_adm.max_queue_age = v;	break;
+			case OPT_MAX_HANDSHAKE_TIME:	t_adm.max_handshake_time = v;	break;
+		}
+	}
+	if (objc > 1) pump();		// A higher limit (or none) lets waiting handshakes start, and deadlines move
+
+	replace_tclobj(&res, Tcl_NewDictObj());
+#define STAT(name) \
+	TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, res, Tcl_NewStringObj(#name, -1), Tcl_NewWideIntObj(t_adm.name)))
+	STAT(max_handshakes);
+	STAT(max_queued);
+	STAT(max_queue_age);
+	STAT(max_handshake_time);
+	STAT(in_progress);
+	STAT(waiting);
+	STAT(queued);
+	STAT(rejected);
+	STAT(expired);
+	STAT(timed_out);
+#undef STAT
+	Tcl_SetObjResult(interp, res);
+
+finally:
+	replace_tclobj(&res, NULL);
+	return code;
+}
+
+//>>>
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
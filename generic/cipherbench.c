@@ -0,0 +1,622 @@
+#include "s2nInt.h"
+#include <openssl/aead.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/nid.h>
+#include <openssl/rsa.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+// Measurements for choosing cipher policies per host: how fast the record
+// ciphers and handshake signatures a policy enables run here, and which CPU
+// features aws-lc has to work with.  The cipher suites and signature schemes
+// are taken from the ClientHello s2n sends under the policy, so they are
+// exactly what the policy offers, in its order of preference.  Each
+// measurement runs for CIPHERBENCH_USEC, in the calling thread.
+
+#define CIPHERBENCH_USEC		100000
+#define CIPHERBENCH_MAX_HELLO	(5 + 16384)		// One record
+
+enum bulk {
+	BULK_AES128_GCM,
+	BULK_AES256_GCM,
+	BULK_CHACHA20_POLY1305,
+	BULK_AES128_CBC_SHA,
+	BULK_AES128_CBC_SHA256,
+	BULK_AES256_CBC_SHA,
+	BULK_AES256_CBC_SHA256,
+	BULK_AES256_CBC_SHA384,
+	BULK_3DES_CBC_SHA,
+	BULK_COUNT
+};
+
+static const struct bulk_alg {
+	const char*			name;
+	const EVP_AEAD*		(*aead)(void);
+	const EVP_CIPHER*	(*cipher)(void);	// CBC suites: cipher with an HMAC over each record
+	const EVP_MD*		(*md)(void);
+} bulk_algs[BULK_COUNT] = {
+	[BULK_AES128_GCM]			= {"aes128-gcm",			EVP_aead_aes_128_gcm,			NULL,					NULL},
+	[BULK_AES256_GCM]			= {"aes256-gcm",			EVP_aead_aes_256_gcm,			NULL,					NULL},
+	[BULK_CHACHA20_POLY1305]	= {"chacha20-poly1305",		EVP_aead_chacha20_poly1305,		NULL,					NULL},
+	[BULK_AES128_CBC_SHA]		= {"aes128-cbc-sha1",		NULL,							EVP_aes_128_cbc,		EVP_sha1},
+	[BULK_AES128_CBC_SHA256]	= {"aes128-cbc-sha256",		NULL,							EVP_aes_128_cbc,		EVP_sha256},
+	[BULK_AES256_CBC_SHA]		= {"aes256-cbc-sha1",		NULL,							EVP_aes_256_cbc,		EVP_sha1},
+	[BULK_AES256_CBC_SHA256]	= {"aes256-cbc-sha256",		NULL,							EVP_aes_256_cbc,		EVP_sha256},
+	[BULK_AES256_CBC_SHA384]	= {"aes256-cbc-sha384",		NULL,							EVP_aes_256_cbc,		EVP_sha384},
+	[BULK_3DES_CBC_SHA]			= {"3des-cbc-sha1",			NULL,							EVP_des_ede3_cbc,		EVP_sha1},
+};
+
+// Names as s2n reports them in the -cipher channel option
+static const struct suite {
+	uint16_t		iana;
+	const char*		name;
+	enum bulk		bulk;
+} suites[] = {
+	{0x1301, "TLS_AES_128_GCM_SHA256",			BULK_AES128_GCM},
+	{0x1302, "TLS_AES_256_GCM_SHA384",			BULK_AES256_GCM},
+	{0x1303, "TLS_CHACHA20_POLY1305_SHA256",	BULK_CHACHA20_POLY1305},
+	{0xC02B, "ECDHE-ECDSA-AES128-GCM-SHA256",	BULK_AES128_GCM},
+	{0xC02C, "ECDHE-ECDSA-AES256-GCM-SHA384",	BULK_AES256_GCM},
+	{0xC02F, "ECDHE-RSA-AES128-GCM-SHA256",		BULK_AES128_GCM},
+	{0xC030, "ECDHE-RSA-AES256-GCM-SHA384",		BULK_AES256_GCM},
+	{0xCCA8, "ECDHE-RSA-CHACHA20-POLY1305",		BULK_CHACHA20_POLY1305},
+	{0xCCA9, "ECDHE-ECDSA-CHACHA20-POLY1305",	BULK_CHACHA20_POLY1305},
+	{0xCCAA, "DHE-RSA-CHACHA20-POLY1305",		BULK_CHACHA20_POLY1305},
+	{0x009C, "AES128-GCM-SHA256",				BULK_AES128_GCM},
+	{0x009D, "AES256-GCM-SHA384",				BULK_AES256_GCM},
+	{0x009E, "DHE-RSA-AES128-GCM-SHA256",		BULK_AES128_GCM},
+	{0x009F, "DHE-RSA-AES256-GCM-SHA384",		BULK_AES256_GCM},
+	{0xC009, "ECDHE-ECDSA-AES128-SHA",			BULK_AES128_CBC_SHA},
+	{0xC00A, "ECDHE-ECDSA-AES256-SHA",			BULK_AES256_CBC_SHA},
+	{0xC013, "ECDHE-RSA-AES128-SHA",			BULK_AES128_CBC_SHA},
+	{0xC014, "ECDHE-RSA-AES256-SHA",			BULK_AES256_CBC_SHA},
+	{0xC023, "ECDHE-ECDSA-AES128-SHA256",		BULK_AES128_CBC_SHA256},
+	{0xC024, "ECDHE-ECDSA-AES256-SHA384",		BULK_AES256_CBC_SHA384},
+	{0xC027, "ECDHE-RSA-AES128-SHA256",			BULK_AES128_CBC_SHA256},
+	{0xC028, "ECDHE-RSA-AES256-SHA384",			BULK_AES256_CBC_SHA384},
+	{0x002F, "AES128-SHA",						BULK_AES128_CBC_SHA},
+	{0x0035, "AES256-SHA",						BULK_AES256_CBC_SHA},
+	{0x003C, "AES128-SHA256",					BULK_AES128_CBC_SHA256},
+	{0x003D, "AES256-SHA256",					BULK_AES256_CBC_SHA256},
+	{0x0033, "DHE-RSA-AES128-SHA",				BULK_AES128_CBC_SHA},
+	{0x0039, "DHE-RSA-AES256-SHA",				BULK_AES256_CBC_SHA},
+	{0x0067, "DHE-RSA-AES128-SHA256",			BULK_AES128_CBC_SHA256},
+	{0x006B, "DHE-RSA-AES256-SHA256",			BULK_AES256_CBC_SHA256},
+	{0x000A, "DES-CBC3-SHA",					BULK_3DES_CBC_SHA},
+	{0x0016, "DHE-RSA-DES-CBC3-SHA",			BULK_3DES_CBC_SHA},
+	{0xC012, "ECDHE-RSA-DES-CBC3-SHA",			BULK_3DES_CBC_SHA},
+};
+
+enum sigkey {
+	KEY_RSA2048,
+	KEY_P256,
+	KEY_P384,
+	KEY_P521,
+	KEY_COUNT
+};
+
+static const struct scheme {
+	uint16_t		iana;
+	const char*		name;
+	enum sigkey		key;
+	const EVP_MD*	(*md)(void);
+	int				pss;
+} schemes[] = {
+	{0x0403, "ecdsa_secp256r1_sha256",	KEY_P256,		EVP_sha256,	0},
+	{0x0503, "ecdsa_secp384r1_sha384",	KEY_P384,		EVP_sha384,	0},
+	{0x0603, "ecdsa_secp521r1_sha512",	KEY_P521,		EVP_sha512,	0},
+	{0x0203, "ecdsa_sha1",				KEY_P256,		EVP_sha1,	0},
+	{0x0804, "rsa_pss_rsae_sha256",		KEY_RSA2048,	EVP_sha256,	1},
+	{0x0805, "rsa_pss_rsae_sha384",		KEY_RSA2048,	EVP_sha384,	1},
+	{0x0806, "rsa_pss_rsae_sha512",		KEY_RSA2048,	EVP_sha512,	1},
+	{0x0809, "rsa_pss_pss_sha256",		KEY_RSA2048,	EVP_sha256,	1},
+	{0x080A, "rsa_pss_pss_sha384",		KEY_RSA2048,	EVP_sha384,	1},
+	{0x080B, "rsa_pss_pss_sha512",		KEY_RSA2048,	EVP_sha512,	1},
+	{0x0401, "rsa_pkcs1_sha256",		KEY_RSA2048,	EVP_sha256,	0},
+	{0x0501, "rsa_pkcs1_sha384",		KEY_RSA2048,	EVP_sha384,	0},
+	{0x0601, "rsa_pkcs1_sha512",		KEY_RSA2048,	EVP_sha512,	0},
+	{0x0201, "rsa_pkcs1_sha1",			KEY_RSA2048,	EVP_sha1,	0},
+};
+
+struct hello {
+	uint16_t		suites[256];
+	int				suites_count;
+	uint16_t		schemes[64];
+	int				schemes_count;
+};
+
+// Bounds checked reads from the ClientHello
+struct rd {
+	const uint8_t*	p;
+	size_t			len;
+};
+
+static int rd_u8(struct rd* r, unsigned* v) //<<<
+{
+	if (r->len < 1) return -1;
+	*v = r->p[0];
+	r->p++; r->len--;
+	return 0;
+}
+
+//>>>
+static int rd_u16(struct rd* r, unsigned* v) //<<<
+{
+	if (r->len < 2) return -1;
+	*v = (r->p[0] << 8) | r->p[1];
+	r->p += 2; r->len -= 2;
+	return 0;
+}
+
+//>>>
+static int rd_sub(struct rd* r, size_t n, struct rd* sub) //<<<
+{
+	if (r->len < n) return -1;
+	*sub = (struct rd){.p = r->p, .len = n};
+	r->p += n; r->len -= n;
+	return 0;
+}
+
+//>>>
+static int parse_hello(const uint8_t* buf, size_t len, struct hello* h) //<<<
+{
+	struct rd	r = {.p = buf, .len = len};
+	struct rd	rec, body, list, exts, ext;
+	unsigned	type, n, hi, lo;
+
+	if (rd_u8(&r, &type) || type != 22) return -1;					// Handshake record
+	if (rd_sub(&r, 2, &list) || rd_u16(&r, &n) || rd_sub(&r, n, &rec)) return -1;
+	if (rd_u8(&rec, &type) || type != 1) return -1;					// ClientHello
+	if (rd_u8(&rec, &hi) || rd_u16(&rec, &lo)) return -1;
+	if (rd_sub(&rec, (hi << 16) | lo, &body)) return -1;			// Must fit in the record
+	if (rd_sub(&body, 2+32, &list)) return -1;						// legacy_version, random
+	if (rd_u8(&body, &n) || rd_sub(&body, n, &list)) return -1;		// legacy_session_id
+
+	if (rd_u16(&body, &n) || rd_sub(&body, n, &list)) return -1;
+	while (list.len >= 2 && h->suites_count < (int)(sizeof(h->suites)/sizeof(h->suites[0]))) {
+		rd_u16(&list, &n);
+		h->suites[h->suites_count++] = n;
+	}
+
+	if (rd_u8(&body, &n) || rd_sub(&body, n, &list)) return -1;		// legacy_compression_methods
+	if (body.len == 0) return 0;									// No extensions
+	if (rd_u16(&body, &n) || rd_sub(&body, n, &exts)) return -1;
+	while (exts.len) {
+		if (rd_u16(&exts, &type) || rd_u16(&exts, &n) || rd_sub(&exts, n, &ext)) return -1;
+		if (type != 13) continue;									// signature_algorithms
+		if (rd_u16(&ext, &n) || rd_sub(&ext, n, &list)) return -1;
+		while (list.len >= 2 && h->schemes_count < (int)(sizeof(h->schemes)/sizeof(h->schemes[0]))) {
+			rd_u16(&list, &n);
+			h->schemes[h->schemes_count++] = n;
+		}
+	}
+
+	return 0;
+}
+
+//>>>
+static int policy_hello(Tcl_Interp* interp, const char* policy, struct hello* h) //<<<
+{
+	// Have s2n write the ClientHello for policy into a socketpair, and parse it
+	int						code = TCL_OK;
+	int						sv[2] = {-1, -1};
+	struct s2n_config*		config = NULL;
+	struct s2n_connection*	con = NULL;
+	s2n_blocked_status		blocked = S2N_NOT_BLOCKED;
+	uint8_t*				buf = NULL;
+	size_t					got = 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) == -1)
+		THROW_POSIX_LABEL(finally, code, "cipherbench: couldn't create socketpair");
+
+	config = s2n_config_new_minimal();		// Verification is off, so skip loading the system trust store
+	if (config == NULL) THROW_ERROR_LABEL(finally, code, "cipherbench: s2n_config_new_minimal failed");
+	if (policy) CHECK_S2N(finally, code, s2n_config_set_cipher_preferences(config, policy));
+	CHECK_S2N(finally, code, s2n_config_disable_x509_verification(config));
+
+	con = s2n_connection_new(S2N_CLIENT);
+	if (con == NULL) THROW_ERROR_LABEL(finally, code, "cipherbench: s2n_connection_new failed");
+	CHECK_S2N(finally, code, s2n_connection_set_config(con, config));
+	CHECK_S2N(finally, code, s2n_connection_set_fd(con, sv[0]));
+
+	// Sends the ClientHello, then blocks waiting for the server
+	if (s2n_negotiate(con, &blocked) == S2N_SUCCESS || s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED)
+		THROW_PRINTF_LABEL(finally, code, "cipherbench: couldn't start a handshake: %s", s2n_strerror(s2n_errno, "EN"));
+
+	buf = ckalloc(CIPHERBENCH_MAX_HELLO);
+	for (;;) {
+		const ssize_t	n = read(sv[1], buf+got, CIPHERBENCH_MAX_HELLO-got);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) break;
+		got += n;
+	}
+	if (got < 5 || parse_hello(buf, got, h) == -1)
+		THROW_ERROR_LABEL(finally, code, "cipherbench: couldn't parse the ClientHello");
+
+finally:
+	if (buf) ckfree(buf);
+	if (con) s2n_connection_free(con);
+	if (config) s2n_config_free(config);
+	if (sv[0] != -1) close(sv[0]);
+	if (sv[1] != -1) close(sv[1]);
+	return code;
+}
+
+//>>>
+static int bench_bulk(Tcl_Interp* interp, const struct bulk_alg* alg, int size, double* enc, double* dec) //<<<
+{
+	// Records of size bytes, in MB/s: AEADs seal and open, CBC suites
+	// encrypt or decrypt and HMAC the record.  As in a connection, keys are
+	// set up once and each record only starts a new IV and MAC
+	int					code = TCL_OK;
+	EVP_AEAD_CTX*		aead = NULL;
+	EVP_CIPHER_CTX*		cctx = NULL;
+	HMAC_CTX*			hctx = NULL;
+	uint8_t				key[64] = {0};
+	uint8_t				nonce[EVP_MAX_IV_LENGTH] = {0};
+	uint8_t				ad[13] = {0};
+	uint8_t				mac[EVP_MAX_MD_SIZE];
+	unsigned			mac_len;
+	const size_t		cap = size + 64;
+	uint8_t*			plain = ckalloc(cap);
+	uint8_t*			sealed = ckalloc(cap);
+	uint8_t*			opened = ckalloc(cap);
+	size_t				sealed_len = 0;
+	size_t				out_len;
+	int					outl;
+	uint64_t			n;
+	int64_t				start, elapsed;
+
+	memset(plain, 'x', cap);
+	memset(opened, 0, cap);		// The decrypt pass MACs it before its first record lands
+
+	if (alg->aead) {
+		const EVP_AEAD*	a = alg->aead();
+		const size_t	nonce_len = EVP_AEAD_nonce_length(a);
+
+		aead = EVP_AEAD_CTX_new(a, key, EVP_AEAD_key_length(a), EVP_AEAD_DEFAULT_TAG_LENGTH);
+		if (aead == NULL) THROW_PRINTF_LABEL(finally, code, "cipherbench: couldn't set up %s", alg->name);
+
+		n = 0; start = mono_usec();
+		do {
+			if (!EVP_AEAD_CTX_seal(aead, sealed, &sealed_len, cap, nonce, nonce_len, plain, size, ad, sizeof(ad)))
+				THROW_PRINTF_LABEL(finally, code, "cipherbench: %s seal failed", alg->name);
+			n++;
+		} while ((elapsed = mono_usec() - start) < CIPHERBENCH_USEC);
+		*enc = (double)n * size / elapsed;
+
+		n = 0; start = mono_usec();
+		do {
+			if (!EVP_AEAD_CTX_open(aead, opened, &out_len, cap, nonce, nonce_len, sealed, sealed_len, ad, sizeof(ad)))
+				THROW_PRINTF_LABEL(finally, code, "cipherbench: %s open failed", alg->name);
+			n++;
+		} while ((elapsed = mono_usec() - start) < CIPHERBENCH_USEC);
+		*dec = (double)n * size / elapsed;
+	} else {
+		const EVP_CIPHER*	cipher = alg->cipher();
+		const EVP_MD*		md = alg->md();
+		const int			len = (size + 15) & ~15;		// Whole blocks, the padding is noise
+
+		cctx = EVP_CIPHER_CTX_new();
+		if (cctx == NULL) THROW_ERROR_LABEL(finally, code, "cipherbench: EVP_CIPHER_CTX_new failed");
+		hctx = HMAC_CTX_new();
+		if (hctx == NULL) THROW_ERROR_LABEL(finally, code, "cipherbench: HMAC_CTX_new failed");
+		if (!HMAC_Init_ex(hctx, key, 32, md, NULL))
+			THROW_PRINTF_LABEL(finally, code, "cipherbench: couldn't set up %s", alg->name);
+
+		for (int encrypt=1; encrypt>=0; encrypt--) {
+			if (
+				!EVP_CipherInit_ex(cctx, cipher, NULL, key, NULL, encrypt) ||
+				!EVP_CIPHER_CTX_set_padding(cctx, 0)
+			) THROW_PRINTF_LABEL(finally, code, "cipherbench: couldn't set up %s", alg->name);
+
+			n = 0; start = mono_usec();
+			do {
+				if (
+					!HMAC_Init_ex(hctx, NULL, 0, NULL, NULL) ||		// Reuses the key
+					!HMAC_Update(hctx, encrypt ? plain : opened, len) ||
+					!HMAC_Final(hctx, mac, &mac_len) ||
+					!EVP_CipherInit_ex(cctx, NULL, NULL, NULL, nonce, -1) ||		// New IV, same key schedule
+					!EVP_CipherUpdate(cctx, encrypt ? sealed : opened, &outl, encrypt ? plain : sealed, len)
+				) THROW_PRINTF_LABEL(finally, code, "cipherbench: %s %s failed", alg->name, encrypt ? "encrypt" : "decrypt");
+				n++;
+			} while ((elapsed = mono_usec() - start) < CIPHERBENCH_USEC);
+			*(encrypt ? enc : dec) = (double)n * size / elapsed;
+		}
+	}
+
+finally:
+	if (aead) EVP_AEAD_CTX_free(aead);
+	if (cctx) EVP_CIPHER_CTX_free(cctx);
+	if (hctx) HMAC_CTX_free(hctx);
+	ckfree(plain);
+	ckfree(sealed);
+	ckfree(opened);
+	return code;
+}
+
+//>>>
+static EVP_PKEY* gen_key(enum sigkey which) //<<<
+{
+	EVP_PKEY*		pkey = NULL;
+	EVP_PKEY_CTX*	ctx = EVP_PKEY_CTX_new_id(which == KEY_RSA2048 ? EVP_PKEY_RSA : EVP_PKEY_EC, NULL);
+
+	if (ctx == NULL || EVP_PKEY_keygen_init(ctx) != 1) goto finally;
+	switch (which) {
+		case KEY_RSA2048:	if (EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) != 1) goto finally;					break;
+		case KEY_P256:		if (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1) != 1) goto finally;	break;
+		case KEY_P384:		if (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_secp384r1) != 1) goto finally;		break;
+		case KEY_P521:		if (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_secp521r1) != 1) goto finally;		break;
+		default:			goto finally;
+	}
+	if (EVP_PKEY_keygen(ctx, &pkey) != 1) pkey = NULL;
+
+finally:
+	if (ctx) EVP_PKEY_CTX_free(ctx);
+	return pkey;
+}
+
+//>>>
+static int bench_scheme(Tcl_Interp* interp, const struct scheme* s, EVP_PKEY* pkey, double* signs, double* verifies) //<<<
+{
+	// Operations per second over a message the size of what TLS 1.3 signs
+	int				code = TCL_OK;
+	EVP_MD_CTX*		mdctx = EVP_MD_CTX_new();
+	EVP_PKEY_CTX*	pctx = NULL;
+	uint8_t			msg[130];
+	uint8_t			sig[1024];
+	size_t			sig_len = 0;
+	uint64_t		n;
+	int64_t			start, elapsed;
+
+	memset(msg, ' ', sizeof(msg));
+	if (mdctx == NULL) THROW_ERROR_LABEL(finally, code, "cipherbench: EVP_MD_CTX_new failed");
+
+	for (int sign=1; sign>=0; sign--) {
+		n = 0; start = mono_usec();
+		do {
+			const int	ok = sign ?
+				EVP_DigestSignInit(mdctx, &pctx, s->md(), NULL, pkey) :
+				EVP_DigestVerifyInit(mdctx, &pctx, s->md(), NULL, pkey);
+			if (ok != 1) THROW_PRINTF_LABEL(finally, code, "cipherbench: %s init failed", s->name);
+			if (s->pss && (
+				EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_PSS_PADDING) != 1 ||
+				EVP_PKEY_CTX_set_rsa_pss_saltlen(pctx, -1) != 1			// Salt as long as the digest
+			)) THROW_PRINTF_LABEL(finally, code, "cipherbench: %s padding failed", s->name);
+			if (sign) {
+				sig_len = sizeof(sig);
+				if (EVP_DigestSign(mdctx, sig, &sig_len, msg, sizeof(msg)) != 1)
+					THROW_PRINTF_LABEL(finally, code, "cipherbench: %s sign failed", s->name);
+			} else {
+				if (EVP_DigestVerify(mdctx, sig, sig_len, msg, sizeof(msg)) != 1)
+					THROW_PRINTF_LABEL(finally, code, "cipherbench: %s verify failed", s->name);
+			}
+			EVP_MD_CTX_reset(mdctx);
+			n++;
+		} while ((elapsed = mono_usec() - start) < CIPHERBENCH_USEC);
+		*(sign ? signs : verifies) = n * 1e6 / elapsed;
+	}
+
+finally:
+	if (mdctx) EVP_MD_CTX_free(mdctx);
+	return code;
+}
+
+//>>>
+static int put_num(Tcl_Interp* interp, Tcl_Obj* d, const char* key, double v) //<<<
+{
+	return Tcl_DictObjPut(interp, d, Tcl_NewStringObj(key, -1), Tcl_NewDoubleObj((int64_t)(v * 100 + 0.5) / 100.0));	// 2 decimal places
+}
+
+//>>>
+OBJCMD(cipherbench_cmd) //<<<
+{
+	int			code = TCL_OK;
+	static const char* opts[] = {
+		"-policy",
+		"-size",
+		NULL
+	};
+	enum opt {
+		OPT_POLICY,
+		OPT_SIZE,
+	};
+	const char*		policy = NULL;
+	int				size = 16384;
+	struct hello	h = {0};
+	double			enc[BULK_COUNT], dec[BULK_COUNT];
+	int				measured[BULK_COUNT] = {0};
+	EVP_PKEY*		keys[KEY_COUNT] = {0};
+	Tcl_Obj*		res = NULL;
+	Tcl_Obj*		ciphers = NULL;
+	Tcl_Obj*		sigs = NULL;
+	Tcl_Obj*		unmeasured = NULL;
+	Tcl_Obj*		entry = NULL;
+
+	if ((objc-1) % 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "?-policy policy? ?-size bytes?");
+		code = TCL_ERROR;
+		goto finally;
+	}
+
+	for (int i=1; i<objc; i+=2) {
+		int		optint;
+		TEST_OK_LABEL(finally, code, Tcl_GetIndexFromObj(interp, objv[i], opts, "option", 0, &optint));
+		switch ((enum opt)optint) {
+			case OPT_POLICY:
+				policy = Tcl_GetString(objv[i+1]);
+				break;
+			case OPT_SIZE:
+				TEST_OK_LABEL(finally, code, Tcl_GetIntFromObj(interp, objv[i+1], &size));
+				if (size < 1 || size > 16384) THROW_ERROR_LABEL(finally, code, "-size must be between 1 and 16384");
+				break;
+		}
+	}
+
+	TEST_OK_LABEL(finally, code, policy_hello(interp, policy, &h));
+
+	replace_tclobj(&ciphers, Tcl_NewDictObj());
+	replace_tclobj(&sigs, Tcl_NewDictObj());
+	replace_tclobj(&unmeasured, Tcl_NewListObj(0, NULL));
+
+	for (int i=0; i<h.suites_count; i++) {
+		const struct suite*	s = NULL;
+		for (size_t j=0; j<sizeof(suites)/sizeof(suites[0]); j++)
+			if (suites[j].iana == h.suites[i]) {s = &suites[j]; break;}
+		if (s == NULL) {
+			if (h.suites[i] != 0x00FF)		// TLS_EMPTY_RENEGOTIATION_INFO_SCSV isn't a cipher
+				TEST_OK_LABEL(finally, code, Tcl_ListObjAppendElement(interp, unmeasured, Tcl_ObjPrintf("0x%04X", h.suites[i])));
+			continue;
+		}
+
+		// Suites with the same record protection share a measurement
+		if (!measured[s->bulk]) {
+			TEST_OK_LABEL(finally, code, bench_bulk(interp, &bulk_algs[s->bulk], size, &enc[s->bulk], &dec[s->bulk]));
+			measured[s->bulk] = 1;
+		}
+		replace_tclobj(&entry, Tcl_NewDictObj());
+		TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, entry, Tcl_NewStringObj("bulk", -1), Tcl_NewStringObj(bulk_algs[s->bulk].name, -1)));
+		TEST_OK_LABEL(finally, code, put_num(interp, entry, "encrypt_mb_per_sec", enc[s->bulk]));
+		TEST_OK_LABEL(finally, code, put_num(interp, entry, "decrypt_mb_per_sec", dec[s->bulk]));
+		TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, ciphers, Tcl_NewStringObj(s->name, -1), entry));
+	}
+
+	for (int i=0; i<h.schemes_count; i++) {
+		const struct scheme*	s = NULL;
+		double					signs, verifies;
+		for (size_t j=0; j<sizeof(schemes)/sizeof(schemes[0]); j++)
+			if (schemes[j].iana == h.schemes[i]) {s = &schemes[j]; break;}
+		if (s == NULL) {
+			TEST_OK_LABEL(finally, code, Tcl_ListObjAppendElement(interp, unmeasured, Tcl_ObjPrintf("0x%04X", h.schemes[i])));
+			continue;
+		}
+
+		if (keys[s->key] == NULL) {
+			keys[s->key] = gen_key(s->key);
+			if (keys[s->key] == NULL) THROW_PRINTF_LABEL(finally, code, "cipherbench: couldn't generate a key for %s", s->name);
+		}
+		TEST_OK_LABEL(finally, code, bench_scheme(interp, s, keys[s->key], &signs, &verifies));
+		replace_tclobj(&entry, Tcl_NewDictObj());
+		TEST_OK_LABEL(finally, code, put_num(interp, entry, "sign_per_sec", signs));
+		TEST_OK_LABEL(finally, code, put_num(interp, entry, "verify_per_sec", verifies));
+		TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, sigs, Tcl_NewStringObj(s->name, -1), entry));
+	}
+
+	replace_tclobj(&res, Tcl_NewDictObj());
+	TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, res, Tcl_NewStringObj("policy", -1),		Tcl_NewStringObj(policy ? policy : "default", -1)));
+	TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, res, Tcl_NewStringObj("size", -1),		Tcl_NewIntObj(size)));
+	TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, res, Tcl_NewStringObj("ciphers", -1),		ciphers));
+	TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, res, Tcl_NewStringObj("signatures", -1),	sigs));
+	TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, res, Tcl_NewStringObj("unmeasured", -1),	unmeasured));
+	Tcl_SetObjResult(interp, res);
+
+finally:
+	for (int i=0; i<KEY_COUNT; i++) if (keys[i]) EVP_PKEY_free(keys[i]);
+	replace_tclobj(&res, NULL);
+	replace_tclobj(&ciphers, NULL);
+	replace_tclobj(&sigs, NULL);
+	replace_tclobj(&unmeasured, NULL);
+	replace_tclobj(&entry, NULL);
+	return code;
+}
+
+//>>>
+OBJCMD(cpu_features_cmd) //<<<
+{
+	int			code = TCL_OK;
+	Tcl_Obj*	res = NULL;
+	Tcl_Obj*	features = NULL;
+	const char*	arch = "unknown";
+
+	enum {A_cmd, A_objc};
+	CHECK_ARGS_LABEL(finally, code, "");
+
+	replace_tclobj(&features, Tcl_NewDictObj());
+#define FEATURE(name, present) \
+	TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, features, Tcl_NewStringObj(name, -1), Tcl_NewBooleanObj((present) != 0)))
+
+#if defined(__x86_64__) || defined(__i386__)
+	{
+		unsigned	a, b, c, d;
+		unsigned	c1 = 0, d1 = 0, b7 = 0, c7 = 0;
+		uint64_t	xcr0 = 0;
+
+#if defined(__x86_64__)
+		arch = "x86_64";
+#else
+		arch = "i386";
+#endif
+		if (__get_cpuid(1, &a, &b, &c, &d)) {c1 = c; d1 = d;}
+		if (__get_cpuid_count(7, 0, &a, &b, &c, &d)) {b7 = b; c7 = c;}
+		if (c1 & (1u<<27)) {		// OSXSAVE: the OS reports which register state it saves
+			uint32_t	lo, hi;
+			__asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+			xcr0 = ((uint64_t)hi << 32) | lo;
+		}
+		// AVX needs the OS to save the YMM state, AVX-512 the opmask and ZMM state too
+		const int	avx_os		= (xcr0 & 0x06) == 0x06;
+		const int	avx512_os	= (xcr0 & 0xe6) == 0xe6;
+
+		FEATURE("sse2",			d1 & (1u<<26));
+		FEATURE("ssse3",		c1 & (1u<<9));
+		FEATURE("sse4.1",		c1 & (1u<<19));
+		FEATURE("pclmulqdq",	c1 & (1u<<1));
+		FEATURE("aesni",		c1 & (1u<<25));
+		FEATURE("rdrand",		c1 & (1u<<30));
+		FEATURE("avx",			(c1 & (1u<<28)) && avx_os);
+		FEATURE("avx2",			(b7 & (1u<<5)) && avx_os);
+		FEATURE("bmi1",			b7 & (1u<<3));
+		FEATURE("bmi2",			b7 & (1u<<8));
+		FEATURE("adx",			b7 & (1u<<19));
+		FEATURE("sha",			b7 & (1u<<29));
+		FEATURE("avx512f",		(b7 & (1u<<16)) && avx512_os);
+		FEATURE("avx512bw",		(b7 & (1u<<30)) && avx512_os);
+		FEATURE("avx512vl",		(b7 & (1u<<31)) && avx512_os);
+		FEATURE("vaes",			(c7 & (1u<<9)) && avx_os);
+		FEATURE("vpclmulqdq",	(c7 & (1u<<10)) && avx_os);
+	}
+#elif defined(__aarch64__)
+	arch = "aarch64";
+#if defined(__linux__)
+	{
+		const unsigned long	hwcap = getauxval(AT_HWCAP);
+
+		FEATURE("neon",			hwcap & HWCAP_ASIMD);
+		FEATURE("aes",			hwcap & HWCAP_AES);
+		FEATURE("pmull",		hwcap & HWCAP_PMULL);
+		FEATURE("sha1",			hwcap & HWCAP_SHA1);
+		FEATURE("sha2",			hwcap & HWCAP_SHA2);
+#ifdef HWCAP_SHA512
+		FEATURE("sha512",		hwcap & HWCAP_SHA512);
+#endif
+#ifdef HWCAP_SHA3
+		FEATURE("sha3",			hwcap & HWCAP_SHA3);
+#endif
+	}
+#endif
+#endif
+#undef FEATURE
+
+	replace_tclobj(&res, Tcl_NewDictObj());
+	TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, res, Tcl_NewStringObj("arch", -1),			Tcl_NewStringObj(arch, -1)));
+	TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, res, Tcl_NewStringObj("features", -1),		features));
+	// What aws-lc decided, after any masking through OPENSSL_ia32cap
+	TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, res, Tcl_NewStringObj("aes_hardware", -1),	Tcl_NewBooleanObj(EVP_has_aes_hardware())));
+	Tcl_SetObjResult(interp, res);
+
+finally:
+	replace_tclobj(&res, NULL);
+	replace_tclobj(&features, NULL);
+	return code;
+}
+
+//>>>
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
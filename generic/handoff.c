@@ -0,0 +1,456 @@
+#define _GNU_SOURCE		// For MSG_CMSG_CLOEXEC
+#include "s2nInt.h"
+
+// Moving established TLS connections to another process (or thread), for
+// restarts that don't drop clients and for spreading connections across
+// processes.  The sender serialises the connection's TLS state (keys,
+// sequence numbers) with s2n_connection_serialize and sends it, with the
+// socket itself as SCM_RIGHTS ancillary data, in a single datagram to an
+// AF_UNIX SOCK_DGRAM socket bound by the receiver.  The receiver rebuilds a
+// direct channel from the fd and state and hands it to a script callback.
+// Datagrams keep each connection's message whole (and with its fd) without
+// any framing.  Access is controlled by the filesystem permissions on the
+// socket path.
+//
+// Serialising spends the connection, so the sender first connects its
+// socket to the receiver's path and checks the receiver's queue has room:
+// a missing or full receiver is an error that leaves the channel usable.
+// The send itself doesn't wait, so a receiver that falls behind can't
+// stall the sender's event loop.
+
+#define HANDOFF_MAGIC		0x73326e48u		// "s2nH"
+#define HANDOFF_VERSION		1
+#define HANDOFF_MAX_MSG		65536			// Header, TLS state and application data
+#define HANDOFF_BATCH		64				// Messages received per readable event, to bound the time spent
+
+#include <poll.h>
+
+struct handoff_hdr {
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	client;			// The connection's role
+	uint32_t	state_len;		// s2n serialised connection, follows the header
+	uint32_t	data_len;		// Application data, follows the state
+};
+
+struct handoff_receiver {
+	char				name[TCL_INTEGER_SPACE + 10];
+	int					fd;
+	char*				path;		// Unlinked when the receiver is closed
+	Tcl_Interp*			interp;
+	Tcl_Obj*			command;
+	struct config_cx*	cfg;		// Holds a ref, may be NULL
+	uint8_t*			buf;		// HANDOFF_MAX_MSG
+	uint64_t			received;
+	uint64_t			errors;
+	int					closed;
+	int					receiving;	// In receive_handler, which frees the receiver if it was closed meanwhile
+};
+
+static atomic_uint		g_receiver_id = 0;
+
+static _Thread_local Tcl_HashTable*	t_receivers = NULL;	// name -> struct handoff_receiver*, this thread's
+
+static int set_path(Tcl_Interp* interp, struct sockaddr_un* sa, Tcl_Obj* path) //<<<
+{
+	Tcl_Size		len;
+	const char*		str = Tcl_GetStringFromObj(path, &len);
+
+	if (len == 0 || (size_t)len > sizeof(sa->sun_path)-1) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("Invalid handoff socket path \"%s\"", str));
+		return TCL_ERROR;
+	}
+	*sa = (struct sockaddr_un){.sun_family = AF_UNIX};
+	memcpy(sa->sun_path, str, len);
+	return TCL_OK;
+}
+
+//>>>
+static int send_handoff(Tcl_Interp* interp, Tcl_Obj* path, Tcl_Obj* channame, Tcl_Obj* data) //<<<
+{
+	int					code = TCL_OK;
+	struct sockaddr_un	sa;
+	struct con_cx*		con_cx = NULL;
+	Tcl_Obj*			state = NULL;
+	int					s = -1;
+	Tcl_Size			state_len, data_len = 0;
+	uint8_t*			state_bytes;
+	uint8_t*			data_bytes = NULL;
+
+	TEST_OK_LABEL(finally, code, set_path(interp, &sa, path));
+	if (data) data_bytes = Tcl_GetByteArrayFromObj(data, &data_len);
+	if (sizeof(struct handoff_hdr) + data_len > HANDOFF_MAX_MSG)
+		THROW_ERROR_LABEL(finally, code, "Handoff data too long");
+
+	s = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (s == -1) THROW_POSIX_LABEL(finally, code, "couldn't create handoff socket");
+
+	// Find out whether there's a receiver, and room in its queue, while the channel is still usable
+	if (connect(s, (struct sockaddr*)&sa, sizeof sa) == -1)
+		THROW_POSIX_LABEL(finally, code, "couldn't connect to handoff receiver");
+	{
+		struct pollfd	pfd = {.fd = s, .events = POLLOUT};
+		int				rc;
+		do {
+			rc = poll(&pfd, 1, 0);
+		} while (rc == -1 && errno == EINTR);
+		if (rc == -1) THROW_POSIX_LABEL(finally, code, "couldn't poll handoff socket");
+		if (rc == 0) {
+			Tcl_SetErrno(EAGAIN);
+			THROW_POSIX_LABEL(finally, code, "handoff receiver's queue is full");
+		}
+	}
+
+	TEST_OK_LABEL(finally, code, direct_chan_serialize(interp, channame, HANDOFF_MAX_MSG - sizeof(struct handoff_hdr) - data_len, &con_cx, &state));
+	// From here on the connection is spent, and the channel is closed whatever happens
+
+	state_bytes = Tcl_GetByteArrayFromObj(state, &state_len);
+
+	struct handoff_hdr	hdr = {
+		.magic		= HANDOFF_MAGIC,
+		.version	= HANDOFF_VERSION,
+		.client		= con_cx->client,
+		.state_len	= state_len,
+		.data_len	= data_len,
+	};
+	struct iovec		iov[] = {
+		{.iov_base = &hdr,			.iov_len = sizeof hdr},
+		{.iov_base = state_bytes,	.iov_len = state_len},
+		{.iov_base = data_bytes,	.iov_len = data_len},
+	};
+	union {
+		struct cmsghdr	align;
+		char			buf[CMSG_SPACE(sizeof(int))];
+	} control = {0};
+	struct msghdr		msg = {
+		.msg_iov		= iov,
+		.msg_iovlen		= data_len ? 3 : 2,
+		.msg_control	= control.buf,
+		.msg_controllen	= sizeof control.buf,
+	};
+	struct cmsghdr*		cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level	= SOL_SOCKET;
+	cmsg->cmsg_type		= SCM_RIGHTS;
+	cmsg->cmsg_len		= CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &con_cx->fd, sizeof(int));
+
+	ssize_t	sent;
+	do {
+		sent = sendmsg(s, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);	// Only fails for want of room if another sender beat us to it
+	} while (sent == -1 && errno == EINTR);
+	if (sent == -1) THROW_POSIX_LABEL(finally, code, "couldn't send handoff");
+
+finally:
+	if (con_cx) {
+		// Closes our reference to the socket, the receiver has its own
+		const int	err = Tcl_GetErrno();
+		Tcl_UnregisterChannel(interp, con_cx->chan);
+		Tcl_SetErrno(err);
+		con_cx = NULL;
+	}
+	if (s != -1) {
+		close(s);
+		s = -1;
+	}
+	replace_tclobj(&state, NULL);
+	return code;
+}
+
+//>>>
+static void free_receiver(struct handoff_receiver* r) //<<<
+{
+	replace_tclobj(&r->command, NULL);
+	if (r->path) {
+		ckfree(r->path);
+		r->path = NULL;
+	}
+	if (r->buf) {
+		ckfree(r->buf);
+		r->buf = NULL;
+	}
+	ckfree(r);
+}
+
+//>>>
+static void interp_deleted(ClientData cdata, Tcl_Interp* interp);
+
+static void close_receiver(struct handoff_receiver* r) //<<<
+{
+	if (r->closed) return;
+	r->closed = 1;
+
+	Tcl_HashEntry*	he = t_receivers ? Tcl_FindHashEntry(t_receivers, r->name) : NULL;
+	if (he) Tcl_DeleteHashEntry(he);
+
+	Tcl_DontCallWhenDeleted(r->interp, interp_deleted, r);
+	Tcl_DeleteFileHandler(r->fd);
+	close(r->fd);
+	r->fd = -1;
+	unlink(r->path);
+	if (r->cfg) {
+		config_cx_decref(r->cfg);
+		r->cfg = NULL;
+	}
+
+	if (!r->receiving) free_receiver(r);
+}
+
+//>>>
+static void interp_deleted(ClientData cdata, Tcl_Interp* interp) //<<<
+{
+	close_receiver((struct handoff_receiver*)cdata);
+}
+
+//>>>
+static void thread_exit(ClientData cdata) //<<<
+{
+	// Interps are deleted before their thread exits, closing their receivers
+	if (t_receivers) {
+		Tcl_DeleteHashTable(t_receivers);
+		ckfree(t_receivers);
+		t_receivers = NULL;
+	}
+}
+
+//>>>
+static int receive_one(struct handoff_receiver* r) //<<<
+{
+	// Returns 0 when there's nothing more to receive
+	Tcl_Interp*			interp = r->interp;
+	struct iovec		iov = {.iov_base = r->buf, .iov_len = HANDOFF_MAX_MSG};
+	union {
+		struct cmsghdr	align;
+		char			buf[CMSG_SPACE(sizeof(int) * 4)];
+	} control;
+	struct msghdr		msg = {
+		.msg_iov		= &iov,
+		.msg_iovlen		= 1,
+		.msg_control	= control.buf,
+		.msg_controllen	= sizeof control.buf,
+	};
+	int					fd = -1;
+	struct handoff_hdr	hdr;
+	Tcl_Channel			chan = NULL;
+	int					code = TCL_OK;
+
+	const ssize_t	got = recvmsg(r->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (got == -1) {
+		if (errno == EINTR) return 1;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) r->errors++;
+		return 0;
+	}
+
+	for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+		const int	nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (int i=0; i<nfds; i++) {
+			int	rfd;
+			memcpy(&rfd, CMSG_DATA(cmsg) + i*sizeof(int), sizeof(int));
+			if (fd == -1) fd = rfd; else close(rfd);	// Only one is expected
+		}
+	}
+
+	if (fd == -1 || msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC) || (size_t)got < sizeof hdr)
+		THROW_ERROR_LABEL(finally, code, "Malformed handoff message");
+	memcpy(&hdr, r->buf, sizeof hdr);
+	if (hdr.magic != HANDOFF_MAGIC || hdr.version != HANDOFF_VERSION)
+		THROW_ERROR_LABEL(finally, code, "Unrecognised handoff message");
+	if ((uint64_t)sizeof hdr + hdr.state_len + hdr.data_len != (uint64_t)got)
+		THROW_ERROR_LABEL(finally, code, "Malformed handoff message");
+
+	const uint8_t*	state = r->buf + sizeof hdr;
+	const uint8_t*	data = state + hdr.state_len;
+
+	code = direct_chan_adopt(interp, fd, hdr.client, r->cfg, state, hdr.state_len, &chan);
+	fd = -1;		// Taken by direct_chan_adopt, even if it failed
+	if (code != TCL_OK) goto finally;
+	r->received++;
+
+	Tcl_Obj*	cmd = Tcl_DuplicateObj(r->command);
+	Tcl_IncrRefCount(cmd);
+	Tcl_ListObjAppendElement(NULL, cmd, Tcl_NewStringObj(Tcl_GetChannelName(chan), -1));
+	Tcl_ListObjAppendElement(NULL, cmd, Tcl_NewByteArrayObj(data, hdr.data_len));
+	code = Tcl_EvalObjEx(interp, cmd, TCL_EVAL_GLOBAL);
+	Tcl_DecrRefCount(cmd);
+	if (code != TCL_OK) {
+		Tcl_AddErrorInfo(interp, "\n    (TLS handoff receiver callback)");
+		Tcl_BackgroundException(interp, code);
+		code = TCL_OK;
+	}
+
+finally:
+	if (fd != -1) close(fd);
+	if (code != TCL_OK) {
+		r->errors++;
+		Tcl_AddErrorInfo(interp, "\n    (receiving TLS handoff)");
+		Tcl_BackgroundException(interp, code);
+	}
+	return 1;
+}
+
+//>>>
+static void receive_handler(ClientData cdata, int mask) //<<<
+{
+	struct handoff_receiver*	r = cdata;
+	Tcl_Interp*					interp = r->interp;
+
+	r->receiving = 1;
+	Tcl_Preserve(interp);
+	for (int i=0; i<HANDOFF_BATCH && !r->closed && receive_one(r); i++) {}
+	Tcl_Release(interp);
+	r->receiving = 0;
+	if (r->closed) free_receiver(r);		// By the callback
+}
+
+//>>>
+static int open_receiver(Tcl_Interp* interp, Tcl_Obj* path, Tcl_Obj* command, struct config_cx* cfg) //<<<
+{
+	int							code = TCL_OK;
+	struct handoff_receiver*	r = NULL;
+	struct sockaddr_un			sa;
+	const int					bufsize = HANDOFF_MAX_MSG * HANDOFF_BATCH;
+	int							s = -1;
+
+	TEST_OK_LABEL(finally, code, set_path(interp, &sa, path));
+
+	s = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (s == -1) THROW_POSIX_LABEL(finally, code, "couldn't create handoff socket");
+	if (bind(s, (struct sockaddr*)&sa, sizeof sa) == -1) THROW_POSIX_LABEL(finally, code, "couldn't bind handoff socket");
+	setsockopt(s, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof bufsize);		// A hint, senders block while it's full
+
+	r = (struct handoff_receiver*)ckalloc(sizeof *r);
+	*r = (struct handoff_receiver){
+		.fd		= s,
+		.interp	= interp,
+		.cfg	= cfg,
+		.path	= ckalloc(strlen(sa.sun_path)+1),
+		.buf	= (uint8_t*)ckalloc(HANDOFF_MAX_MSG),
+	};
+	s = -1;
+	strcpy(r->path, sa.sun_path);
+	snprintf(r->name, sizeof r->name, "s2nhandoff%u", atomic_fetch_add(&g_receiver_id, 1) + 1);
+	replace_tclobj(&r->command, command);
+	if (cfg) config_cx_incref(cfg);
+
+	if (t_receivers == NULL) {
+		t_receivers = (Tcl_HashTable*)ckalloc(sizeof *t_receivers);
+		Tcl_InitHashTable(t_receivers, TCL_STRING_KEYS);
+		Tcl_CreateThreadExitHandler(thread_exit, NULL);
+	}
+	int				isnew;
+	Tcl_HashEntry*	he = Tcl_CreateHashEntry(t_receivers, r->name, &isnew);
+	Tcl_SetHashValue(he, r);
+	Tcl_CallWhenDeleted(interp, interp_deleted, r);
+	Tcl_CreateFileHandler(r->fd, TCL_READABLE, receive_handler, r);
+
+	Tcl_SetObjResult(interp, Tcl_NewStringObj(r->name, -1));
+	r = NULL;
+
+finally:
+	if (s != -1) {
+		close(s);
+		s = -1;
+	}
+	return code;
+}
+
+//>>>
+static struct handoff_receiver* get_receiver(Tcl_Interp* interp, Tcl_Obj* name) //<<<
+{
+	Tcl_HashEntry*	he = t_receivers ? Tcl_FindHashEntry(t_receivers, Tcl_GetString(name)) : NULL;
+
+	if (he == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("handoff receiver \"%s\" doesn't exist in this thread", Tcl_GetString(name)));
+		Tcl_SetErrorCode(interp, "S2N", "HANDOFF", Tcl_GetString(name), NULL);
+		return NULL;
+	}
+	return Tcl_GetHashValue(he);
+}
+
+//>>>
+OBJCMD(handoff_cmd) //<<<
+{
+	int				code = TCL_OK;
+	static const char* ops[] = {
+		"send",
+		"receive",
+		"close",
+		"stats",
+		NULL
+	};
+	enum op {
+		OP_SEND,
+		OP_RECEIVE,
+		OP_CLOSE,
+		OP_STATS,
+	};
+	int				opint;
+
+	enum {A_cmd, A_OP, A_args};
+	CHECK_MIN_ARGS_LABEL(finally, code, "send|receive|close|stats ?arg ...?");
+
+	TEST_OK_LABEL(finally, code, Tcl_GetIndexFromObj(interp, objv[A_OP], ops, "op", TCL_EXACT, &opint));
+	switch ((enum op)opint) {
+		case OP_SEND: //<<<
+		{
+			Tcl_Obj*	data = NULL;
+
+			if (objc != A_args+2 && !(objc == A_args+4 && strcmp(Tcl_GetString(objv[A_args]), "-data") == 0)) {
+				Tcl_WrongNumArgs(interp, A_args, objv, "?-data bytes? path channelName");
+				code = TCL_ERROR;
+				goto finally;
+			}
+			if (objc == A_args+4) data = objv[A_args+1];
+			TEST_OK_LABEL(finally, code, send_handoff(interp, objv[objc-2], objv[objc-1], data));
+			break;
+		}
+		//>>>
+		case OP_RECEIVE: //<<<
+		{
+			struct config_cx*	cfg = NULL;
+
+			if (objc != A_args+2 && !(objc == A_args+4 && strcmp(Tcl_GetString(objv[A_args]), "-config") == 0)) {
+				Tcl_WrongNumArgs(interp, A_args, objv, "?-config config? path command");
+				code = TCL_ERROR;
+				goto finally;
+			}
+			if (objc == A_args+4) TEST_OK_LABEL(finally, code, get_config_cx_from_obj(interp, objv[A_args+1], &cfg));
+			TEST_OK_LABEL(finally, code, open_receiver(interp, objv[objc-2], objv[objc-1], cfg));
+			break;
+		}
+		//>>>
+		case OP_CLOSE: //<<<
+		case OP_STATS:
+		{
+			if (objc != A_args+1) {
+				Tcl_WrongNumArgs(interp, A_args, objv, "receiver");
+				code = TCL_ERROR;
+				goto finally;
+			}
+			struct handoff_receiver*	r = get_receiver(interp, objv[A_args]);
+			if (r == NULL) {
+				code = TCL_ERROR;
+				goto finally;
+			}
+			if (opint == OP_CLOSE) {
+				close_receiver(r);
+			} else {
+				Tcl_Obj*	d = Tcl_NewDictObj();
+				Tcl_DictObjPut(NULL, d, Tcl_NewStringObj("path", -1),		Tcl_NewStringObj(r->path, -1));
+				Tcl_DictObjPut(NULL, d, Tcl_NewStringObj("received", -1),	Tcl_NewWideIntObj(r->received));
+				Tcl_DictObjPut(NULL, d, Tcl_NewStringObj("errors", -1),		Tcl_NewWideIntObj(r->errors));
+				Tcl_SetObjResult(interp, d);
+			}
+			break;
+		}
+		//>>>
+		default: THROW_ERROR_LABEL(finally, code, "Unhandled op");
+	}
+
+finally:
+	return code;
+}
+
+//>>>
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
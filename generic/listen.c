@@ -0,0 +1,522 @@
+#define _GNU_SOURCE		// For accept4
+#include "s2nInt.h"
+#include <netinet/in.h>
+
+// TLS listeners that accept straight into direct channels.  Each listener
+// belongs to the thread (and interp) that opened it and accepts in that
+// thread's event loop.  Listeners opened with the same -group in several
+// threads each bind their own SO_REUSEPORT socket on the same port, so the
+// kernel spreads incoming connections across the threads, and all of them
+// share the s2n_config (and so the certificates, session ticket keys and
+// caches) of the first listener opened in the group.  Each listener is a
+// shard of its group, with its own accept and handshake counters.
+
+#define ACCEPT_BATCH	64		// Connections accepted per readable event, to bound the time spent
+#define ACCEPT_BACKOFF	100		// Milliseconds to stop accepting for when out of fds or memory
+
+struct listen_shard {
+	atomic_int				refcount;		// The listener, and each connection it accepted
+	uint32_t				id;
+	Tcl_ThreadId			thread;
+	atomic_uint_fast64_t	accepts;
+	atomic_uint_fast64_t	accept_errors;
+	atomic_uint_fast64_t	handshakes;
+	struct listen_shard*	next;			// In the group, under g_groups_mutex
+};
+
+struct listen_group {
+	char*					name;
+	struct config_cx*		cfg;			// Holds a ref
+	struct listen_shard*	shards;
+};
+
+struct listener {
+	char					name[TCL_INTEGER_SPACE + 10];
+	int						fd;
+	int						port;
+	Tcl_Interp*				interp;
+	Tcl_Obj*				command;
+	struct config_cx*		cfg;			// Holds a ref
+	struct listen_shard*	shard;
+	struct listen_group*	group;			// NULL if not in a group
+	int						uring;			// Accepted connections use the thread's io_uring, where available
+	Tcl_TimerToken			backoff;		// Accepting again after running out of fds, if set
+	int						closed;
+	int						accepting;		// In accept_handler, which frees the listener if it was closed meanwhile
+};
+
+static atomic_uint		g_listener_id = 0;
+
+TCL_DECLARE_MUTEX(g_groups_mutex);
+static Tcl_HashTable	g_groups;			// name -> struct listen_group*
+static int				g_groups_init = 0;
+
+static _Thread_local Tcl_HashTable*	t_listeners = NULL;	// name -> struct listener*, this thread's
+
+void listen_shard_incref(struct listen_shard* shard) //<<<
+{
+	atomic_fetch_add_explicit(&shard->refcount, 1, memory_order_relaxed);
+}
+
+//>>>
+void listen_shard_decref(struct listen_shard* shard) //<<<
+{
+	if (atomic_fetch_sub_explicit(&shard->refcount, 1, memory_order_acq_rel) == 1)
+		ckfree(shard);
+}
+
+//>>>
+void listen_shard_handshake(struct listen_shard* shard) //<<<
+{
+	atomic_fetch_add_explicit(&shard->handshakes, 1, memory_order_relaxed);
+}
+
+//>>>
+static Tcl_Obj* shard_stats(struct listen_shard* shard) //<<<
+{
+	Tcl_Obj*	d = Tcl_NewDictObj();
+
+	Tcl_DictObjPut(NULL, d, Tcl_NewStringObj("thread", -1), Tcl_ObjPrintf("%p", (void*)shard->thread));
+#define STAT(name) \
+	Tcl_DictObjPut(NULL, d, Tcl_NewStringObj(#name, -1), Tcl_NewWideIntObj(atomic_load_explicit(&shard->name, memory_order_relaxed)))
+	STAT(accepts);
+	STAT(accept_errors);
+	STAT(handshakes);
+#undef STAT
+
+	return d;
+}
+
+//>>>
+static void free_listener(struct listener* l) //<<<
+{
+	replace_tclobj(&l->command, NULL);
+	ckfree(l);
+}
+
+//>>>
+static void leave_group(struct listener* l) //<<<
+{
+	struct listen_group*	g = l->group;
+
+	if (g == NULL) return;
+	l->group = NULL;
+
+	Tcl_MutexLock(&g_groups_mutex);
+	for (struct listen_shard** p = &g->shards; *p; p = &(*p)->next) {
+		if (*p == l->shard) {
+			*p = l->shard->next;
+			break;
+		}
+	}
+	if (g->shards == NULL) {
+		Tcl_HashEntry*	he = Tcl_FindHashEntry(&g_groups, g->name);
+		if (he) Tcl_DeleteHashEntry(he);
+	} else {
+		g = NULL;		// Still in use
+	}
+	Tcl_MutexUnlock(&g_groups_mutex);
+
+	if (g) {
+		config_cx_decref(g->cfg);
+		ckfree(g->name);
+		ckfree(g);
+	}
+}
+
+//>>>
+static void interp_deleted(ClientData cdata, Tcl_Interp* interp);
+
+static void close_listener(struct listener* l) //<<<
+{
+	if (l->closed) return;
+	l->closed = 1;
+
+	Tcl_HashEntry*	he = t_listeners ? Tcl_FindHashEntry(t_listeners, l->name) : NULL;
+	if (he) Tcl_DeleteHashEntry(he);
+
+	Tcl_DontCallWhenDeleted(l->interp, interp_deleted, l);
+	if (l->backoff) {
+		Tcl_DeleteTimerHandler(l->backoff);
+		l->backoff = NULL;
+	}
+	Tcl_DeleteFileHandler(l->fd);
+	close(l->fd);
+	l->fd = -1;
+
+	leave_group(l);
+	listen_shard_decref(l->shard);
+	l->shard = NULL;
+	if (l->cfg) {
+		config_cx_decref(l->cfg);
+		l->cfg = NULL;
+	}
+
+	if (!l->accepting) free_listener(l);
+}
+
+//>>>
+static void interp_deleted(ClientData cdata, Tcl_Interp* interp) //<<<
+{
+	close_listener((struct listener*)cdata);
+}
+
+//>>>
+static void thread_exit(ClientData cdata) //<<<
+{
+	// Interps are deleted before their thread exits, closing their listeners
+	if (t_listeners) {
+		Tcl_DeleteHashTable(t_listeners);
+		ckfree(t_listeners);
+		t_listeners = NULL;
+	}
+}
+
+//>>>
+static void accept_handler(ClientData cdata, int mask);
+
+static void backoff_done(ClientData cdata) //<<<
+{
+	struct listener*	l = cdata;
+
+	l->backoff = NULL;
+	Tcl_CreateFileHandler(l->fd, TCL_READABLE, accept_handler, l);
+}
+
+//>>>
+static void accept_handler(ClientData cdata, int mask) //<<<
+{
+	struct listener*	l = cdata;
+	Tcl_Interp*			interp = l->interp;
+
+	l->accepting = 1;
+	Tcl_Preserve(interp);
+	for (int i=0; i<ACCEPT_BATCH && !l->closed; i++) {
+		struct sockaddr_storage	sa;
+		socklen_t				len = sizeof sa;
+		const int				fd = accept4(l->fd, (struct sockaddr*)&sa, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (fd == -1) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) atomic_fetch_add_explicit(&l->shard->accept_errors, 1, memory_order_relaxed);
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+				// The connection stays in the backlog, so the socket stays
+				// readable: stop watching it for a while rather than spin
+				Tcl_DeleteFileHandler(l->fd);
+				l->backoff = Tcl_CreateTimerHandler(ACCEPT_BACKOFF, backoff_done, l);
+			}
+			break;
+		}
+		atomic_fetch_add_explicit(&l->shard->accepts, 1, memory_order_relaxed);
+
+		Tcl_Channel		chan = NULL;
+		if (direct_chan_accept(interp, fd, l->cfg, l->shard, l->uring, &chan) != TCL_OK) {
+			Tcl_AddErrorInfo(interp, "\n    (accepting TLS connection)");
+			Tcl_BackgroundException(interp, TCL_ERROR);
+			continue;
+		}
+		if (chan == NULL) continue;		// Turned away by admission control
+
+		char		host[INET6_ADDRSTRLEN] = "";
+		char		serv[8] = "";
+		getnameinfo((struct sockaddr*)&sa, len, host, sizeof host, serv, sizeof serv, NI_NUMERICHOST | NI_NUMERICSERV);
+
+		Tcl_Obj*	cmd = Tcl_DuplicateObj(l->command);
+		Tcl_IncrRefCount(cmd);
+		Tcl_ListObjAppendElement(NULL, cmd, Tcl_NewStringObj(Tcl_GetChannelName(chan), -1));
+		Tcl_ListObjAppendElement(NULL, cmd, Tcl_NewStringObj(host, -1));
+		Tcl_ListObjAppendElement(NULL, cmd, Tcl_NewStringObj(serv, -1));
+		const int	code = Tcl_EvalObjEx(interp, cmd, TCL_EVAL_GLOBAL);
+		Tcl_DecrRefCount(cmd);
+		if (code != TCL_OK) {
+			Tcl_AddErrorInfo(interp, "\n    (TLS listener accept callback)");
+			Tcl_BackgroundException(interp, code);
+		}
+	}
+	Tcl_Release(interp);
+	l->accepting = 0;
+	if (l->closed) free_listener(l);		// By the accept callback
+}
+
+//>>>
+static int join_group(Tcl_Interp* interp, struct listener* l, const char* name, struct config_cx* cfg) //<<<
+{
+	int						code = TCL_OK;
+	struct listen_group*	g = NULL;
+	Tcl_HashEntry*			he;
+	int						isnew;
+
+	Tcl_MutexLock(&g_groups_mutex);
+	if (!g_groups_init) {
+		Tcl_InitHashTable(&g_groups, TCL_STRING_KEYS);
+		g_groups_init = 1;
+	}
+	he = Tcl_CreateHashEntry(&g_groups, name, &isnew);
+	if (isnew) {
+		if (cfg == NULL) {
+			Tcl_DeleteHashEntry(he);
+			THROW_ERROR_LABEL(finally, code, "The first listener in a group needs a -config");
+		}
+		g = (struct listen_group*)ckalloc(sizeof *g);
+		*g = (struct listen_group){
+			.name	= ckalloc(strlen(name)+1),
+			.cfg	= cfg,
+		};
+		strcpy(g->name, name);
+		config_cx_incref(cfg);
+		Tcl_SetHashValue(he, g);
+	} else {
+		g = Tcl_GetHashValue(he);
+		// Equal values make distinct config_cxs in different threads, so compare what they were made from
+		if (cfg && cfg != g->cfg && strcmp(cfg->spec, g->cfg->spec) != 0)
+			THROW_PRINTF_LABEL(finally, code, "-config differs from the config of group \"%s\"", name);
+	}
+
+	// Every shard uses the group's config, so that they all share one s2n_config
+	config_cx_incref(g->cfg);
+	l->cfg = g->cfg;
+	l->shard->next = g->shards;
+	g->shards = l->shard;
+	l->group = g;
+
+finally:
+	Tcl_MutexUnlock(&g_groups_mutex);
+	return code;
+}
+
+//>>>
+static int open_listener(Tcl_Interp* interp, Tcl_Obj* command, Tcl_Obj* port_obj, const char* myaddr, const char* group, struct config_cx* cfg, int backlog, int uring) //<<<
+{
+	int					code = TCL_OK;
+	struct listener*	l = NULL;
+	struct addrinfo*	addrs = NULL;
+	struct addrinfo		hints = {
+		.ai_family		= AF_UNSPEC,
+		.ai_socktype	= SOCK_STREAM,
+		.ai_flags		= AI_PASSIVE,
+	};
+	int					s = -1;
+	int					err = 0;		// From the last address that failed
+	const int			on = 1;
+
+	const int rc = getaddrinfo(myaddr, Tcl_GetString(port_obj), &hints, &addrs);
+	if (rc != 0) THROW_ERROR_LABEL(finally, code, "couldn't open listening socket: ", gai_strerror(rc));
+
+	for (struct addrinfo* addr=addrs; addr; addr=addr->ai_next) {
+		s = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addr->ai_protocol);
+		if (s == -1) {
+			err = errno;
+			continue;
+		}
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+#ifdef SO_REUSEPORT
+		if (group && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) == -1)
+			THROW_POSIX_LABEL(finally, code, "couldn't set SO_REUSEPORT");
+#else
+		if (group) THROW_ERROR_LABEL(finally, code, "SO_REUSEPORT isn't available on this platform");
+#endif
+		if (bind(s, addr->ai_addr, addr->ai_addrlen) == 0 && listen(s, backlog) == 0) break;
+		err = errno;
+		close(s);
+		s = -1;
+	}
+	if (s == -1) {
+		errno = err;		// Not close's
+		THROW_POSIX_LABEL(finally, code, "couldn't open listening socket");
+	}
+
+	l = (struct listener*)ckalloc(sizeof *l);
+	*l = (struct listener){
+		.fd		= s,
+		.interp	= interp,
+		.uring	= uring,
+	};
+	s = -1;
+	const uint32_t	id = atomic_fetch_add(&g_listener_id, 1) + 1;
+	snprintf(l->name, sizeof l->name, "s2nlisten%u", id);
+	replace_tclobj(&l->command, command);
+
+	struct sockaddr_storage	sa;
+	socklen_t				salen = sizeof sa;
+	if (getsockname(l->fd, (struct sockaddr*)&sa, &salen) == 0)
+		l->port = sa.ss_family == AF_INET6 ? ntohs(((struct sockaddr_in6*)&sa)->sin6_port) : ntohs(((struct sockaddr_in*)&sa)->sin_port);
+
+	l->shard = (struct listen_shard*)ckalloc(sizeof *l->shard);
+	*l->shard = (struct listen_shard){
+		.refcount	= 1,
+		.id			= id,
+		.thread		= Tcl_GetCurrentThread(),
+	};
+
+	if (group) {
+		TEST_OK_LABEL(finally, code, join_group(interp, l, group, cfg));
+	} else {
+		if (cfg == NULL) THROW_ERROR_LABEL(finally, code, "A listener needs a -config");
+		config_cx_incref(cfg);
+		l->cfg = cfg;
+	}
+
+	if (t_listeners == NULL) {
+		t_listeners = (Tcl_HashTable*)ckalloc(sizeof *t_listeners);
+		Tcl_InitHashTable(t_listeners, TCL_STRING_KEYS);
+		Tcl_CreateThreadExitHandler(thread_exit, NULL);
+	}
+	int				isnew;
+	Tcl_HashEntry*	he = Tcl_CreateHashEntry(t_listeners, l->name, &isnew);
+	Tcl_SetHashValue(he, l);
+	Tcl_CallWhenDeleted(interp, interp_deleted, l);
+	Tcl_CreateFileHandler(l->fd, TCL_READABLE, accept_handler, l);
+
+	Tcl_SetObjResult(interp, Tcl_NewStringObj(l->name, -1));
+	l = NULL;
+
+finally:
+	if (addrs) {
+		freeaddrinfo(addrs);
+		addrs = NULL;
+	}
+	if (s != -1) {
+		close(s);
+		s = -1;
+	}
+	if (l) {
+		leave_group(l);
+		if (l->shard) listen_shard_decref(l->shard);
+		if (l->cfg) config_cx_decref(l->cfg);
+		close(l->fd);
+		free_listener(l);
+		l = NULL;
+	}
+	return code;
+}
+
+//>>>
+static struct listener* get_listener(Tcl_Interp* interp, Tcl_Obj* name) //<<<
+{
+	Tcl_HashEntry*	he = t_listeners ? Tcl_FindHashEntry(t_listeners, Tcl_GetString(name)) : NULL;
+
+	if (he == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("listener \"%s\" doesn't exist in this thread", Tcl_GetString(name)));
+		Tcl_SetErrorCode(interp, "S2N", "LISTENER", Tcl_GetString(name), NULL);
+		return NULL;
+	}
+	return Tcl_GetHashValue(he);
+}
+
+//>>>
+static Tcl_Obj* listener_stats(struct listener* l) //<<<
+{
+	Tcl_Obj*	res = shard_stats(l->shard);
+	Tcl_Obj*	shards = Tcl_NewDictObj();
+
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("port", -1), Tcl_NewIntObj(l->port));
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("group", -1), Tcl_NewStringObj(l->group ? l->group->name : "", -1));
+	if (l->group) {
+		Tcl_MutexLock(&g_groups_mutex);
+		for (struct listen_shard* s = l->group->shards; s; s = s->next)
+			Tcl_DictObjPut(NULL, shards, Tcl_NewWideIntObj(s->id), shard_stats(s));
+		Tcl_MutexUnlock(&g_groups_mutex);
+	} else {
+		Tcl_DictObjPut(NULL, shards, Tcl_NewWideIntObj(l->shard->id), shard_stats(l->shard));
+	}
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("shards", -1), shards);
+
+	return res;
+}
+
+//>>>
+OBJCMD(listener_cmd) //<<<
+{
+	int				code = TCL_OK;
+	static const char* ops[] = {
+		"open",
+		"close",
+		"stats",
+		NULL
+	};
+	enum op {
+		OP_OPEN,
+		OP_CLOSE,
+		OP_STATS,
+	};
+	int				opint;
+
+	enum {A_cmd, A_OP, A_args};
+	CHECK_MIN_ARGS_LABEL(finally, code, "open|close|stats ?arg ...?");
+
+	TEST_OK_LABEL(finally, code, Tcl_GetIndexFromObj(interp, objv[A_OP], ops, "op", TCL_EXACT, &opint));
+	switch ((enum op)opint) {
+		case OP_OPEN: //<<<
+		{
+			static const char* opts[] = {
+				"-config",
+				"-myaddr",
+				"-group",
+				"-backlog",
+				"-uring",
+				NULL
+			};
+			enum opt {
+				OPT_CONFIG,
+				OPT_MYADDR,
+				OPT_GROUP,
+				OPT_BACKLOG,
+				OPT_URING,
+			};
+			struct config_cx*	cfg = NULL;
+			const char*			myaddr = NULL;
+			const char*			group = NULL;
+			int					backlog = SOMAXCONN;
+			int					uring = 0;
+
+			if (objc < A_args+2 || (objc - A_args) % 2) {
+				Tcl_WrongNumArgs(interp, A_args, objv, "?-opt val ...? command port");
+				code = TCL_ERROR;
+				goto finally;
+			}
+			for (int i=A_args; i<objc-2; i+=2) {
+				int		optint;
+				TEST_OK_LABEL(finally, code, Tcl_GetIndexFromObj(interp, objv[i], opts, "option", 0, &optint));
+				switch ((enum opt)optint) {
+					case OPT_CONFIG:	TEST_OK_LABEL(finally, code, get_config_cx_from_obj(interp, objv[i+1], &cfg));	break;
+					case OPT_MYADDR:	myaddr = Tcl_GetString(objv[i+1]);	break;
+					case OPT_GROUP:		group = Tcl_GetString(objv[i+1]);	break;
+					case OPT_BACKLOG:	TEST_OK_LABEL(finally, code, Tcl_GetIntFromObj(interp, objv[i+1], &backlog));	break;
+					case OPT_URING:		TEST_OK_LABEL(finally, code, Tcl_GetBooleanFromObj(interp, objv[i+1], &uring));	break;
+				}
+			}
+			TEST_OK_LABEL(finally, code, open_listener(interp, objv[objc-2], objv[objc-1], myaddr, group, cfg, backlog, uring));
+			break;
+		}
+		//>>>
+		case OP_CLOSE: //<<<
+		case OP_STATS:
+		{
+			if (objc != A_args+1) {
+				Tcl_WrongNumArgs(interp, A_args, objv, "listener");
+				code = TCL_ERROR;
+				goto finally;
+			}
+			struct listener*	l = get_listener(interp, objv[A_args]);
+			if (l == NULL) {
+				code = TCL_ERROR;
+				goto finally;
+			}
+			if (opint == OP_CLOSE) {
+				close_listener(l);
+			} else {
+				Tcl_SetObjResult(interp, listener_stats(l));
+			}
+			break;
+		}
+		//>>>
+		default: THROW_ERROR_LABEL(finally, code, "Unhandled op");
+	}
+
+finally:
+	return code;
+}
+
+//>>>
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
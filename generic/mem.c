@@ -0,0 +1,273 @@
+#include "s2nInt.h"
+#include <sys/mman.h>
+
+// Allocator callbacks for s2n: allocations up to 128 KiB are rounded up to
+// one of four size classes per power of two and recycled through per-thread
+// free lists, so a new connection's buffers usually come from the last
+// connection's rather than from malloc.  When mlock is on (the default, as for
+// s2n's own allocator, unless S2N_DONT_MLOCK is set) blocks are whole pages,
+// and are locked once when they come from the system rather than each time
+// s2n allocates them.  A block freed by a thread other than the one that
+// allocated it joins the freeing thread's cache.
+//
+// s2n doesn't always free with the size it was given: blobs pass back the
+// allocated size, but s2n_free_object passes the size it asked for.  Both
+// round to the same block size, so that is recomputed on free rather than
+// trusted (or stored in a header, which would cost mlocked blocks a page).
+
+#define MEM_MIN_SHIFT		6		// Smallest class: 64 bytes
+#define MEM_MAX_SHIFT		17		// Largest class: 128 KiB
+#define MEM_CLASSES			((MEM_MAX_SHIFT - MEM_MIN_SHIFT) * 4 + 1)
+#define MEM_CACHE_BYTES		(256 * 1024)	// Per class, per thread
+#define MEM_CACHE_MIN		4
+#define MEM_CACHE_MAX		256
+
+struct mem_block {
+	struct mem_block*	next;
+};
+
+enum mem_cache_state {
+	CACHE_NONE,			// Thread hasn't allocated yet
+	CACHE_ACTIVE,
+	CACHE_GONE			// Thread is exiting, don't cache any more
+};
+
+struct mem_cache {
+	enum mem_cache_state	state;
+	struct mem_block*		free[MEM_CLASSES];
+	uint32_t				count[MEM_CLASSES];
+};
+
+static _Thread_local struct mem_cache	t_cache;
+
+static int				g_mlock = 1;
+static size_t			g_page_size = 4096;
+
+static atomic_int_fast64_t	g_in_use		= 0;	// Bytes handed to s2n
+static atomic_int_fast64_t	g_peak			= 0;
+static atomic_int_fast64_t	g_cached		= 0;	// Bytes in thread caches
+static atomic_int_fast64_t	g_locked		= 0;
+static atomic_uint_fast64_t	g_allocs		= 0;
+static atomic_uint_fast64_t	g_frees			= 0;
+static atomic_uint_fast64_t	g_pool_hits		= 0;
+static atomic_uint_fast64_t	g_pool_misses	= 0;
+static atomic_uint_fast64_t	g_mlock_failures	= 0;
+
+static inline int size_class(uint32_t n) //<<<
+{
+	if (n <= (1u << MEM_MIN_SHIFT)) return 0;
+	const int		k = 31 - __builtin_clz(n-1);		// 2^k < n <= 2^(k+1)
+	if (k >= MEM_MAX_SHIFT) return -1;
+	const int		step_shift = k - 2;
+	const uint32_t	sub = (n - (1u << k) + (1u << step_shift) - 1) >> step_shift;	// 1..4
+
+	return (k - MEM_MIN_SHIFT) * 4 + sub;
+}
+
+//>>>
+static inline uint32_t class_size(int c) //<<<
+{
+	if (c == 0) return 1u << MEM_MIN_SHIFT;
+	const int	k = (c-1) / 4 + MEM_MIN_SHIFT;
+
+	return (1u << k) + ((c-1) % 4 + 1) * (1u << (k-2));
+}
+
+//>>>
+static inline uint32_t block_size(uint32_t n, int* c) //<<<
+{
+	// The size of the block handed out for a request of n bytes, and its
+	// class in *c (-1 for blocks too big to pool).  Idempotent, so the
+	// allocated size maps to itself.
+	if (n == 0) n = 1;
+	if (g_mlock) n = (n + g_page_size - 1) & ~(g_page_size - 1);	// Page sized classes are all multiples of the page size
+
+	*c = size_class(n);
+	return *c >= 0 ? class_size(*c) : n;
+}
+
+//>>>
+static inline uint32_t cache_limit(int c) //<<<
+{
+	const uint32_t	limit = MEM_CACHE_BYTES / class_size(c);
+
+	return limit < MEM_CACHE_MIN ? MEM_CACHE_MIN : limit > MEM_CACHE_MAX ? MEM_CACHE_MAX : limit;
+}
+
+//>>>
+static void* sys_alloc(uint32_t size) //<<<
+{
+	void*	p = NULL;
+
+	if (!g_mlock) return malloc(size);
+
+	if (posix_memalign(&p, g_page_size, size)) return NULL;
+#ifdef MADV_DONTDUMP
+	madvise(p, size, MADV_DONTDUMP);
+#endif
+	if (mlock(p, size)) {
+		// As for s2n's own allocator, failing to lock is an allocation failure
+		atomic_fetch_add_explicit(&g_mlock_failures, 1, memory_order_relaxed);
+		free(p);
+		return NULL;
+	}
+	atomic_fetch_add_explicit(&g_locked, size, memory_order_relaxed);
+	return p;
+}
+
+//>>>
+static void sys_free(void* p, uint32_t size) //<<<
+{
+	if (g_mlock) {
+		munlock(p, size);
+		atomic_fetch_sub_explicit(&g_locked, size, memory_order_relaxed);
+	}
+	free(p);
+}
+
+//>>>
+static void flush_cache(struct mem_cache* cache) //<<<
+{
+	for (int c=0; c<MEM_CLASSES; c++) {
+		const uint32_t	size = class_size(c);
+
+		while (cache->free[c]) {
+			struct mem_block*	b = cache->free[c];
+			cache->free[c] = b->next;
+			sys_free(b, size);
+			atomic_fetch_sub_explicit(&g_cached, size, memory_order_relaxed);
+		}
+		cache->count[c] = 0;
+	}
+}
+
+//>>>
+static void thread_exit_flush(ClientData cdata) //<<<
+{
+	flush_cache(&t_cache);
+	t_cache.state = CACHE_GONE;
+}
+
+//>>>
+static int mem_init(void) //<<<
+{
+	const long	page_size = sysconf(_SC_PAGESIZE);
+
+	if (page_size > 0) g_page_size = page_size;
+	return S2N_SUCCESS;
+}
+
+//>>>
+static int mem_cleanup(void) //<<<
+{
+	// Other threads' caches are released when they exit
+	if (t_cache.state == CACHE_ACTIVE) flush_cache(&t_cache);
+	return S2N_SUCCESS;
+}
+
+//>>>
+static int mem_malloc(void** ptr, uint32_t requested, uint32_t* allocated) //<<<
+{
+	int				c;
+	const uint32_t	size = block_size(requested, &c);
+	void*			p = NULL;
+
+	if (c >= 0) {
+		if (t_cache.state == CACHE_NONE) {
+			Tcl_CreateThreadExitHandler(thread_exit_flush, NULL);
+			t_cache.state = CACHE_ACTIVE;
+		}
+
+		if (t_cache.free[c]) {
+			struct mem_block*	b = t_cache.free[c];
+			t_cache.free[c] = b->next;
+			t_cache.count[c]--;
+			atomic_fetch_sub_explicit(&g_cached, size, memory_order_relaxed);
+			atomic_fetch_add_explicit(&g_pool_hits, 1, memory_order_relaxed);
+			p = b;
+		}
+	}
+
+	if (p == NULL) {
+		atomic_fetch_add_explicit(&g_pool_misses, 1, memory_order_relaxed);
+		p = sys_alloc(size);
+		if (p == NULL) return S2N_FAILURE;
+	}
+
+	atomic_fetch_add_explicit(&g_allocs, 1, memory_order_relaxed);
+	const int_fast64_t	in_use = atomic_fetch_add_explicit(&g_in_use, size, memory_order_relaxed) + size;
+	int_fast64_t		peak = atomic_load_explicit(&g_peak, memory_order_relaxed);
+	while (in_use > peak && !atomic_compare_exchange_weak_explicit(&g_peak, &peak, in_use, memory_order_relaxed, memory_order_relaxed));
+
+	*ptr = p;
+	*allocated = size;
+	return S2N_SUCCESS;
+}
+
+//>>>
+static int mem_free(void* ptr, uint32_t freed) //<<<
+{
+	int				c;
+	const uint32_t	size = block_size(freed, &c);		// What mem_malloc handed out, whichever size s2n passed
+
+	if (ptr == NULL) return S2N_SUCCESS;
+
+	atomic_fetch_add_explicit(&g_frees, 1, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&g_in_use, size, memory_order_relaxed);
+
+	if (
+		c >= 0 &&
+		t_cache.state == CACHE_ACTIVE &&
+		t_cache.count[c] < cache_limit(c)
+	) {
+		struct mem_block*	b = ptr;
+		b->next = t_cache.free[c];
+		t_cache.free[c] = b;
+		t_cache.count[c]++;
+		atomic_fetch_add_explicit(&g_cached, size, memory_order_relaxed);
+		return S2N_SUCCESS;
+	}
+
+	sys_free(ptr, size);
+	return S2N_SUCCESS;
+}
+
+//>>>
+int mem_install(void) //<<<
+{
+	static int	mlock_checked = 0;
+
+	// Decided once per process: blocks cached from a previous s2n_init must match
+	if (!mlock_checked) {
+		g_mlock = getenv("S2N_DONT_MLOCK") == NULL;
+		mlock_checked = 1;
+	}
+
+	return s2n_mem_set_callbacks(mem_init, mem_cleanup, mem_malloc, mem_free);
+}
+
+//>>>
+Tcl_Obj* mem_stats(void) //<<<
+{
+	Tcl_Obj*	res = Tcl_NewDictObj();
+
+#define STAT(name, var) \
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj(name, -1), Tcl_NewWideIntObj(atomic_load_explicit(&var, memory_order_relaxed)))
+	STAT("in_use",			g_in_use);
+	STAT("peak",			g_peak);
+	STAT("cached",			g_cached);
+	STAT("locked",			g_locked);
+	STAT("allocs",			g_allocs);
+	STAT("frees",			g_frees);
+	STAT("pool_hits",		g_pool_hits);
+	STAT("pool_misses",		g_pool_misses);
+	STAT("mlock_failures",	g_mlock_failures);
+#undef STAT
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("mlock", -1), Tcl_NewBooleanObj(g_mlock));
+
+	return res;
+}
+
+//>>>
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
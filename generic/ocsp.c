@@ -0,0 +1,468 @@
+#include "s2nInt.h"
+#include <openssl/asn1.h>
+#include <openssl/err.h>
+#include <openssl/ocsp.h>
+#include <pthread.h>
+
+// OCSP stapling for server certificate chains.  The response is fetched (from
+// a file or by calling a script) when the config is created and then again by
+// a timer in the config's thread, halfway to the response's nextUpdate unless
+// a fixed refresh interval is given.  The handshake only ever reads the copy
+// s2n holds on the cert chain, so fetching never happens on the accept path.
+// If a refresh fails the previous response stays stapled (until it expires)
+// and the fetch is retried shortly.
+//
+// The config is shared with other threads (listener groups, transferred
+// channels, the offload I/O thread), so handshakes anywhere may be reading
+// the staple when a refresh replaces it.  Each config with staplers has a
+// lock, which handshakes hold for reading around s2n_negotiate while their
+// connection uses that config (the SNI callback moves it to the config it
+// switches to), so handshakes on configs without staplers take no lock at
+// all.  The refresh swaps the response only when it can take the lock for
+// writing, trying again shortly if it can't rather than stalling its
+// thread, and after OCSP_BUSY_TRIES waits for it: the lock prefers writers,
+// so a steady stream of handshakes can't starve it.  The timer and interp
+// belong to the thread that created the stapler: freed from another
+// thread, it is marked dead (so a refresh already due leaves the chain
+// alone) and the owner thread is sent an event to finish the job.
+
+#define OCSP_RETRY_SECS		60
+#define OCSP_BUSY_RETRY_MS	50			// Handshakes were reading the staple
+#define OCSP_BUSY_TRIES		20			// Then block for the lock
+#define OCSP_MIN_REFRESH	60
+#define OCSP_MAX_REFRESH	(24 * 3600)
+#define OCSP_DEFAULT_REFRESH	3600		// When the response has no nextUpdate
+
+struct ocsp_lock {
+	pthread_rwlock_t	rw;
+};
+
+struct ocsp_stapler {
+	struct s2n_cert_chain_and_key*	chain;
+	struct ocsp_lock*	lock;			// The config's, which outlives the stapler's use of it
+	Tcl_Interp*			interp;			// Preserved, for script callbacks and background errors
+	Tcl_ThreadId		owner;			// The thread interp, the timer and the Tcl_Objs belong to
+	Tcl_Obj*			file;
+	Tcl_Obj*			command;
+	int					refresh;		// Seconds, or 0 to derive from the response's nextUpdate
+	int64_t				expires;		// wall_usec() of the stapled response's nextUpdate, 0 if none
+	Tcl_Obj*			pending;		// Fetched response waiting to be swapped in, empty to unstaple
+	int64_t				pending_expires;
+	int					pending_refresh;
+	int					busy_tries;		// Swaps of pending that found the lock in use
+	Tcl_TimerToken		timer;
+
+	// Guarded by g_ocsp_mutex
+	int					dead;			// Freed from another thread, the owner hasn't finished it yet
+	int					owner_gone;		// The owner thread has exited
+};
+
+struct ocsp_free_ev {
+	Tcl_Event				ev;
+	struct ocsp_stapler*	s;
+};
+
+static void owner_exit(ClientData cdata);
+
+TCL_DECLARE_MUTEX(g_ocsp_mutex);
+static _Thread_local struct ocsp_lock*	t_held = NULL;		// Read locked by this thread's handshake
+
+static int fetch(Tcl_Interp* interp, struct ocsp_stapler* s, Tcl_Obj** der) //<<<
+{
+	int				code = TCL_OK;
+	Tcl_Channel		chan = NULL;
+	Tcl_Obj*		res = NULL;
+
+	if (s->file) {
+		chan = Tcl_FSOpenFileChannel(interp, s->file, "r", 0);
+		if (chan == NULL) {
+			code = TCL_ERROR;
+			goto finally;
+		}
+		TEST_OK_LABEL(finally, code, Tcl_SetChannelOption(interp, chan, "-translation", "binary"));
+		replace_tclobj(&res, Tcl_NewObj());
+		if (Tcl_ReadChars(chan, res, -1, 0) < 0) THROW_POSIX_LABEL(finally, code, "Could not read OCSP response");
+	} else {
+		TEST_OK_LABEL(finally, code, Tcl_EvalObjEx(interp, s->command, TCL_EVAL_GLOBAL));
+		replace_tclobj(&res, Tcl_GetObjResult(interp));
+		Tcl_ResetResult(interp);
+	}
+
+	replace_tclobj(der, res);
+
+finally:
+	if (chan) {
+		const int rc = Tcl_Close(interp, chan);
+		if (code == TCL_OK) code = rc;
+		chan = NULL;
+	}
+	replace_tclobj(&res, NULL);
+	return code;
+}
+
+//>>>
+static int parse(Tcl_Interp* interp, struct ocsp_stapler* s, Tcl_Obj* der, int64_t* expires, int* next_refresh) //<<<
+{
+	int						code = TCL_OK;
+	Tcl_Size				len;
+	const unsigned char*	bytes = Tcl_GetByteArrayFromObj(der, &len);
+	const unsigned char*	p = bytes;
+	OCSP_RESPONSE*			resp = NULL;
+	OCSP_BASICRESP*			basic = NULL;
+	ASN1_GENERALIZEDTIME*	next_update = NULL;
+	int64_t					remaining = -1;		// Seconds until nextUpdate, -1 if there isn't one
+
+	// Check it's a response worth stapling, and when it expires
+	resp = d2i_OCSP_RESPONSE(NULL, &p, len);
+	if (resp == NULL) THROW_ERROR_LABEL(finally, code, "Could not parse OCSP response");
+	if (OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL)
+		THROW_PRINTF_LABEL(finally, code, "OCSP response status is %d", OCSP_response_status(resp));
+	basic = OCSP_response_get1_basic(resp);
+	if (basic == NULL || OCSP_resp_count(basic) < 1) THROW_ERROR_LABEL(finally, code, "OCSP response has no status");
+	OCSP_single_get0_status(OCSP_resp_get0(basic, 0), NULL, NULL, NULL, &next_update);
+	if (next_update) {
+		int		days, secs;
+		if (!ASN1_TIME_diff(&days, &secs, NULL, next_update)) THROW_ERROR_LABEL(finally, code, "Could not read OCSP nextUpdate");
+		if (days < 0 || secs < 0 || (days == 0 && secs == 0)) THROW_ERROR_LABEL(finally, code, "OCSP response has expired");
+		remaining = (int64_t)days * 86400 + secs;
+	}
+
+	*expires = next_update ? wall_usec() + remaining * 1000000 : 0;
+
+	if (s->refresh) {
+		*next_refresh = s->refresh;
+	} else if (remaining == -1) {
+		*next_refresh = OCSP_DEFAULT_REFRESH;
+	} else {
+		*next_refresh =
+			remaining / 2 < OCSP_MIN_REFRESH ? OCSP_MIN_REFRESH :
+			remaining / 2 > OCSP_MAX_REFRESH ? OCSP_MAX_REFRESH :
+			remaining / 2;
+	}
+
+finally:
+	ERR_clear_error();
+	if (basic) {
+		OCSP_BASICRESP_free(basic);
+		basic = NULL;
+	}
+	if (resp) {
+		OCSP_RESPONSE_free(resp);
+		resp = NULL;
+	}
+	return code;
+}
+
+//>>>
+static int fetch_pending(Tcl_Interp* interp, struct ocsp_stapler* s) //<<<
+{
+	int			code = TCL_OK;
+	Tcl_Obj*	der = NULL;
+
+	TEST_OK_LABEL(finally, code, fetch(interp, s, &der));
+	TEST_OK_LABEL(finally, code, parse(interp, s, der, &s->pending_expires, &s->pending_refresh));
+	replace_tclobj(&s->pending, der);
+
+finally:
+	replace_tclobj(&der, NULL);
+	return code;
+}
+
+//>>>
+enum swap_result {
+	SWAP_DONE,
+	SWAP_BUSY,			// Handshakes are reading the current response
+	SWAP_DEAD,			// The config is being freed, and the chain with it
+	SWAP_FAILED,
+};
+
+static enum swap_result swap_pending(struct ocsp_stapler* s) //<<<
+{
+	enum swap_result		res;
+	Tcl_Size				len;
+	const unsigned char*	bytes = Tcl_GetByteArrayFromObj(s->pending, &len);
+
+	// Under g_ocsp_mutex so that the config (and its lock) can't be freed
+	// from another thread meanwhile.  Waiting for the lock there only holds
+	// up frees, for as long as the s2n_negotiate calls in progress take.
+	Tcl_MutexLock(&g_ocsp_mutex);
+	if (s->dead) {
+		res = SWAP_DEAD;
+	} else if (
+		s->busy_tries < OCSP_BUSY_TRIES ?
+			pthread_rwlock_trywrlock(&s->lock->rw) != 0 :
+			pthread_rwlock_wrlock(&s->lock->rw) != 0
+	) {
+		res = SWAP_BUSY;
+	} else {
+		res = s2n_cert_chain_and_key_set_ocsp_data(s->chain, len ? bytes : NULL, len) == S2N_SUCCESS ? SWAP_DONE : SWAP_FAILED;
+		pthread_rwlock_unlock(&s->lock->rw);
+	}
+	Tcl_MutexUnlock(&g_ocsp_mutex);
+
+	s->busy_tries = res == SWAP_BUSY ? s->busy_tries + 1 : 0;
+	return res;
+}
+
+//>>>
+static void refresh_timer(ClientData cdata) //<<<
+{
+	struct ocsp_stapler*	s = cdata;
+	Tcl_Interp*				interp = s->interp;
+	int						next_ms = OCSP_RETRY_SECS * 1000;
+
+	s->timer = NULL;
+	if (Tcl_InterpDeleted(interp)) return;		// Nothing left to run callbacks or report errors in
+
+	Tcl_Preserve(interp);
+	if (s->pending == NULL) {
+		const int	code = fetch_pending(interp, s);
+		if (code != TCL_OK) {
+			Tcl_AddErrorInfo(interp, "\n    (refreshing OCSP response)");
+			Tcl_BackgroundException(interp, code);
+
+			if (s->expires && wall_usec() >= s->expires) {
+				// Stapling an expired response would fail clients that check it, better none at all
+				replace_tclobj(&s->pending, Tcl_NewObj());
+				s->pending_expires = 0;
+				s->pending_refresh = OCSP_RETRY_SECS;
+			}
+		}
+	}
+
+	if (s->pending) {
+		switch (swap_pending(s)) {
+			case SWAP_DONE:
+				s->expires = s->pending_expires;
+				next_ms = s->pending_refresh * 1000;
+				replace_tclobj(&s->pending, NULL);
+				break;
+			case SWAP_BUSY:
+				next_ms = OCSP_BUSY_RETRY_MS;
+				break;
+			case SWAP_DEAD:
+				goto done;		// The free event will be along
+			case SWAP_FAILED:
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("Could not staple OCSP response: %s", s2n_strerror(s2n_errno, "EN")));
+				Tcl_AddErrorInfo(interp, "\n    (refreshing OCSP response)");
+				Tcl_BackgroundException(interp, TCL_ERROR);
+				replace_tclobj(&s->pending, NULL);
+				break;
+		}
+	}
+	s->timer = Tcl_CreateTimerHandler(next_ms, refresh_timer, s);
+
+done:
+	Tcl_Release(interp);
+}
+
+//>>>
+static void release_owned(struct ocsp_stapler* s) //<<<
+{
+	// What belongs to the owner thread, in the owner thread
+	if (s->timer) {
+		Tcl_DeleteTimerHandler(s->timer);
+		s->timer = NULL;
+	}
+	replace_tclobj(&s->file, NULL);
+	replace_tclobj(&s->command, NULL);
+	replace_tclobj(&s->pending, NULL);
+	if (s->interp) {
+		Tcl_Release(s->interp);
+		s->interp = NULL;
+	}
+}
+
+//>>>
+static void stapler_free(struct ocsp_stapler* s) //<<<
+{
+	ckfree(s);
+}
+
+//>>>
+static int free_ev_proc(Tcl_Event* ev, int flags) //<<<
+{
+	// In the owner thread, for a stapler freed in another
+	struct ocsp_stapler*	s = ((struct ocsp_free_ev*)ev)->s;
+
+	Tcl_DeleteThreadExitHandler(owner_exit, s);
+	release_owned(s);
+	stapler_free(s);
+	return 1;
+}
+
+//>>>
+static int free_ev_match(Tcl_Event* ev, ClientData cdata) //<<<
+{
+	return ev->proc == free_ev_proc && ((struct ocsp_free_ev*)ev)->s == cdata;
+}
+
+//>>>
+static void owner_exit(ClientData cdata) //<<<
+{
+	// The owner thread is exiting: its timer and interp go with it, and a
+	// free event it hasn't serviced never will be
+	struct ocsp_stapler*	s = cdata;
+
+	Tcl_MutexLock(&g_ocsp_mutex);
+	s->owner_gone = 1;
+	const int	dead = s->dead;
+	Tcl_MutexUnlock(&g_ocsp_mutex);
+
+	release_owned(s);
+	if (dead) {
+		Tcl_DeleteEvents(free_ev_match, s);
+		stapler_free(s);
+	}
+}
+
+//>>>
+int ocsp_stapler_new(Tcl_Interp* interp, struct config_cx* cfg, struct s2n_cert_chain_and_key* chain, Tcl_Obj* spec, struct ocsp_stapler** res) //<<<
+{
+	int						code = TCL_OK;
+	struct ocsp_stapler*	s = (struct ocsp_stapler*)ckalloc(sizeof *s);
+	Tcl_DictSearch			search = {0};
+	Tcl_Obj*				k;
+	Tcl_Obj*				v;
+	int						done;
+	int						next_refresh;
+	static const char* keys[] = {"file", "command", "refresh", NULL};
+	enum {K_FILE, K_COMMAND, K_REFRESH};
+
+	if (cfg->ocsp_lock == NULL) {
+		// Nothing can be handshaking with cfg yet, handshakes see the lock from the first one
+		pthread_rwlockattr_t	attr;
+
+		cfg->ocsp_lock = (struct ocsp_lock*)ckalloc(sizeof *cfg->ocsp_lock);
+		pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+		pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+		pthread_rwlock_init(&cfg->ocsp_lock->rw, &attr);
+		pthread_rwlockattr_destroy(&attr);
+	}
+
+	*s = (struct ocsp_stapler){
+		.chain	= chain,
+		.lock	= cfg->ocsp_lock,
+		.interp	= interp,
+		.owner	= Tcl_GetCurrentThread(),
+	};
+	Tcl_Preserve(s->interp);
+	Tcl_CreateThreadExitHandler(owner_exit, s);
+
+	TEST_OK_LABEL(finally, code, Tcl_DictObjFirst(interp, spec, &search, &k, &v, &done));
+	for (; !done; Tcl_DictObjNext(&search, &k, &v, &done)) {
+		int		idx;
+		TEST_OK_LABEL(finally, code, Tcl_GetIndexFromObj(interp, k, keys, "ocsp source", TCL_EXACT, &idx));
+		switch (idx) {
+			case K_FILE:	replace_tclobj(&s->file, v);	break;
+			case K_COMMAND:	replace_tclobj(&s->command, v);	break;
+			case K_REFRESH:
+				TEST_OK_LABEL(finally, code, Tcl_GetIntFromObj(interp, v, &s->refresh));
+				if (s->refresh < 1) THROW_ERROR_LABEL(finally, code, "ocsp refresh must be a positive number of seconds");
+				break;
+		}
+	}
+	if ((s->file == NULL) == (s->command == NULL)) THROW_ERROR_LABEL(finally, code, "ocsp needs exactly one of file or command");
+
+	// The first response is fetched now, so that the config staples from its
+	// first handshake.  Nothing can be using chain yet, so no need for the lock.
+	TEST_OK_LABEL(finally, code, fetch_pending(interp, s));
+	{
+		Tcl_Size				len;
+		const unsigned char*	bytes = Tcl_GetByteArrayFromObj(s->pending, &len);
+		CHECK_S2N(finally, code, s2n_cert_chain_and_key_set_ocsp_data(s->chain, bytes, len));
+	}
+	s->expires = s->pending_expires;
+	next_refresh = s->pending_refresh;
+	replace_tclobj(&s->pending, NULL);
+	s->timer = Tcl_CreateTimerHandler(next_refresh * 1000, refresh_timer, s);
+
+	*res = s;
+	s = NULL;
+
+finally:
+	Tcl_DictObjDone(&search);
+	if (s) {
+		ocsp_stapler_free(s);
+		s = NULL;
+	}
+	return code;
+}
+
+//>>>
+void ocsp_stapler_free(struct ocsp_stapler* s) //<<<
+{
+	// Called with the last ref to the config, from whichever thread that is,
+	// before the chain is freed
+	if (s->owner == Tcl_GetCurrentThread()) {
+		Tcl_DeleteThreadExitHandler(owner_exit, s);
+		release_owned(s);
+		stapler_free(s);
+		return;
+	}
+
+	Tcl_MutexLock(&g_ocsp_mutex);
+	s->dead = 1;
+	const int	gone = s->owner_gone;
+	if (!gone) {
+		struct ocsp_free_ev*	ev = (struct ocsp_free_ev*)ckalloc(sizeof *ev);
+		*ev = (struct ocsp_free_ev){.ev.proc = free_ev_proc, .s = s};
+		Tcl_ThreadQueueEvent(s->owner, &ev->ev, TCL_QUEUE_TAIL);
+		Tcl_ThreadAlert(s->owner);
+	}
+	Tcl_MutexUnlock(&g_ocsp_mutex);
+
+	if (gone) stapler_free(s);		// owner_exit has released the rest
+}
+
+//>>>
+void ocsp_lock_free(struct ocsp_lock* lock) //<<<
+{
+	// After the config's staplers have been freed
+	pthread_rwlock_destroy(&lock->rw);
+	ckfree(lock);
+}
+
+//>>>
+static void hold(struct config_cx* cfg) //<<<
+{
+	struct ocsp_lock*	lock = cfg ? cfg->ocsp_lock : NULL;
+
+	if (t_held == lock) return;
+	if (t_held) pthread_rwlock_unlock(&t_held->rw);
+	t_held = lock;
+	if (t_held) pthread_rwlock_rdlock(&t_held->rw);
+}
+
+//>>>
+void ocsp_handshake_enter(struct s2n_connection* s2n_con) //<<<
+{
+	// Around s2n_negotiate: hold off refreshes from swapping a staple s2n
+	// might be reading, for the config the connection is using now (an
+	// earlier call may have switched it for SNI)
+	struct s2n_config*	config = NULL;
+	void*				ctx = NULL;
+
+	if (s2n_connection_get_config(s2n_con, &config) == S2N_SUCCESS && config)
+		s2n_config_get_ctx(config, &ctx);
+	hold(ctx);
+}
+
+//>>>
+void ocsp_handshake_switch(struct config_cx* cfg) //<<<
+{
+	// Inside s2n_negotiate: the connection is switching to cfg, whose staples it will read
+	hold(cfg);
+}
+
+//>>>
+void ocsp_handshake_leave(void) //<<<
+{
+	hold(NULL);
+}
+
+//>>>
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
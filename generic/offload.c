@@ -0,0 +1,704 @@
+#include "s2nInt.h"
+
+// Offloaded direct channels.  Once a direct channel has completed its
+// handshake it can be handed to a background I/O thread, which from then on
+// owns the socket and the s2n connection: it runs an epoll loop over all
+// offloaded connections, doing the syscalls and the record encryption and
+// decryption, and exchanges plaintext buffers with the channel's thread
+// through a pair of single producer, single consumer queues per connection.
+// The channel driver only moves buffers in and out of the queues, so the
+// crypto runs in parallel with script execution.
+//
+// The I/O thread is woken by an eventfd when a channel queues data to send,
+// makes room in a full receive queue, or is closed, and it wakes the
+// channel's thread by queueing an event there (or by signalling a condition
+// when the channel is blocked in a read or write).  A closed channel's
+// connection stays in the epoll set while the I/O thread sends what was
+// left queued and the close_notify, for up to the channel's -linger time,
+// and then it hands con_cx back to the channel's thread to be freed, since
+// its timers, admission state and config refs belong to that thread.
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define OFFLOAD_BUF			16384	// Plaintext per receive buffer, a full record
+#define OFFLOAD_SLOTS		64		// Buffers per queue, a power of 2
+#define OFFLOAD_EVENTS		64
+
+struct iobuf {
+	uint32_t		len;
+	uint32_t		off;
+	uint8_t			data[];
+};
+
+// Lock-free single producer, single consumer ring of buffers
+struct spsc {
+	atomic_uint		head;		// Next slot to consume, written by the consumer
+	atomic_uint		tail;		// Next slot to fill, written by the producer
+	struct iobuf*	slots[OFFLOAD_SLOTS];
+};
+
+struct offload {
+	atomic_int				refcount;		// The channel, the I/O thread, and each queued notify event
+	struct con_cx*			con_cx;
+	int						fd;
+	atomic_uintptr_t		owner;			// Tcl_ThreadId of the channel's thread
+
+	struct spsc				rx;				// I/O thread -> channel
+	struct spsc				tx;				// Channel -> I/O thread
+	struct iobuf*			rx_cur;			// Channel side: partly read receive buffer
+	atomic_int				rx_paused;		// I/O thread stopped reading because rx was full
+	atomic_int				eof;			// I/O thread saw the end of the stream (after what's in rx)
+	atomic_int				error;			// errno from the I/O thread, 0 if none
+
+	atomic_int				kicked;			// On the I/O thread's kick list
+	atomic_int				notify_pending;	// Notify event queued to the channel's thread
+	atomic_int				closing;		// Channel closed, the I/O thread finishes up
+	atomic_int				waiting;		// Channel thread blocked on cond
+	Tcl_Mutex				mutex;
+	Tcl_Condition			cond;
+	int						watch_mask;		// Channel side
+
+	// I/O thread side
+	int						in_epoll;
+	int						lingering;		// Closed, sending what's left: on g_io.lingering
+	int64_t					linger_deadline;	// mono_usec to give up on that
+	struct iobuf*			rx_spare;
+	struct offload*			next_kick;		// Under g_io.mutex
+	struct offload*			prev;			// Attached or lingering list
+	struct offload*			next;
+};
+
+struct offload_ev {
+	Tcl_Event				ev;
+	struct offload*			o;
+};
+
+static struct {
+	Tcl_Mutex				mutex;
+	int						started;
+	int						quit;
+	int						epfd;
+	int						evfd;
+	Tcl_ThreadId			thread;
+	struct offload*			kicks;			// Under mutex
+	struct offload*			attached;		// I/O thread only
+	struct offload*			lingering;		// I/O thread only
+} g_io = {
+	.epfd	= -1,
+	.evfd	= -1,
+};
+
+static inline int spsc_empty(struct spsc* q) //<<<
+{
+	return atomic_load_explicit(&q->head, memory_order_acquire) == atomic_load_explicit(&q->tail, memory_order_acquire);
+}
+
+//>>>
+static inline int spsc_full(struct spsc* q) //<<<
+{
+	return atomic_load_explicit(&q->tail, memory_order_acquire) - atomic_load_explicit(&q->head, memory_order_acquire) == OFFLOAD_SLOTS;
+}
+
+//>>>
+static inline int spsc_push(struct spsc* q, struct iobuf* b) //<<<
+{
+	const unsigned	t = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	const unsigned	h = atomic_load_explicit(&q->head, memory_order_acquire);
+
+	if (t - h == OFFLOAD_SLOTS) return 0;
+	q->slots[t & (OFFLOAD_SLOTS-1)] = b;
+	atomic_store_explicit(&q->tail, t+1, memory_order_release);
+	return 1;
+}
+
+//>>>
+static inline struct iobuf* spsc_peek(struct spsc* q) //<<<
+{
+	const unsigned	h = atomic_load_explicit(&q->head, memory_order_relaxed);
+	const unsigned	t = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+	return h == t ? NULL : q->slots[h & (OFFLOAD_SLOTS-1)];
+}
+
+//>>>
+static inline void spsc_pop(struct spsc* q) //<<<
+{
+	atomic_fetch_add_explicit(&q->head, 1, memory_order_release);
+}
+
+//>>>
+static void offload_decref(struct offload* o) //<<<
+{
+	struct iobuf*	b;
+
+	if (atomic_fetch_sub_explicit(&o->refcount, 1, memory_order_acq_rel) != 1) return;
+
+	while ((b = spsc_peek(&o->rx))) { spsc_pop(&o->rx); ckfree(b); }
+	while ((b = spsc_peek(&o->tx))) { spsc_pop(&o->tx); ckfree(b); }
+	if (o->rx_cur)   ckfree(o->rx_cur);
+	if (o->rx_spare) ckfree(o->rx_spare);
+	Tcl_MutexFinalize(&o->mutex);
+	Tcl_ConditionFinalize(&o->cond);
+	ckfree(o);
+}
+
+//>>>
+static void wake_io(void) //<<<
+{
+	const uint64_t	one = 1;
+	ssize_t			rc;
+
+	do {
+		rc = write(g_io.evfd, &one, sizeof one);
+	} while (rc == -1 && errno == EINTR);
+}
+
+//>>>
+static void kick(struct offload* o) //<<<
+{
+	// Ask the I/O thread to service this connection
+	if (atomic_exchange(&o->kicked, 1)) return;
+
+	Tcl_MutexLock(&g_io.mutex);
+	o->next_kick = g_io.kicks;
+	g_io.kicks = o;
+	Tcl_MutexUnlock(&g_io.mutex);
+	wake_io();
+}
+
+//>>>
+static int ready_mask(struct offload* o) //<<<
+{
+	int		mask = 0;
+
+	if (o->rx_cur || !spsc_empty(&o->rx) || atomic_load(&o->eof) || atomic_load(&o->error)) mask |= TCL_READABLE;
+	if (!spsc_full(&o->tx) || atomic_load(&o->error)) mask |= TCL_WRITABLE;
+
+	return mask;
+}
+
+//>>>
+static int notify_proc(Tcl_Event* ev, int flags) //<<<
+{
+	struct offload*	o = ((struct offload_ev*)ev)->o;
+
+	if (!(flags & TCL_FILE_EVENTS)) return 0;
+
+	const Tcl_ThreadId	owner = (Tcl_ThreadId)atomic_load(&o->owner);
+	if (owner != Tcl_GetCurrentThread() && !atomic_load(&o->closing)) {
+		// The channel moved to another thread since this was queued, follow it
+		struct offload_ev*	fwd = ckalloc(sizeof *fwd);
+		*fwd = (struct offload_ev){.ev.proc = notify_proc, .o = o};
+		Tcl_ThreadQueueEvent(owner, &fwd->ev, TCL_QUEUE_TAIL);
+		Tcl_ThreadAlert(owner);
+		return 1;
+	}
+
+	atomic_store(&o->notify_pending, 0);
+	if (!atomic_load(&o->closing)) {
+		const int	mask = ready_mask(o) & o->watch_mask;
+		if (mask) Tcl_NotifyChannel(o->con_cx->chan, mask);
+	}
+	offload_decref(o);
+	return 1;
+}
+
+//>>>
+static void notify(struct offload* o) //<<<
+{
+	// Tell the channel's thread that the queues have changed
+	if (atomic_load(&o->waiting)) {
+		Tcl_MutexLock(&o->mutex);
+		Tcl_ConditionNotify(&o->cond);
+		Tcl_MutexUnlock(&o->mutex);
+	}
+
+	if (atomic_exchange(&o->notify_pending, 1)) return;
+
+	const Tcl_ThreadId	owner = (Tcl_ThreadId)atomic_load(&o->owner);
+	struct offload_ev*	ev = ckalloc(sizeof *ev);
+	*ev = (struct offload_ev){.ev.proc = notify_proc, .o = o};
+	atomic_fetch_add(&o->refcount, 1);
+	Tcl_ThreadQueueEvent(owner, &ev->ev, TCL_QUEUE_TAIL);
+	Tcl_ThreadAlert(owner);
+}
+
+//>>>
+static void wait_for(struct offload* o, int want) //<<<
+{
+	// Blocking channels: wait until the I/O thread makes the channel ready for want
+	Tcl_MutexLock(&o->mutex);
+	atomic_store(&o->waiting, 1);
+	while (!(ready_mask(o) & want))
+		Tcl_ConditionWait(&o->cond, &o->mutex, NULL);
+	atomic_store(&o->waiting, 0);
+	Tcl_MutexUnlock(&o->mutex);
+}
+
+//>>>
+static int teardown_proc(Tcl_Event* ev, int flags) //<<<
+{
+	// In the channel's thread, once the I/O thread is done with the connection
+	struct offload*	o = ((struct offload_ev*)ev)->o;
+	struct con_cx*	con_cx = o->con_cx;
+
+	con_cx->offload = NULL;
+	o->con_cx = NULL;
+	free_con_cx(con_cx);
+	offload_decref(o);		// The channel's ref
+	return 1;
+}
+
+//>>>
+
+// I/O thread <<<
+static void list_unlink(struct offload** head, struct offload* o) //<<<
+{
+	if (o->prev) o->prev->next = o->next; else *head = o->next;
+	if (o->next) o->next->prev = o->prev;
+	o->prev = o->next = NULL;
+}
+
+//>>>
+static void list_push(struct offload** head, struct offload* o) //<<<
+{
+	o->prev = NULL;
+	o->next = *head;
+	if (o->next) o->next->prev = o;
+	*head = o;
+}
+
+//>>>
+static int finish_step(struct offload* o) //<<<
+{
+	// Send what the closed channel left queued, then the close_notify.
+	// Returns 0 while the socket is full (EPOLLOUT calls again), 1 when
+	// done or when it can't be done.
+	struct con_cx*		con_cx = o->con_cx;
+	s2n_blocked_status	blocked = S2N_NOT_BLOCKED;
+	struct iobuf*		b;
+
+	if (atomic_load(&o->error)) return 1;
+
+	while ((b = spsc_peek(&o->tx))) {
+		const ssize_t	w = s2n_send(con_cx->s2n_con, b->data + b->off, b->len - b->off, &blocked);
+		if (w < 0) return s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED;
+		b->off += w;
+		if (b->off == b->len) {
+			spsc_pop(&o->tx);
+			ckfree(b);
+		}
+	}
+
+	if (s2n_shutdown_send(con_cx->s2n_con, &blocked) == S2N_SUCCESS) return 1;
+	return s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED;
+}
+
+//>>>
+static void finish_done(struct offload* o) //<<<
+{
+	// Close the socket and hand con_cx back to be freed
+	epoll_ctl(g_io.epfd, EPOLL_CTL_DEL, o->fd, NULL);
+	close(o->fd);
+
+	list_unlink(o->lingering ? &g_io.lingering : &g_io.attached, o);
+
+	// The channel was closed in its owning thread, so owner can't change any more
+	const Tcl_ThreadId	owner = (Tcl_ThreadId)atomic_load(&o->owner);
+	struct offload_ev*	ev = ckalloc(sizeof *ev);
+	*ev = (struct offload_ev){.ev.proc = teardown_proc, .o = o};
+	Tcl_ThreadQueueEvent(owner, &ev->ev, TCL_QUEUE_TAIL);
+	Tcl_ThreadAlert(owner);
+	offload_decref(o);		// The I/O thread's
+}
+
+//>>>
+static void finish(struct offload* o) //<<<
+{
+	// The channel was closed: keep the socket in the epoll set until what it
+	// left queued and the close_notify have gone, or its -linger time is up
+	if (!o->lingering) {
+		list_unlink(&g_io.attached, o);
+		list_push(&g_io.lingering, o);
+		o->lingering = 1;
+		o->linger_deadline = mono_usec() + (int64_t)o->con_cx->linger_ms * 1000;
+	}
+
+	if (finish_step(o) || mono_usec() >= o->linger_deadline) finish_done(o);
+}
+
+//>>>
+static int linger_timeout(void) //<<<
+{
+	// Abandons lingering connections that are out of time, and returns the
+	// epoll_wait timeout until the next one is
+	const int64_t	now = mono_usec();
+	int64_t			next = -1;
+	struct offload*	o = g_io.lingering;
+
+	while (o) {
+		struct offload*	next_o = o->next;		// finish_done only unlinks o
+		if (o->linger_deadline <= now) {
+			finish_done(o);
+		} else if (next == -1 || o->linger_deadline < next) {
+			next = o->linger_deadline;
+		}
+		o = next_o;
+	}
+
+	return next == -1 ? -1 : (int)((next - now + 999) / 1000);
+}
+
+//>>>
+static void service(struct offload* o) //<<<
+{
+	struct con_cx*		con_cx = o->con_cx;
+	s2n_blocked_status	blocked = S2N_NOT_BLOCKED;
+	struct iobuf*		b;
+	int					changed = 0;
+
+	if (o->lingering) {
+		finish(o);
+		return;
+	}
+
+	// A newly closed channel is finished from the kick list, which it is always on
+	if (atomic_load(&o->closing) || atomic_load(&o->error)) return;
+
+	// Send what the channel has queued
+	while ((b = spsc_peek(&o->tx))) {
+		const ssize_t	w = s2n_send(con_cx->s2n_con, b->data + b->off, b->len - b->off, &blocked);
+		if (w >= 0) {
+			b->off += w;
+			if (b->off == b->len) {
+				spsc_pop(&o->tx);
+				ckfree(b);
+				changed = 1;
+			}
+		} else {
+			if (s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED) {
+				atomic_store(&o->error, s2n_error_get_type(s2n_errno) == S2N_ERR_T_IO && errno ? errno : EIO);
+				changed = 1;
+			}
+			break;
+		}
+	}
+
+	// Receive while there's room for it
+	atomic_store(&o->rx_paused, 0);
+	while (!atomic_load(&o->eof) && !atomic_load(&o->error)) {
+		if (spsc_full(&o->rx)) {
+			atomic_store(&o->rx_paused, 1);
+			break;
+		}
+		if (o->rx_spare == NULL) o->rx_spare = ckalloc(sizeof(struct iobuf) + OFFLOAD_BUF);
+		const ssize_t	got = s2n_recv(con_cx->s2n_con, o->rx_spare->data, OFFLOAD_BUF, &blocked);
+		if (got > 0) {
+			o->rx_spare->len = got;
+			o->rx_spare->off = 0;
+			spsc_push(&o->rx, o->rx_spare);
+			o->rx_spare = NULL;
+			changed = 1;
+		} else if (got == 0) {
+			atomic_store(&o->eof, 1);
+			changed = 1;
+		} else {
+			switch (s2n_error_get_type(s2n_errno)) {
+				case S2N_ERR_T_BLOCKED:
+					break;
+				case S2N_ERR_T_CLOSED:
+					atomic_store(&o->eof, 1);
+					changed = 1;
+					break;
+				default:
+					atomic_store(&o->error, s2n_error_get_type(s2n_errno) == S2N_ERR_T_IO && errno ? errno : EIO);
+					changed = 1;
+					break;
+			}
+			break;
+		}
+	}
+
+	if (changed) {
+		atomic_thread_fence(memory_order_seq_cst);
+		notify(o);
+	}
+}
+
+//>>>
+static Tcl_ThreadCreateType io_thread(ClientData cdata) //<<<
+{
+	struct epoll_event	evs[OFFLOAD_EVENTS];
+	int					timeout = -1;
+
+	for (;;) {
+		const int	n = epoll_wait(g_io.epfd, evs, OFFLOAD_EVENTS, timeout);
+
+		for (int i=0; i<n; i++) {
+			if (evs[i].data.ptr == NULL) {
+				uint64_t	v;
+				while (read(g_io.evfd, &v, sizeof v) == -1 && errno == EINTR);
+			} else {
+				service((struct offload*)evs[i].data.ptr);
+			}
+		}
+
+		Tcl_MutexLock(&g_io.mutex);
+		struct offload*	kicks = g_io.kicks;
+		const int		quit = g_io.quit;
+		g_io.kicks = NULL;
+		Tcl_MutexUnlock(&g_io.mutex);
+
+		while (kicks) {
+			struct offload*	o = kicks;
+			kicks = o->next_kick;
+			atomic_store(&o->kicked, 0);
+			if (!o->in_epoll) {
+				// Newly offloaded
+				struct epoll_event	ev = {
+					.events		= EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+					.data.ptr	= o,
+				};
+				if (epoll_ctl(g_io.epfd, EPOLL_CTL_ADD, o->fd, &ev) == -1) atomic_store(&o->error, errno);
+				o->in_epoll = 1;
+				list_push(&g_io.attached, o);
+			}
+			if (atomic_load(&o->closing)) {
+				finish(o);
+			} else {
+				service(o);
+			}
+		}
+
+		if (quit) {
+			while (g_io.lingering) finish_done(g_io.lingering);
+			break;
+		}
+		timeout = linger_timeout();
+	}
+
+	TCL_THREAD_CREATE_RETURN;
+}
+
+//>>>
+// I/O thread >>>
+
+static int start_io_thread(Tcl_Interp* interp) //<<<
+{
+	int		code = TCL_OK;
+
+	Tcl_MutexLock(&g_io.mutex);
+	if (g_io.started) goto finally;
+
+	g_io.epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (g_io.epfd == -1) THROW_POSIX_LABEL(finally, code, "Could not create epoll fd for the I/O thread");
+	g_io.evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (g_io.evfd == -1) THROW_POSIX_LABEL(finally, code, "Could not create eventfd for the I/O thread");
+
+	struct epoll_event	ev = {.events = EPOLLIN, .data.ptr = NULL};
+	if (epoll_ctl(g_io.epfd, EPOLL_CTL_ADD, g_io.evfd, &ev) == -1) THROW_POSIX_LABEL(finally, code, "Could not watch the I/O thread's eventfd");
+
+	if (Tcl_CreateThread(&g_io.thread, io_thread, NULL, TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK)
+		THROW_ERROR_LABEL(finally, code, "Could not start the I/O thread");
+	g_io.started = 1;
+
+finally:
+	if (code != TCL_OK) {
+		if (g_io.evfd != -1) { close(g_io.evfd); g_io.evfd = -1; }
+		if (g_io.epfd != -1) { close(g_io.epfd); g_io.epfd = -1; }
+	}
+	Tcl_MutexUnlock(&g_io.mutex);
+	return code;
+}
+
+//>>>
+int offload_attach(Tcl_Interp* interp, struct con_cx* con_cx) //<<<
+{
+	int					code = TCL_OK;
+	struct offload*		o = NULL;
+
+	if (con_cx->type != CHANTYPE_DIRECT) THROW_ERROR_LABEL(finally, code, "Only channels from s2n::socket and s2n::listener can be offloaded");
+	if (!con_cx->handshake_done) THROW_ERROR_LABEL(finally, code, "Can't offload before the handshake completes");
+	if (con_cx->uring) THROW_ERROR_LABEL(finally, code, "Can't offload a channel using io_uring");
+	if (con_cx->write_closed || con_cx->read_closed) THROW_ERROR_LABEL(finally, code, "Can't offload a closing channel");
+	TEST_OK_LABEL(finally, code, start_io_thread(interp));
+
+	if (-1 == fcntl(con_cx->fd, F_SETFL, fcntl(con_cx->fd, F_GETFL) | O_NONBLOCK))
+		THROW_POSIX_LABEL(finally, code, "Could not make the socket non-blocking");
+
+	o = ckalloc(sizeof *o);
+	*o = (struct offload){
+		.refcount	= 2,		// The channel and the I/O thread
+		.con_cx		= con_cx,
+		.fd			= con_cx->fd,
+		.owner		= (uintptr_t)Tcl_GetCurrentThread(),
+	};
+
+	// Data held for coalescing goes first
+	if (con_cx->coalesce_len) {
+		struct iobuf*	b = ckalloc(sizeof *b + con_cx->coalesce_len);
+		*b = (struct iobuf){.len = con_cx->coalesce_len};
+		memcpy(b->data, con_cx->coalesce_buf, con_cx->coalesce_len);
+		spsc_push(&o->tx, b);
+		con_cx->coalesce_len = 0;
+	}
+
+	// From here on the I/O thread owns the fd and the s2n connection
+	con_cx->offload = o;
+	kick(o);
+
+finally:
+	return code;
+}
+
+//>>>
+int offload_input(struct con_cx* con_cx, char* buf, int toRead, int* errorCodePtr) //<<<
+{
+	struct offload*	o = con_cx->offload;
+	int				got = 0;
+
+	for (;;) {
+		while (got < toRead) {
+			struct iobuf*	b = o->rx_cur;
+			if (b == NULL) {
+				b = spsc_peek(&o->rx);
+				if (b == NULL) break;
+				spsc_pop(&o->rx);
+				o->rx_cur = b;
+			}
+			const int	n = (int)(b->len - b->off) < toRead - got ? (int)(b->len - b->off) : toRead - got;
+			memcpy(buf + got, b->data + b->off, n);
+			b->off += n;
+			got += n;
+			if (b->off == b->len) {
+				o->rx_cur = NULL;
+				ckfree(b);
+			}
+		}
+		if (got) break;
+
+		if (atomic_load(&o->error)) {
+			*errorCodePtr = atomic_load(&o->error);
+			return -1;
+		}
+		if (atomic_load(&o->eof)) {
+			con_cx->read_closed = 1;
+			return 0;
+		}
+		if (!con_cx->blocking) {
+			con_cx->stats.eagain++;
+			*errorCodePtr = EAGAIN;
+			return -1;
+		}
+		wait_for(o, TCL_READABLE);
+	}
+
+	con_cx->stats.read_count += got;
+	if (atomic_load(&o->rx_paused)) kick(o);		// There's room again
+	return got;
+}
+
+//>>>
+int offload_output(struct con_cx* con_cx, const char* buf, int toWrite, int* errorCodePtr) //<<<
+{
+	struct offload*	o = con_cx->offload;
+	int				written = 0;
+
+	while (written < toWrite) {
+		if (atomic_load(&o->error)) {
+			if (written) break;
+			*errorCodePtr = atomic_load(&o->error);
+			return -1;
+		}
+		if (spsc_full(&o->tx)) {
+			if (!con_cx->blocking) break;
+			kick(o);
+			wait_for(o, TCL_WRITABLE);
+			continue;
+		}
+
+		const int		n = toWrite - written < OFFLOAD_BUF ? toWrite - written : OFFLOAD_BUF;
+		struct iobuf*	b = ckalloc(sizeof *b + n);
+		*b = (struct iobuf){.len = n};
+		memcpy(b->data, buf + written, n);
+		spsc_push(&o->tx, b);
+		written += n;
+	}
+
+	if (written == 0) {
+		con_cx->stats.eagain++;
+		*errorCodePtr = EAGAIN;
+		return -1;
+	}
+	con_cx->stats.write_count += written;
+	kick(o);
+	return written;
+}
+
+//>>>
+void offload_watch(struct con_cx* con_cx, int mask) //<<<
+{
+	struct offload*	o = con_cx->offload;
+
+	o->watch_mask = mask;
+	if (ready_mask(o) & mask) notify(o);
+}
+
+//>>>
+void offload_thread_insert(struct con_cx* con_cx) //<<<
+{
+	atomic_store(&con_cx->offload->owner, (uintptr_t)Tcl_GetCurrentThread());
+}
+
+//>>>
+void offload_close(struct con_cx* con_cx) //<<<
+{
+	// The I/O thread hands con_cx back to be freed once it has finished with the connection
+	struct offload*	o = con_cx->offload;
+
+	atomic_store(&o->closing, 1);
+	kick(o);
+}
+
+//>>>
+void offload_cleanup(void) //<<<
+{
+	Tcl_MutexLock(&g_io.mutex);
+	const int	started = g_io.started;
+	g_io.quit = 1;
+	Tcl_MutexUnlock(&g_io.mutex);
+
+	if (started) {
+		int		result;
+		wake_io();
+		Tcl_JoinThread(g_io.thread, &result);
+		close(g_io.evfd);
+		close(g_io.epfd);
+		g_io.evfd = g_io.epfd = -1;
+		g_io.started = 0;
+	}
+	g_io.quit = 0;
+	Tcl_MutexFinalize(&g_io.mutex);
+	g_io.mutex = NULL;
+}
+
+//>>>
+#else
+int offload_attach(Tcl_Interp* interp, struct con_cx* con_cx) //<<<
+{
+	Tcl_SetObjResult(interp, Tcl_NewStringObj("Offloading needs epoll, which this platform doesn't have", -1));
+	return TCL_ERROR;
+}
+
+//>>>
+int offload_input(struct con_cx* con_cx, char* buf, int toRead, int* errorCodePtr) { *errorCodePtr = EINVAL; return -1; }
+int offload_output(struct con_cx* con_cx, const char* buf, int toWrite, int* errorCodePtr) { *errorCodePtr = EINVAL; return -1; }
+void offload_watch(struct con_cx* con_cx, int mask) {}
+void offload_thread_insert(struct con_cx* con_cx) {}
+void offload_close(struct con_cx* con_cx) {}
+void offload_cleanup(void) {}
+#endif
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
@@ -0,0 +1,540 @@
+#include "s2nInt.h"
+
+// Pools of client connections to one upstream, connected and handshaken
+// ahead of need so that requests don't wait for TCP and TLS setup.  The
+// channels are created by s2n::socket -async in the pool's interp, and while
+// idle they belong to the pool: channel handlers notice when their handshake
+// completes or fails and, once ready, when the server closes them (or sends
+// anything, which an idle request/response connection shouldn't see).
+// Handing one out detaches it and moves it to the caller's interp, and the
+// pool is topped up again from a timer.  Nothing here waits for a
+// connection: with none ready, get hands out one that is still connecting.
+
+#define POOL_DEFAULT_SIZE				4
+#define POOL_DEFAULT_CONNECT_TIMEOUT	10000	// ms allowed for connect and handshake
+#define POOL_RETRY_MS					1000	// After failing to create a connection
+
+enum pool_entry_state {
+	ENTRY_CONNECTING,
+	ENTRY_READY,
+};
+
+struct pool;
+
+struct pool_entry {
+	struct pool*			pool;
+	Tcl_Channel				chan;
+	struct con_cx*			con_cx;
+	enum pool_entry_state	state;
+	int64_t					created_usec;
+	int64_t					ready_usec;
+	Tcl_TimerToken			timer;		// Connect timeout while connecting, idle timeout once ready
+	struct pool_entry*		next;
+	struct pool_entry*		prev;
+};
+
+struct pool {
+	char				name[TCL_INTEGER_SPACE + 10];
+	Tcl_Interp*			interp;
+	Tcl_Obj*			socket_cmd;		// ::s2n::socket ?opt val ...? host port, without -async
+	int					size;
+	int					connect_timeout;
+	int					max_idle;		// ms a ready connection is kept, 0 for no limit
+	struct pool_entry*	head;			// Ready entries first, oldest first
+	struct pool_entry*	tail;
+	int					ready;
+	int					connecting;
+	Tcl_TimerToken		refill_timer;
+	Tcl_Obj*			last_error;
+	uint64_t			hits;
+	uint64_t			misses;
+	uint64_t			created;
+	uint64_t			failed;			// Connections that couldn't be created, or didn't become ready in time
+	uint64_t			discarded;		// Ready connections closed by the server, or idle for max_idle
+	uint64_t			readied;		// Connections that became ready
+	uint64_t			connect_usec;	// Total time taken by those to become ready
+	int					closed;
+	int					refilling;
+};
+
+static atomic_uint		g_pool_id = 0;
+
+static _Thread_local Tcl_HashTable*	t_pools = NULL;	// name -> struct pool*, this thread's
+
+static void entry_event(ClientData cdata, int mask);
+static void entry_closed(ClientData cdata);
+static void schedule_refill(struct pool* p, int delay_ms);
+
+static void entry_unlink(struct pool_entry* e) //<<<
+{
+	struct pool*	p = e->pool;
+
+	if (e->prev) e->prev->next = e->next; else p->head = e->next;
+	if (e->next) e->next->prev = e->prev; else p->tail = e->prev;
+	e->next = e->prev = NULL;
+	if (e->state == ENTRY_READY) p->ready--; else p->connecting--;
+}
+
+//>>>
+static void entry_detach(struct pool_entry* e) //<<<
+{
+	// Stop watching the channel and forget it, but leave it open
+	entry_unlink(e);
+	if (e->timer) {
+		Tcl_DeleteTimerHandler(e->timer);
+		e->timer = NULL;
+	}
+	Tcl_DeleteChannelHandler(e->chan, entry_event, e);
+	Tcl_DeleteCloseHandler(e->chan, entry_closed, e);
+	ckfree(e);
+}
+
+//>>>
+static void entry_discard(struct pool_entry* e, int refill_ms) //<<<
+{
+	struct pool*	p = e->pool;
+	Tcl_Channel		chan = e->chan;
+
+	entry_detach(e);
+	Tcl_UnregisterChannel(p->interp, chan);
+	if (!p->closed) schedule_refill(p, refill_ms);
+}
+
+//>>>
+static void entry_failed(struct pool_entry* e, Tcl_Obj* reason) //<<<
+{
+	// Replaced after a pause, so that an upstream that's down isn't hammered
+	e->pool->failed++;
+	replace_tclobj(&e->pool->last_error, reason);
+	entry_discard(e, POOL_RETRY_MS);
+}
+
+//>>>
+static Tcl_Channel entry_hand_out(Tcl_Interp* interp, struct pool_entry* e) //<<<
+{
+	// Detach e and give its channel to interp, which needn't be the pool's
+	struct pool*	p = e->pool;
+	Tcl_Channel		chan = e->chan;
+
+	entry_detach(e);
+	if (interp != p->interp) {
+		Tcl_RegisterChannel(interp, chan);
+		Tcl_UnregisterChannel(p->interp, chan);
+	}
+	return chan;
+}
+
+//>>>
+static void entry_closed(ClientData cdata) //<<<
+{
+	// Closed by something other than the pool, like interp deletion
+	struct pool_entry*	e = cdata;
+
+	entry_unlink(e);
+	if (e->timer) {
+		Tcl_DeleteTimerHandler(e->timer);
+		e->timer = NULL;
+	}
+	if (!e->pool->closed) schedule_refill(e->pool, 0);
+	ckfree(e);
+}
+
+//>>>
+static void entry_timeout(ClientData cdata) //<<<
+{
+	struct pool_entry*	e = cdata;
+
+	e->timer = NULL;
+	if (e->state == ENTRY_CONNECTING) {
+		entry_failed(e, Tcl_NewStringObj("connect and handshake timed out", -1));
+	} else {
+		e->pool->discarded++;
+		entry_discard(e, 0);
+	}
+}
+
+//>>>
+static void entry_ready(struct pool_entry* e) //<<<
+{
+	struct pool*	p = e->pool;
+
+	if (e->timer) {
+		Tcl_DeleteTimerHandler(e->timer);
+		e->timer = NULL;
+	}
+	// Move it to the end of the ready entries
+	entry_unlink(e);
+	e->state = ENTRY_READY;
+	e->ready_usec = mono_usec();
+	p->readied++;
+	p->connect_usec += e->ready_usec - e->created_usec;
+	struct pool_entry*	after = NULL;
+	for (struct pool_entry* i = p->head; i && i->state == ENTRY_READY; i = i->next) after = i;
+	e->prev = after;
+	e->next = after ? after->next : p->head;
+	if (e->next) e->next->prev = e; else p->tail = e;
+	if (after) after->next = e; else p->head = e;
+	p->ready++;
+
+	Tcl_DeleteChannelHandler(e->chan, entry_event, e);
+	Tcl_CreateChannelHandler(e->chan, TCL_READABLE, entry_event, e);
+	if (p->max_idle > 0) e->timer = Tcl_CreateTimerHandler(p->max_idle, entry_timeout, e);
+}
+
+//>>>
+static void entry_event(ClientData cdata, int mask) //<<<
+{
+	struct pool_entry*	e = cdata;
+
+	if (e->state == ENTRY_CONNECTING) {
+		// The driver only reports writable once the handshake is done, and
+		// readable before that when the connection or handshake failed
+		if (e->con_cx->handshake_done) {
+			entry_ready(e);
+		} else if (e->con_cx->handshake_error) {
+			entry_failed(e, Tcl_ObjPrintf("connect and handshake failed: %s", e->con_cx->handshake_error));
+		}
+		return;
+	}
+
+	// Readable while idle: a TLS 1.3 session ticket is consumed without
+	// producing any data, anything else means the connection is done for
+	char	byte;
+	const int	got = Tcl_Read(e->chan, &byte, 1);
+	if (got == 0 && !Tcl_Eof(e->chan) && !e->con_cx->read_closed) return;
+	e->pool->discarded++;
+	entry_discard(e, 0);
+}
+
+//>>>
+static int socket_async(Tcl_Interp* interp, struct pool* p, Tcl_Channel* chan) //<<<
+{
+	// Start a connection in interp, leaving its channel non-blocking
+	int			code = TCL_OK;
+	Tcl_Obj*	cmd = NULL;
+	Tcl_Obj**	ov;
+	Tcl_Size	oc;
+
+	// ::s2n::socket -async ?opt val ...? host port
+	replace_tclobj(&cmd, Tcl_DuplicateObj(p->socket_cmd));
+	TEST_OK_LABEL(finally, code, Tcl_ListObjReplace(interp, cmd, 1, 0, 1, (Tcl_Obj*[]){Tcl_NewStringObj("-async", -1)}));
+	TEST_OK_LABEL(finally, code, Tcl_ListObjGetElements(interp, cmd, &oc, &ov));
+	TEST_OK_LABEL(finally, code, Tcl_EvalObjv(interp, oc, ov, TCL_EVAL_GLOBAL));
+
+	*chan = Tcl_GetChannel(interp, Tcl_GetString(Tcl_GetObjResult(interp)), NULL);
+	if (*chan == NULL) THROW_ERROR_LABEL(finally, code, "socket command didn't return a channel");
+	Tcl_SetChannelOption(NULL, *chan, "-blocking", "0");
+
+finally:
+	replace_tclobj(&cmd, NULL);
+	return code;
+}
+
+//>>>
+static int add_connection(struct pool* p) //<<<
+{
+	int					code = TCL_OK;
+	Tcl_Channel			chan;
+	struct pool_entry*	e = NULL;
+
+	TEST_OK_LABEL(finally, code, socket_async(p->interp, p, &chan));
+
+	e = (struct pool_entry*)ckalloc(sizeof *e);
+	*e = (struct pool_entry){
+		.pool			= p,
+		.chan			= chan,
+		.con_cx			= (struct con_cx*)Tcl_GetChannelInstanceData(chan),
+		.state			= ENTRY_CONNECTING,
+		.created_usec	= mono_usec(),
+		.prev			= p->tail,
+	};
+	if (p->tail) p->tail->next = e; else p->head = e;
+	p->tail = e;
+	p->connecting++;
+	p->created++;
+
+	Tcl_CreateCloseHandler(chan, entry_closed, e);
+	Tcl_CreateChannelHandler(chan, TCL_READABLE | TCL_WRITABLE, entry_event, e);
+	e->timer = Tcl_CreateTimerHandler(p->connect_timeout, entry_timeout, e);
+
+finally:
+	return code;
+}
+
+//>>>
+static void refill(ClientData cdata) //<<<
+{
+	struct pool*	p = cdata;
+	Tcl_Interp*		interp = p->interp;
+
+	p->refill_timer = NULL;
+	if (p->closed) return;
+
+	p->refilling = 1;
+	Tcl_Preserve(interp);
+	Tcl_InterpState	saved = Tcl_SaveInterpState(interp, TCL_OK);
+	while (!p->closed && p->ready + p->connecting < p->size) {
+		if (add_connection(p) != TCL_OK) {
+			p->failed++;
+			replace_tclobj(&p->last_error, Tcl_GetObjResult(interp));
+			if (!p->closed) p->refill_timer = Tcl_CreateTimerHandler(POOL_RETRY_MS, refill, p);
+			break;
+		}
+	}
+	Tcl_RestoreInterpState(interp, saved);
+	Tcl_Release(interp);
+	p->refilling = 0;
+	if (p->closed) ckfree(p);		// By something the socket command did
+}
+
+//>>>
+static void schedule_refill(struct pool* p, int delay_ms) //<<<
+{
+	if (p->refill_timer || p->refilling) return;
+	p->refill_timer = Tcl_CreateTimerHandler(delay_ms, refill, p);
+}
+
+//>>>
+static void interp_deleted(ClientData cdata, Tcl_Interp* interp);
+
+static void close_pool(struct pool* p) //<<<
+{
+	if (p->closed) return;
+	p->closed = 1;
+
+	Tcl_HashEntry*	he = t_pools ? Tcl_FindHashEntry(t_pools, p->name) : NULL;
+	if (he) Tcl_DeleteHashEntry(he);
+
+	Tcl_DontCallWhenDeleted(p->interp, interp_deleted, p);
+	if (p->refill_timer) {
+		Tcl_DeleteTimerHandler(p->refill_timer);
+		p->refill_timer = NULL;
+	}
+	while (p->head) {
+		Tcl_Channel		chan = p->head->chan;
+		entry_detach(p->head);
+		Tcl_UnregisterChannel(p->interp, chan);
+	}
+	replace_tclobj(&p->socket_cmd, NULL);
+	replace_tclobj(&p->last_error, NULL);
+
+	if (!p->refilling) ckfree(p);
+}
+
+//>>>
+static void interp_deleted(ClientData cdata, Tcl_Interp* interp) //<<<
+{
+	close_pool((struct pool*)cdata);
+}
+
+//>>>
+static void thread_exit(ClientData cdata) //<<<
+{
+	// Interps are deleted before their thread exits, closing their pools
+	if (t_pools) {
+		Tcl_DeleteHashTable(t_pools);
+		ckfree(t_pools);
+		t_pools = NULL;
+	}
+}
+
+//>>>
+static int pool_get(Tcl_Interp* interp, struct pool* p) //<<<
+{
+	// Hand out the oldest ready connection, or if none is ready the one
+	// furthest along, or a new one: either of those still connecting
+	int				code = TCL_OK;
+	Tcl_Channel		chan;
+
+	while (p->head && p->head->state == ENTRY_READY) {
+		struct pool_entry*	e = p->head;
+
+		if (e->con_cx->read_closed || Tcl_Eof(e->chan)) {
+			p->discarded++;
+			entry_discard(e, 0);
+			continue;
+		}
+		chan = entry_hand_out(interp, e);
+		Tcl_SetChannelOption(NULL, chan, "-blocking", "1");		// As s2n::socket would have left it
+		p->hits++;
+		goto done;
+	}
+
+	p->misses++;
+	if (p->head) {
+		chan = entry_hand_out(interp, p->head);		// Only connecting entries are left
+	} else {
+		TEST_OK_LABEL(finally, code, socket_async(interp, p, &chan));
+	}
+
+done:
+	schedule_refill(p, 0);
+	Tcl_SetObjResult(interp, Tcl_NewStringObj(Tcl_GetChannelName(chan), -1));
+
+finally:
+	return code;
+}
+
+//>>>
+static Tcl_Obj* pool_stats(struct pool* p) //<<<
+{
+	Tcl_Obj*	d = Tcl_NewDictObj();
+
+#define STAT(name, val)	Tcl_DictObjPut(NULL, d, Tcl_NewStringObj(name, -1), Tcl_NewWideIntObj((Tcl_WideInt)(val)))
+	STAT("size",			p->size);
+	STAT("ready",			p->ready);
+	STAT("connecting",		p->connecting);
+	STAT("hits",			p->hits);
+	STAT("misses",			p->misses);
+	STAT("created",			p->created);
+	STAT("failed",			p->failed);
+	STAT("discarded",		p->discarded);
+	STAT("connect_usec",	p->readied ? p->connect_usec / p->readied : 0);		// Mean
+#undef STAT
+	Tcl_DictObjPut(NULL, d, Tcl_NewStringObj("last_error", -1), p->last_error ? p->last_error : Tcl_NewObj());
+
+	return d;
+}
+
+//>>>
+static int open_pool(Tcl_Interp* interp, int objc, Tcl_Obj *const objv[]) //<<<
+{
+	// objv: ?-opt val ...? host port, the options not for the pool are for s2n::socket
+	int				code = TCL_OK;
+	static const char* opts[] = {
+		"-size",
+		"-connect_timeout",
+		"-max_idle",
+		NULL
+	};
+	enum opt {
+		OPT_SIZE,
+		OPT_CONNECT_TIMEOUT,
+		OPT_MAX_IDLE,
+	};
+	struct pool*	p = NULL;
+	Tcl_Obj*		cmd = NULL;
+
+	p = (struct pool*)ckalloc(sizeof *p);
+	*p = (struct pool){
+		.interp				= interp,
+		.size				= POOL_DEFAULT_SIZE,
+		.connect_timeout	= POOL_DEFAULT_CONNECT_TIMEOUT,
+	};
+	replace_tclobj(&cmd, Tcl_NewListObj(1, (Tcl_Obj*[]){Tcl_NewStringObj(NS "::socket", -1)}));
+
+	for (int i=0; i<objc-2; i+=2) {
+		int		optint, v;
+		if (Tcl_GetIndexFromObj(NULL, objv[i], opts, "option", TCL_EXACT, &optint) != TCL_OK) {
+			if (strcmp(Tcl_GetString(objv[i]), "-async") == 0) THROW_ERROR_LABEL(finally, code, "The pool decides when to use -async");
+			TEST_OK_LABEL(finally, code, Tcl_ListObjAppendElement(interp, cmd, objv[i]));
+			TEST_OK_LABEL(finally, code, Tcl_ListObjAppendElement(interp, cmd, objv[i+1]));
+			continue;
+		}
+		TEST_OK_LABEL(finally, code, Tcl_GetIntFromObj(interp, objv[i+1], &v));
+		if (v < 0) THROW_PRINTF_LABEL(finally, code, "%s can't be negative", opts[optint]);
+		switch ((enum opt)optint) {
+			case OPT_SIZE:				p->size = v;			break;
+			case OPT_CONNECT_TIMEOUT:	p->connect_timeout = v;	break;
+			case OPT_MAX_IDLE:			p->max_idle = v;		break;
+		}
+	}
+	TEST_OK_LABEL(finally, code, Tcl_ListObjAppendElement(interp, cmd, objv[objc-2]));
+	TEST_OK_LABEL(finally, code, Tcl_ListObjAppendElement(interp, cmd, objv[objc-1]));
+	replace_tclobj(&p->socket_cmd, cmd);
+
+	snprintf(p->name, sizeof p->name, "s2npool%u", atomic_fetch_add(&g_pool_id, 1) + 1);
+	if (t_pools == NULL) {
+		t_pools = (Tcl_HashTable*)ckalloc(sizeof *t_pools);
+		Tcl_InitHashTable(t_pools, TCL_STRING_KEYS);
+		Tcl_CreateThreadExitHandler(thread_exit, NULL);
+	}
+	int				isnew;
+	Tcl_HashEntry*	he = Tcl_CreateHashEntry(t_pools, p->name, &isnew);
+	Tcl_SetHashValue(he, p);
+	Tcl_CallWhenDeleted(interp, interp_deleted, p);
+	schedule_refill(p, 0);
+
+	Tcl_SetObjResult(interp, Tcl_NewStringObj(p->name, -1));
+	p = NULL;
+
+finally:
+	replace_tclobj(&cmd, NULL);
+	if (p) {
+		replace_tclobj(&p->socket_cmd, NULL);
+		ckfree(p);
+		p = NULL;
+	}
+	return code;
+}
+
+//>>>
+static struct pool* get_pool(Tcl_Interp* interp, Tcl_Obj* name) //<<<
+{
+	Tcl_HashEntry*	he = t_pools ? Tcl_FindHashEntry(t_pools, Tcl_GetString(name)) : NULL;
+
+	if (he == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("pool \"%s\" doesn't exist in this thread", Tcl_GetString(name)));
+		Tcl_SetErrorCode(interp, "S2N", "POOL", Tcl_GetString(name), NULL);
+		return NULL;
+	}
+	return Tcl_GetHashValue(he);
+}
+
+//>>>
+OBJCMD(pool_cmd) //<<<
+{
+	int				code = TCL_OK;
+	static const char* ops[] = {
+		"open",
+		"get",
+		"close",
+		"stats",
+		NULL
+	};
+	enum op {
+		OP_OPEN,
+		OP_GET,
+		OP_CLOSE,
+		OP_STATS,
+	};
+	int				opint;
+
+	enum {A_cmd, A_OP, A_args};
+	CHECK_MIN_ARGS_LABEL(finally, code, "open|get|close|stats ?arg ...?");
+
+	TEST_OK_LABEL(finally, code, Tcl_GetIndexFromObj(interp, objv[A_OP], ops, "op", TCL_EXACT, &opint));
+	if (opint == OP_OPEN) {
+		if (objc < A_args+2 || (objc - A_args) % 2) {
+			Tcl_WrongNumArgs(interp, A_args, objv, "?-opt val ...? host port");
+			code = TCL_ERROR;
+			goto finally;
+		}
+		TEST_OK_LABEL(finally, code, open_pool(interp, objc-A_args, objv+A_args));
+		goto finally;
+	}
+
+	if (objc != A_args+1) {
+		Tcl_WrongNumArgs(interp, A_args, objv, "pool");
+		code = TCL_ERROR;
+		goto finally;
+	}
+	struct pool*	p = get_pool(interp, objv[A_args]);
+	if (p == NULL) {
+		code = TCL_ERROR;
+		goto finally;
+	}
+	switch ((enum op)opint) {
+		case OP_GET:	TEST_OK_LABEL(finally, code, pool_get(interp, p));	break;
+		case OP_CLOSE:	close_pool(p);										break;
+		case OP_STATS:	Tcl_SetObjResult(interp, pool_stats(p));			break;
+		default: THROW_ERROR_LABEL(finally, code, "Unhandled op");
+	}
+
+finally:
+	return code;
+}
+
+//>>>
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
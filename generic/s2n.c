@@ -8,6 +8,7 @@ static const char* lit_str[L_size] = {
 };
 
 int g_unloading = 0;
+static atomic_uint		g_con_id = 0;
 
 TCL_DECLARE_MUTEX(g_init_mutex);
 static int				g_init = 0;
@@ -63,12 +64,218 @@ static const char* action_str(int action) //<<<
 
 //>>>
 
+// Stats <<<
+static uint64_t scan_records(struct record_scan* rs, const uint8_t* buf, size_t len) //<<<
+{
+	uint64_t	records = 0;
+	size_t		i = 0;
+
+	// Only the 5 byte record headers are inspected, bodies are skipped over
+	while (i < len) {
+		if (rs->remain) {
+			const size_t	take = len-i < rs->remain ? len-i : rs->remain;
+			rs->remain -= take;
+			i += take;
+		} else {
+			rs->hdr[rs->hdr_len++] = buf[i++];
+			if (rs->hdr_len == sizeof(rs->hdr)) {
+				rs->remain = (rs->hdr[3] << 8) | rs->hdr[4];
+				rs->hdr_len = 0;
+				records++;
+			}
+		}
+	}
+
+	return records;
+}
+
+//>>>
+static void note_blocked(struct con_cx* con_cx, s2n_blocked_status blocked) //<<<
+{
+	switch (blocked) {
+		case S2N_BLOCKED_ON_READ:	con_cx->stats.blocked_on_read++;	break;
+		case S2N_BLOCKED_ON_WRITE:	con_cx->stats.blocked_on_write++;	break;
+		default: break;
+	}
+}
+
+//>>>
+static void note_hs_event(struct con_cx* con_cx, const char* what) //<<<
+{
+	if (con_cx->hs_timeline_len >= HS_TIMELINE_MAX) return;
+	con_cx->hs_timeline[con_cx->hs_timeline_len++] = (struct hs_event){
+		.what	= what,
+		.usec	= wall_usec(),
+	};
+}
+
+//>>>
+static void handshake_complete(struct con_cx* con_cx) //<<<
+{
+	con_cx->handshake_done = 1;
+	con_cx->stats.handshake_usec = mono_usec() - con_cx->created_usec;
+	note_hs_event(con_cx, "DONE");
+	TRACE(con_cx, TR_HANDSHAKE_DONE, 0, 0, con_cx->stats.handshake_usec, 0);
+	if (con_cx->shard) listen_shard_handshake(con_cx->shard);
+	admission_leave(con_cx);		// Makes room for a queued handshake
+
+	if (con_cx->client && con_cx->config_cx && con_cx->config_cx->session_cache) {
+		struct session_cache*	cache = con_cx->config_cx->session_cache;
+		session_cache_handshake(cache, s2n_connection_is_session_resumed(con_cx->s2n_con));
+		session_cache_store(cache, con_cx->s2n_con);	// TLS 1.2 tickets arrive during the handshake
+	}
+}
+
+//>>>
+static int con_negotiate(struct con_cx* con_cx) //<<<
+{
+	// Wraps s2n_negotiate to record which handshake message s2n has reached
+	// after each call, and when, for the -handshake_timeline option.  A
+	// flight of several messages handled in one call only shows its last.
+	if (con_cx->hs_timeline_len == 0) note_hs_event(con_cx, "START");
+	con_cx->stats.negotiate_calls++;
+
+	ocsp_handshake_enter(con_cx->s2n_con);
+	const int	rc = s2n_negotiate(con_cx->s2n_con, &con_cx->blocked);
+	ocsp_handshake_leave();
+	TRACE(con_cx, TR_NEGOTIATE, con_cx->blocked, 0, rc, rc == S2N_SUCCESS ? 0 : s2n_errno);
+
+	const char*	msg = s2n_connection_get_last_message_name(con_cx->s2n_con);
+	if (msg && strcmp(msg, con_cx->hs_timeline[con_cx->hs_timeline_len-1].what) != 0)
+		note_hs_event(con_cx, msg);
+
+	return rc;
+}
+
+//>>>
+static Tcl_Obj* stats_obj(const struct con_stats* s) //<<<
+{
+	Tcl_Obj*	d = Tcl_NewDictObj();
+
+#define STAT(name, val) Tcl_DictObjPut(NULL, d, Tcl_NewStringObj(name, -1), Tcl_NewWideIntObj((Tcl_WideInt)(val)))
+	STAT("plaintext_in",	s->read_count);
+	STAT("plaintext_out",	s->write_count);
+	STAT("ciphertext_in",	s->wire_in);
+	STAT("ciphertext_out",	s->wire_out);
+	STAT("records_in",		s->records_in);
+	STAT("records_out",		s->records_out);
+	STAT("read_syscalls",	s->read_syscalls);
+	STAT("write_syscalls",	s->write_syscalls);
+	STAT("blocked_read",	s->blocked_on_read);
+	STAT("blocked_write",	s->blocked_on_write);
+	STAT("eagain",			s->eagain);
+	STAT("negotiate_calls",	s->negotiate_calls);
+	STAT("coalesced",		s->coalesced);
+	STAT("coalesce_flushes",	s->coalesce_flushes);
+	STAT("handshake_usec",	s->handshake_usec);
+#undef STAT
+
+	return d;
+}
+
+//>>>
+static void append_con_stats(Tcl_DString* val, struct con_cx* con_cx) //<<<
+{
+	Tcl_Obj*	d = stats_obj(&con_cx->stats);
+
+	Tcl_IncrRefCount(d);
+	Tcl_DictObjPut(NULL, d, Tcl_NewStringObj("age_usec", -1), Tcl_NewWideIntObj(mono_usec() - con_cx->created_usec));
+	Tcl_DStringAppend(val, Tcl_GetString(d), -1);
+	Tcl_DecrRefCount(d);
+}
+
+//>>>
+static const char* kx_group_str(struct s2n_connection* s2n_con) //<<<
+{
+	const char*	kem_group = s2n_connection_get_kem_group_name(s2n_con);
+	if (kem_group && strcmp(kem_group, "NONE") != 0) return kem_group;
+
+	const char*	curve = s2n_connection_get_curve(s2n_con);
+	return curve ? curve : "NONE";
+}
+
+//>>>
+static void append_peer_chain(Tcl_DString* val, struct con_cx* con_cx) //<<<
+{
+	struct s2n_cert_chain_and_key*	chain = NULL;
+	uint32_t						certs = 0;
+	uint64_t						bytes = 0;
+	char							buf[2*TCL_INTEGER_SPACE + 16];
+
+	if (!con_cx->handshake_done) goto done;
+
+	chain = s2n_cert_chain_and_key_new();
+	if (chain == NULL) goto done;
+	if (s2n_connection_get_peer_cert_chain(con_cx->s2n_con, chain) != S2N_SUCCESS) goto done;
+	if (s2n_cert_chain_get_length(chain, &certs) != S2N_SUCCESS) goto done;
+
+	for (uint32_t i=0; i<certs; i++) {
+		struct s2n_cert*	cert = NULL;
+		const uint8_t*		der = NULL;
+		uint32_t			der_len = 0;
+
+		if (s2n_cert_chain_get_cert(chain, &cert, i) != S2N_SUCCESS) continue;
+		if (s2n_cert_get_der(cert, &der, &der_len) != S2N_SUCCESS) continue;
+		bytes += der_len;
+	}
+
+done:
+	if (chain) {
+		s2n_cert_chain_and_key_free(chain);
+		chain = NULL;
+	}
+	snprintf(buf, sizeof(buf), "certs %" PRIu32 " bytes %" PRIu64, certs, bytes);
+	Tcl_DStringAppend(val, buf, -1);
+}
+
+//>>>
+static void append_hs_timeline(Tcl_DString* val, struct con_cx* con_cx) //<<<
+{
+	char	buf[TCL_INTEGER_SPACE];
+
+	for (int i=0; i<con_cx->hs_timeline_len; i++) {
+		Tcl_DStringAppendElement(val, con_cx->hs_timeline[i].what);
+		snprintf(buf, sizeof(buf), "%" PRId64, con_cx->hs_timeline[i].usec);
+		Tcl_DStringAppendElement(val, buf);
+	}
+}
+
+//>>>
+static void append_session(Tcl_DString* val, struct con_cx* con_cx) //<<<
+{
+	// Hex encoded, suitable for the -session option of s2n::push and s2n::socket
+	static const char	hexdigits[] = "0123456789abcdef";
+	const int			len = s2n_connection_get_session_length(con_cx->s2n_con);
+
+	if (len <= 0) return;
+
+	uint8_t*	session = (uint8_t*)ckalloc(len);
+	const int	got = s2n_connection_get_session(con_cx->s2n_con, session, len);
+	for (int i=0; i<got; i++) {
+		const char	hex[2] = {hexdigits[session[i] >> 4], hexdigits[session[i] & 0xf]};
+		Tcl_DStringAppend(val, hex, 2);
+	}
+	ckfree(session);
+}
+
+//>>>
+// Stats >>>
+
 // Common driver parts <<<
+#define COMMON_OPTNAMES	"servername prefer server_supports client_supports protocol stats cipher kx_group handshake_type resumed peer_chain handshake_timeline session alpn coalesce_bytes coalesce_delay pending"
+static int s2n_common_chan_get_option(struct con_cx* con_cx, const char* optname, Tcl_DString* val);
 static int s2n_common_chan_input(ClientData cdata, char* buf, int toRead, int* errorCodePtr);
 static int s2n_common_chan_output(ClientData cdata, const char* buf, int toWrite, int* errorCodePtr);
 static int s2n_common_chan_close2(ClientData cdata, Tcl_Interp* interp, int flags);
 static int s2n_common_chan_seek(ClientData cdata, long offset, int mode, int* errorCodePtr);
 static void s2n_common_chan_thread_action(ClientData cdata, int action);
+static int con_set_coalesce(Tcl_Interp* interp, struct con_cx* con_cx, const char* optname, const char* optval);
+static void pending_watch(struct con_cx* con_cx, int mask);
+static void pending_cancel(struct con_cx* con_cx);
+static int coalesce_before_read(struct con_cx* con_cx, int* errorCodePtr);
+static void coalesce_cancel(struct con_cx* con_cx);
+static void offload_snapshot(struct con_cx* con_cx);
+static void offload_snapshot_free(struct con_cx* con_cx);
 // Common driver parts >>>
 // Stacked channel implementation <<<
 static int s2n_stacked_chan_block_mode(ClientData cdata, int mode);
@@ -96,6 +303,7 @@ static int s2n_stacked_chan_block_mode(ClientData cdata, int mode) //<<<
 {
 	struct con_cx*	con_cx = cdata;
 	Tcl_DriverBlockModeProc*	base_blockmode = Tcl_ChannelBlockModeProc(Tcl_GetChannelType(con_cx->basechan));
+	con_cx->blocking = mode == TCL_MODE_BLOCKING;
 	return base_blockmode(Tcl_GetChannelInstanceData(con_cx->basechan), mode);
 }
 
@@ -107,8 +315,10 @@ static int s2n_stacked_chan_set_option(ClientData cdata, Tcl_Interp* interp, con
 
 	if (strcmp(optname, "-servername") == 0) {
 		CHECK_S2N(finally, code, s2n_set_server_name(con_cx->s2n_con, optval));
+	} else if (strcmp(optname, "-coalesce_bytes") == 0 || strcmp(optname, "-coalesce_delay") == 0) {
+		TEST_OK_LABEL(finally, code, con_set_coalesce(interp, con_cx, optname, optval));
 	} else {
-		code = Tcl_BadChannelOption(interp, optname, "servername");
+		code = Tcl_BadChannelOption(interp, optname, "servername coalesce_bytes coalesce_delay");
 		Tcl_SetErrno(EINVAL);
 		goto finally;
 	}
@@ -123,44 +333,8 @@ static int s2n_stacked_chan_get_option(ClientData cdata, Tcl_Interp* interp, con
 	int				code = TCL_OK;
 	struct con_cx*	con_cx = cdata;
 
-	if (optname == NULL) {
-		// Return all optionnames and their current values in val
-		Tcl_DStringAppendElement(val, "-servername");
-		const char*		servername = s2n_get_server_name(con_cx->s2n_con);
-		Tcl_DStringAppendElement(val, servername ? servername : "");
-
-		Tcl_DStringAppendElement(val, "-prefer");
-		// TODO: keep a record of this
-		Tcl_DStringAppendElement(val, "<todo>");
-
-		Tcl_DStringAppendElement(val, "-server_supports");
-		Tcl_DStringAppendElement(val, proto_str(s2n_connection_get_server_protocol_version(con_cx->s2n_con)));
-
-		Tcl_DStringAppendElement(val, "-client_supports");
-		Tcl_DStringAppendElement(val, proto_str(s2n_connection_get_client_protocol_version(con_cx->s2n_con)));
-
-		Tcl_DStringAppendElement(val, "-protocol");
-		Tcl_DStringAppendElement(val, proto_str(s2n_connection_get_actual_protocol_version(con_cx->s2n_con)));
-
-	} else if (strcmp(optname, "-servername") == 0) {
-		const char*		servername = s2n_get_server_name(con_cx->s2n_con);
-		if (servername) Tcl_DStringAppend(val, servername, -1);
-
-	} else if (strcmp(optname, "-prefer") == 0) {
-		// TODO: keep a record of this
-		Tcl_DStringAppend(val, "<todo>", -1);
-
-	} else if (strcmp(optname, "-server_supports") == 0) {
-		Tcl_DStringAppend(val, proto_str(s2n_connection_get_server_protocol_version(con_cx->s2n_con)), -1);
-
-	} else if (strcmp(optname, "-client_supports") == 0) {
-		Tcl_DStringAppend(val, proto_str(s2n_connection_get_client_protocol_version(con_cx->s2n_con)), -1);
-
-	} else if (strcmp(optname, "-protocol") == 0) {
-		Tcl_DStringAppend(val, proto_str(s2n_connection_get_actual_protocol_version(con_cx->s2n_con)), -1);
-
-	} else {
-		code = Tcl_BadChannelOption(interp, optname, "servername prefer server_supports client_supports protocol");
+	if (!s2n_common_chan_get_option(con_cx, optname, val)) {
+		code = Tcl_BadChannelOption(interp, optname, COMMON_OPTNAMES);
 		Tcl_SetErrno(EINVAL);
 		goto finally;
 	}
@@ -187,6 +361,8 @@ static void s2n_stacked_chan_watch(ClientData cdata, int mask) //<<<
 	}
 
 	CLOGS(WATCH, "gotmask %s, forwarding %s", mask_str(gotmask), mask_str(mask));
+	TRACE(con_cx, TR_WATCH, mask, gotmask, 0, 0);
+	pending_watch(con_cx, mask);
 	Tcl_DriverWatchProc*	base_watch = Tcl_ChannelWatchProc(Tcl_GetChannelType(con_cx->basechan));
 	return base_watch(Tcl_GetChannelInstanceData(con_cx->basechan), mask);
 }
@@ -195,6 +371,7 @@ static void s2n_stacked_chan_watch(ClientData cdata, int mask) //<<<
 static int s2n_stacked_chan_handler(ClientData cdata, int mask) //<<<
 {
 	struct con_cx*	con_cx = cdata;
+	const int		gotmask = mask;
 
 	CLOGS(IO, "mask: %s, handshake_done: %d", mask_str(mask), con_cx->handshake_done);
 	if (!con_cx->handshake_done) {
@@ -206,9 +383,9 @@ static int s2n_stacked_chan_handler(ClientData cdata, int mask) //<<<
 
 		CLOGS(HANDSHAKE, "handshake not done, calling s2n_negotiate");
 		con_cx->blocked = S2N_NOT_BLOCKED;
-		const int neg_rc = s2n_negotiate(con_cx->s2n_con, &con_cx->blocked);
+		const int neg_rc = con_negotiate(con_cx);
 		if (neg_rc == S2N_SUCCESS) {
-			con_cx->handshake_done = 1;
+			handshake_complete(con_cx);
 			mask |= TCL_WRITABLE;
 			if (s2n_peek(con_cx->s2n_con) > 0) mask |= TCL_READABLE;
 		} else {
@@ -216,6 +393,7 @@ static int s2n_stacked_chan_handler(ClientData cdata, int mask) //<<<
 				case S2N_ERR_T_BLOCKED:
 				{
 					int internal_mask = 0;
+					note_blocked(con_cx, con_cx->blocked);
 					switch (con_cx->blocked) {
 						case S2N_BLOCKED_ON_READ:	internal_mask |= TCL_READABLE; break;
 						case S2N_BLOCKED_ON_WRITE:	internal_mask |= TCL_WRITABLE; break;
@@ -240,6 +418,7 @@ static int s2n_stacked_chan_handler(ClientData cdata, int mask) //<<<
 	}
 
 	CLOGS(IO, "returning %s", mask_str(mask));
+	TRACE(con_cx, TR_HANDLER, mask, gotmask, 0, 0);
 	return mask;
 }
 
@@ -251,6 +430,8 @@ static int s2n_direct_chan_set_option(ClientData cdata, Tcl_Interp* interp, cons
 static int s2n_direct_chan_get_option(ClientData cdata, Tcl_Interp* interp, const char* optname, Tcl_DString* dsPtr);
 static void s2n_direct_chan_watch(ClientData cdata, int mask);
 static void s2n_direct_chan_handler(ClientData cdata, int mask);
+static void s2n_direct_chan_set_watch(struct con_cx* con_cx, int mask);
+static void linger_handler(ClientData cdata, int mask);
 
 Tcl_ChannelType	s2n_direct_channel_type = {
 	.typeName			= "s2n_direct",
@@ -277,6 +458,17 @@ static int s2n_direct_chan_block_mode(ClientData cdata, int mode) //<<<
 {
 	struct con_cx*	con_cx = cdata;
 
+	if (con_cx->uring) {
+		// The ring does the waiting, blocking reads and writes run it until their operation completes
+		con_cx->blocking = mode == TCL_MODE_BLOCKING;
+		return 0;
+	}
+	if (con_cx->offload) {
+		// The I/O thread needs the fd non-blocking, blocking reads and writes wait on the queues instead
+		con_cx->blocking = mode == TCL_MODE_BLOCKING;
+		return 0;
+	}
+
 	switch (mode) {
 		case TCL_MODE_BLOCKING:
 			con_cx->blocking = 1;
@@ -302,9 +494,42 @@ static int s2n_direct_chan_set_option(ClientData cdata, Tcl_Interp* interp, cons
 	struct con_cx*	con_cx = cdata;
 
 	if (strcmp(optname, "-servername") == 0) {
+		if (con_cx->offload) THROW_ERROR_LABEL(finally, code, "Can't set -servername on an offloaded channel");
 		CHECK_S2N(finally, code, s2n_set_server_name(con_cx->s2n_con, optval));
+	} else if (strcmp(optname, "-coalesce_bytes") == 0 || strcmp(optname, "-coalesce_delay") == 0) {
+		TEST_OK_LABEL(finally, code, con_set_coalesce(interp, con_cx, optname, optval));
+	} else if (strcmp(optname, "-linger") == 0) {
+		int		v;
+		TEST_OK_LABEL(finally, code, Tcl_GetInt(interp, optval, &v));
+		if (v < 0) THROW_ERROR_LABEL(finally, code, "-linger can't be negative");
+		con_cx->linger_ms = v;
+	} else if (strcmp(optname, "-offload") == 0) {
+		int		v;
+		TEST_OK_LABEL(finally, code, Tcl_GetBoolean(interp, optval, &v));
+		if (v && !con_cx->offload) {
+			const int	mask = con_cx->watch_mask == -1 ? 0 : con_cx->watch_mask;
+			// The I/O thread owns s2n_con from the moment it's attached: the
+			// timers that would touch it go (attaching queues held data to
+			// send first), and the options that read it are answered from a
+			// snapshot
+			offload_snapshot(con_cx);
+			code = offload_attach(interp, con_cx);
+			if (code != TCL_OK) {
+				offload_snapshot_free(con_cx);
+				goto finally;
+			}
+			coalesce_cancel(con_cx);
+			pending_cancel(con_cx);
+			// Readiness now comes from the I/O thread rather than the notifier
+			s2n_direct_chan_set_watch(con_cx, 0);
+			offload_watch(con_cx, mask);
+		} else if (!v && con_cx->offload) {
+			THROW_ERROR_LABEL(finally, code, "-offload can't be turned off");
+		}
+	} else if (sockopt_set(interp, con_cx->fd, optname, optval, &code)) {
+		// Handled
 	} else {
-		code = Tcl_BadChannelOption(interp, optname, "servername");
+		code = Tcl_BadChannelOption(interp, optname, "servername coalesce_bytes coalesce_delay linger offload nodelay quickack sndbuf rcvbuf keepalive keepidle keepintvl keepcnt user_timeout busy_poll");
 		Tcl_SetErrno(EINVAL);
 		goto finally;
 	}
@@ -318,45 +543,50 @@ static int s2n_direct_chan_get_option(ClientData cdata, Tcl_Interp* interp, cons
 {
 	int				code = TCL_OK;
 	struct con_cx*	con_cx = cdata;
+	char			buf[TCL_INTEGER_SPACE];
 
 	if (optname == NULL) {
 		// Return all optionnames and their current values in val
-		Tcl_DStringAppendElement(val, "-servername");
-		const char*		servername = s2n_get_server_name(con_cx->s2n_con);
-		Tcl_DStringAppendElement(val, servername ? servername : "");
+		s2n_common_chan_get_option(con_cx, NULL, val);
+
+		Tcl_DStringAppendElement(val, "-watch_updates");
+		snprintf(buf, sizeof(buf), "%zu", con_cx->watch_updates);
+		Tcl_DStringAppendElement(val, buf);
+
+		Tcl_DStringAppendElement(val, "-linger");
+		snprintf(buf, sizeof(buf), "%d", con_cx->linger_ms);
+		Tcl_DStringAppendElement(val, buf);
 
-		Tcl_DStringAppendElement(val, "-prefer");
-		// TODO: keep a record of this
-		Tcl_DStringAppendElement(val, "<todo>");
+		Tcl_DStringAppendElement(val, "-offload");
+		Tcl_DStringAppendElement(val, con_cx->offload ? "1" : "0");
 
-		Tcl_DStringAppendElement(val, "-server_supports");
-		Tcl_DStringAppendElement(val, proto_str(s2n_connection_get_server_protocol_version(con_cx->s2n_con)));
+		Tcl_DStringAppendElement(val, "-uring");
+		Tcl_DStringAppendElement(val, con_cx->uring ? "1" : "0");
 
-		Tcl_DStringAppendElement(val, "-client_supports");
-		Tcl_DStringAppendElement(val, proto_str(s2n_connection_get_client_protocol_version(con_cx->s2n_con)));
+		sockopt_get_all(con_cx->fd, val);
 
-		Tcl_DStringAppendElement(val, "-protocol");
-		Tcl_DStringAppendElement(val, proto_str(s2n_connection_get_actual_protocol_version(con_cx->s2n_con)));
+	} else if (s2n_common_chan_get_option(con_cx, optname, val)) {
+		// Handled
 
-	} else if (strcmp(optname, "-servername") == 0) {
-		const char*		servername = s2n_get_server_name(con_cx->s2n_con);
-		if (servername) Tcl_DStringAppend(val, servername, -1);
+	} else if (sockopt_get(interp, con_cx->fd, optname, val, &code)) {
+		// Handled, code has the result
 
-	} else if (strcmp(optname, "-prefer") == 0) {
-		// TODO: keep a record of this
-		Tcl_DStringAppend(val, "<todo>", -1);
+	} else if (strcmp(optname, "-watch_updates") == 0) {
+		snprintf(buf, sizeof(buf), "%zu", con_cx->watch_updates);
+		Tcl_DStringAppend(val, buf, -1);
 
-	} else if (strcmp(optname, "-server_supports") == 0) {
-		Tcl_DStringAppend(val, proto_str(s2n_connection_get_server_protocol_version(con_cx->s2n_con)), -1);
+	} else if (strcmp(optname, "-linger") == 0) {
+		snprintf(buf, sizeof(buf), "%d", con_cx->linger_ms);
+		Tcl_DStringAppend(val, buf, -1);
 
-	} else if (strcmp(optname, "-client_supports") == 0) {
-		Tcl_DStringAppend(val, proto_str(s2n_connection_get_client_protocol_version(con_cx->s2n_con)), -1);
+	} else if (strcmp(optname, "-offload") == 0) {
+		Tcl_DStringAppend(val, con_cx->offload ? "1" : "0", -1);
 
-	} else if (strcmp(optname, "-protocol") == 0) {
-		Tcl_DStringAppend(val, proto_str(s2n_connection_get_actual_protocol_version(con_cx->s2n_con)), -1);
+	} else if (strcmp(optname, "-uring") == 0) {
+		Tcl_DStringAppend(val, con_cx->uring ? "1" : "0", -1);
 
 	} else {
-		code = Tcl_BadChannelOption(interp, optname, "servername prefer server_supports client_supports protocol");
+		code = Tcl_BadChannelOption(interp, optname, COMMON_OPTNAMES " watch_updates linger offload uring " SOCKOPT_NAMES);
 		Tcl_SetErrno(EINVAL);
 		goto finally;
 	}
@@ -365,12 +595,52 @@ finally:
 	return code;
 }
 
+//>>>
+static void s2n_direct_chan_set_watch(struct con_cx* con_cx, int mask) //<<<
+{
+	// Tcl calls watchProc far more often than the interest set actually
+	// changes, and with the epoll notifier each Tcl_CreateFileHandler costs an
+	// epoll_ctl syscall, so only touch the notifier when the mask differs
+	// from what is already registered for the fd.  -1 means no handler.
+	const int	want = mask ? mask : -1;
+
+	if (con_cx->uring) {
+		// Readiness comes from the ring's completions, which needs to know every time
+		if (want != con_cx->watch_mask) {
+			TRACE(con_cx, TR_WATCH_UPDATE, mask, con_cx->watch_mask, 0, 0);
+			con_cx->watch_mask = want;
+			con_cx->watch_updates++;
+		}
+		uring_watch(con_cx, mask);
+		return;
+	}
+
+	if (want == con_cx->watch_mask) return;
+
+	CLOGS(WATCH, "fd %d: %s -> %s", con_cx->fd, con_cx->watch_mask == -1 ? "none" : mask_str(con_cx->watch_mask), mask ? mask_str(mask) : "none");
+	TRACE(con_cx, TR_WATCH_UPDATE, mask, con_cx->watch_mask, 0, 0);
+	if (mask) {
+		Tcl_CreateFileHandler(con_cx->fd, mask, con_cx->lingering ? linger_handler : s2n_direct_chan_handler, con_cx);
+	} else {
+		Tcl_DeleteFileHandler(con_cx->fd);
+	}
+	con_cx->watch_mask = want;
+	con_cx->watch_updates++;
+}
+
 //>>>
 static void s2n_direct_chan_watch(ClientData cdata, int mask) //<<<
 {
 	struct con_cx*	con_cx = cdata;
 	const int gotmask = mask;
 
+	con_cx->watch_wanted = mask;
+	if (con_cx->offload) {
+		TRACE(con_cx, TR_WATCH, mask, gotmask, 0, 0);
+		offload_watch(con_cx, mask);
+		return;
+	}
+
 	if (!con_cx->handshake_done) {
 		// While the handshake is busy, signal that we want to be notified when IO is possible
 		mask &= TCL_EXCEPTION;
@@ -384,7 +654,9 @@ static void s2n_direct_chan_watch(ClientData cdata, int mask) //<<<
 	}
 
 	CLOGS(WATCH, "gotmask %s, forwarding %s", mask_str(gotmask), mask_str(mask));
-	Tcl_CreateFileHandler(con_cx->fd, mask, s2n_direct_chan_handler, con_cx);
+	TRACE(con_cx, TR_WATCH, mask, gotmask, 0, 0);
+	pending_watch(con_cx, mask);
+	s2n_direct_chan_set_watch(con_cx, mask);
 }
 
 //>>>
@@ -394,15 +666,26 @@ static int s2n_direct_chan_notify(Tcl_Event* ev, int flags) //<<<
 	struct con_cx*			con_cx = s2n_ev->con_cx;
 	int						mask = s2n_ev->mask;
 
+	// Events for a con_cx are deleted from the queue when its channel closes
+	// (see direct_ev_match), so con_cx is still live and chan still open here
 	CLOGS(IO, "mask: %s", mask_str(mask));
+	TRACE(con_cx, TR_NOTIFY, mask, 0, 0, 0);
 	Tcl_NotifyChannel(con_cx->chan, mask);
 	return 1;	// Event is freed by Tcl
 }
 
+//>>>
+static int direct_ev_match(Tcl_Event* ev, ClientData cdata) //<<<
+{
+	// Tcl_DeleteEvents predicate: the readiness events queued for con_cx cdata
+	return ev->proc == s2n_direct_chan_notify && ((struct s2n_direct_ev*)ev)->con_cx == cdata;
+}
+
 //>>>
 static void s2n_direct_chan_handler(ClientData cdata, int mask) //<<<
 {
 	struct con_cx*	con_cx = cdata;
+	const int		gotmask = mask;
 
 	if (con_cx->connected) {
 		CLOGS(IO, "mask: %s, connected: %d, handshake_done: %d", mask_str(mask), con_cx->connected, con_cx->handshake_done);
@@ -416,9 +699,9 @@ static void s2n_direct_chan_handler(ClientData cdata, int mask) //<<<
 
 		CLOGS(HANDSHAKE, "handshake not done, calling s2n_negotiate");
 		con_cx->blocked = S2N_NOT_BLOCKED;
-		const int neg_rc = s2n_negotiate(con_cx->s2n_con, &con_cx->blocked);
+		const int neg_rc = con_negotiate(con_cx);
 		if (neg_rc == S2N_SUCCESS) {
-			con_cx->handshake_done = 1;
+			handshake_complete(con_cx);
 			mask |= TCL_WRITABLE;
 			if (s2n_peek(con_cx->s2n_con) > 0) mask |= TCL_READABLE;
 		} else {
@@ -426,6 +709,7 @@ static void s2n_direct_chan_handler(ClientData cdata, int mask) //<<<
 				case S2N_ERR_T_BLOCKED:
 				{
 					int internal_mask = 0;
+					note_blocked(con_cx, con_cx->blocked);
 					switch (con_cx->blocked) {
 						case S2N_BLOCKED_ON_READ:	internal_mask |= TCL_READABLE; break;
 						case S2N_BLOCKED_ON_WRITE:	internal_mask |= TCL_WRITABLE; break;
@@ -433,22 +717,27 @@ static void s2n_direct_chan_handler(ClientData cdata, int mask) //<<<
 					}
 					if (internal_mask) {
 						CLOGS(HANDSHAKE, "handshake blocked on %s, passing on mask: %s", con_cx->blocked == S2N_BLOCKED_ON_WRITE ? "write" : "read", mask_str(internal_mask));
-						Tcl_CreateFileHandler(con_cx->fd, internal_mask, s2n_direct_chan_handler, con_cx);
+						s2n_direct_chan_set_watch(con_cx, internal_mask);
 					}
 					break;
 				}
 
 				case S2N_ERR_T_IO:
+					con_cx->handshake_error = Tcl_ErrnoMsg(errno);		// Like a refused -async connect
 					fprintf(stderr, "s2n_direct_chan_handler: s2n_negotiate failed: %s, errno: %d\n", s2n_strerror(s2n_errno, "EN"), errno);
+					direct_chan_refuse(con_cx);
 					break;
 
 				default:
 					fprintf(stderr, "s2n_direct_chan_handler: s2n_negotiate failed: %s\n", s2n_strerror(s2n_errno, "EN"));
+					con_cx->handshake_error = s2n_strerror(s2n_errno, "EN");
+					direct_chan_refuse(con_cx);
 					break;
 			}
 		}
 	}
 
+	TRACE(con_cx, TR_HANDLER, mask, gotmask, 0, 0);
 	if (mask) {
 		struct s2n_direct_ev*	ev = ckalloc(sizeof(struct s2n_direct_ev));
 		*ev = (struct s2n_direct_ev){
@@ -461,10 +750,250 @@ static void s2n_direct_chan_handler(ClientData cdata, int mask) //<<<
 	}
 }
 
+//>>>
+void direct_chan_ready(struct con_cx* con_cx, int mask) //<<<
+{
+	// For transports that report readiness themselves rather than through a file handler
+	s2n_direct_chan_handler(con_cx, mask);
+}
+
+//>>>
+void direct_chan_refuse(struct con_cx* con_cx) //<<<
+{
+	// Drop a connection before its handshake completes, the channel reads EOF until the script closes it
+	struct s2n_direct_ev*	ev = ckalloc(sizeof(struct s2n_direct_ev));
+
+	s2n_direct_chan_set_watch(con_cx, 0);
+	shutdown(con_cx->fd, SHUT_RDWR);
+	con_cx->read_closed = 1;
+	con_cx->write_closed = 1;		// Nothing to close_notify
+	con_cx->blocked = S2N_NOT_BLOCKED;	// Or a handshake it stopped would keep watching the socket
+	*ev = (struct s2n_direct_ev){
+		.ev.proc	= s2n_direct_chan_notify,
+		.con_cx		= con_cx,
+		.mask		= TCL_READABLE,
+	};
+	Tcl_QueueEvent(&ev->ev, TCL_QUEUE_TAIL);
+}
+
 //>>>
 
 // Direct channel implementation >>>
 // Common parts implementation <<<
+static const char* common_optnames[] = {
+	"-servername",
+	"-prefer",
+	"-server_supports",
+	"-client_supports",
+	"-protocol",
+	"-stats",
+	"-cipher",
+	"-kx_group",
+	"-handshake_type",
+	"-resumed",
+	"-peer_chain",
+	"-handshake_timeline",
+	"-session",
+	"-alpn",
+	"-coalesce_bytes",
+	"-coalesce_delay",
+	"-pending",
+	NULL
+};
+enum common_opt {
+	COPT_SERVERNAME,
+	COPT_PREFER,
+	COPT_SERVER_SUPPORTS,
+	COPT_CLIENT_SUPPORTS,
+	COPT_PROTOCOL,
+	COPT_STATS,
+	COPT_CIPHER,
+	COPT_KX_GROUP,
+	COPT_HANDSHAKE_TYPE,
+	COPT_RESUMED,
+	COPT_PEER_CHAIN,
+	COPT_HANDSHAKE_TIMELINE,
+	COPT_SESSION,
+	COPT_ALPN,
+	COPT_COALESCE_BYTES,
+	COPT_COALESCE_DELAY,
+	COPT_PENDING,
+};
+
+static int common_opt_reads_con(enum common_opt opt) //<<<
+{
+	switch (opt) {
+		case COPT_PREFER:
+		case COPT_STATS:
+		case COPT_HANDSHAKE_TIMELINE:
+		case COPT_COALESCE_BYTES:
+		case COPT_COALESCE_DELAY:
+			return 0;
+		default:
+			return 1;
+	}
+}
+
+//>>>
+static void s2n_common_chan_option_value(struct con_cx* con_cx, enum common_opt opt, Tcl_DString* val) //<<<
+{
+	if (con_cx->offload_opts && common_opt_reads_con(opt)) {
+		Tcl_DStringAppend(val, con_cx->offload_opts[opt], -1);
+		return;
+	}
+
+	switch (opt) {
+		case COPT_SERVERNAME:
+		{
+			const char*		servername = s2n_get_server_name(con_cx->s2n_con);
+			if (servername) Tcl_DStringAppend(val, servername, -1);
+			break;
+		}
+
+		case COPT_PREFER:
+			// TODO: keep a record of this
+			Tcl_DStringAppend(val, "<todo>", -1);
+			break;
+
+		case COPT_SERVER_SUPPORTS:
+			Tcl_DStringAppend(val, proto_str(s2n_connection_get_server_protocol_version(con_cx->s2n_con)), -1);
+			break;
+
+		case COPT_CLIENT_SUPPORTS:
+			Tcl_DStringAppend(val, proto_str(s2n_connection_get_client_protocol_version(con_cx->s2n_con)), -1);
+			break;
+
+		case COPT_PROTOCOL:
+			Tcl_DStringAppend(val, proto_str(s2n_connection_get_actual_protocol_version(con_cx->s2n_con)), -1);
+			break;
+
+		case COPT_STATS:
+			append_con_stats(val, con_cx);
+			break;
+
+		case COPT_CIPHER:
+		{
+			const char*		cipher = s2n_connection_get_cipher(con_cx->s2n_con);
+			if (cipher) Tcl_DStringAppend(val, cipher, -1);
+			break;
+		}
+
+		case COPT_KX_GROUP:
+			Tcl_DStringAppend(val, kx_group_str(con_cx->s2n_con), -1);
+			break;
+
+		case COPT_HANDSHAKE_TYPE:
+		{
+			const char*		type = s2n_connection_get_handshake_type_name(con_cx->s2n_con);
+			if (type) Tcl_DStringAppend(val, type, -1);
+			break;
+		}
+
+		case COPT_RESUMED:
+			Tcl_DStringAppend(val, s2n_connection_is_session_resumed(con_cx->s2n_con) == 1 ? "1" : "0", -1);
+			break;
+
+		case COPT_PEER_CHAIN:
+			append_peer_chain(val, con_cx);
+			break;
+
+		case COPT_HANDSHAKE_TIMELINE:
+			append_hs_timeline(val, con_cx);
+			break;
+
+		case COPT_SESSION:
+			append_session(val, con_cx);
+			break;
+
+		case COPT_ALPN:
+		{
+			const char*		protocol = s2n_get_application_protocol(con_cx->s2n_con);
+			if (protocol) Tcl_DStringAppend(val, protocol, -1);
+			break;
+		}
+
+		case COPT_COALESCE_BYTES:
+		case COPT_COALESCE_DELAY:
+		{
+			char	buf[TCL_INTEGER_SPACE];
+			snprintf(buf, sizeof(buf), "%d", opt == COPT_COALESCE_BYTES ? con_cx->coalesce_bytes : con_cx->coalesce_delay);
+			Tcl_DStringAppend(val, buf, -1);
+			break;
+		}
+
+		case COPT_PENDING:
+		{
+			char	buf[TCL_INTEGER_SPACE];
+			snprintf(buf, sizeof(buf), "%u", con_cx->s2n_con ? s2n_peek(con_cx->s2n_con) : 0);
+			Tcl_DStringAppend(val, buf, -1);
+			break;
+		}
+	}
+}
+
+//>>>
+static void offload_snapshot(struct con_cx* con_cx) //<<<
+{
+	// Once a channel is offloaded only the I/O thread may use its s2n_con,
+	// so the options that read it are answered from their values now
+	const int	count = sizeof(common_optnames) / sizeof(common_optnames[0]) - 1;
+
+	con_cx->offload_opts = (char**)ckalloc(count * sizeof(con_cx->offload_opts[0]));
+	for (int i=0; i<count; i++) {
+		Tcl_DString		ds;
+
+		Tcl_DStringInit(&ds);
+		if (i == COPT_PENDING) {
+			Tcl_DStringAppend(&ds, "0", 1);		// The I/O thread moves what s2n holds to the channel's queue, where it is readable
+		} else if (common_opt_reads_con(i)) {
+			s2n_common_chan_option_value(con_cx, i, &ds);
+		}
+		con_cx->offload_opts[i] = ckalloc(Tcl_DStringLength(&ds) + 1);
+		memcpy(con_cx->offload_opts[i], Tcl_DStringValue(&ds), Tcl_DStringLength(&ds) + 1);
+		Tcl_DStringFree(&ds);
+	}
+}
+
+//>>>
+static void offload_snapshot_free(struct con_cx* con_cx) //<<<
+{
+	const int	count = sizeof(common_optnames) / sizeof(common_optnames[0]) - 1;
+
+	if (con_cx->offload_opts == NULL) return;
+	for (int i=0; i<count; i++) ckfree(con_cx->offload_opts[i]);
+	ckfree(con_cx->offload_opts);
+	con_cx->offload_opts = NULL;
+}
+
+//>>>
+static int s2n_common_chan_get_option(struct con_cx* con_cx, const char* optname, Tcl_DString* val) //<<<
+{
+	// Returns 1 if optname was handled, 0 if it isn't a common option
+	if (optname == NULL) {
+		// Return all optionnames and their current values in val
+		for (int i=0; common_optnames[i]; i++) {
+			Tcl_DString		ds;
+
+			Tcl_DStringInit(&ds);
+			s2n_common_chan_option_value(con_cx, i, &ds);
+			Tcl_DStringAppendElement(val, common_optnames[i]);
+			Tcl_DStringAppendElement(val, Tcl_DStringValue(&ds));
+			Tcl_DStringFree(&ds);
+		}
+		return 1;
+	}
+
+	for (int i=0; common_optnames[i]; i++) {
+		if (strcmp(optname, common_optnames[i]) == 0) {
+			s2n_common_chan_option_value(con_cx, i, val);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+//>>>
 static int s2n_common_chan_input(ClientData cdata, char* buf, int toRead, int* errorCodePtr) //<<<
 {
 	struct con_cx*		con_cx = cdata;
@@ -473,6 +1002,8 @@ static int s2n_common_chan_input(ClientData cdata, char* buf, int toRead, int* e
 	int					read_total = 0;
 
 	if (con_cx->read_closed) return 0;
+	if (con_cx->offload) return offload_input(con_cx, buf, toRead, errorCodePtr);
+	if (coalesce_before_read(con_cx, errorCodePtr) == -1) return -1;
 
 	CLOGS(IO, "--> toRead: %d", toRead);
 	while (remain) {
@@ -481,14 +1012,16 @@ static int s2n_common_chan_input(ClientData cdata, char* buf, int toRead, int* e
 		if (got > 0) {
 			remain -= got;
 			read_total += got;
-			con_cx->read_count += got;
+			con_cx->stats.read_count += got;
 		} else if (got == 0) {
 			con_cx->read_closed = 1;
 			break;
         } else {
 			switch (s2n_error_get_type(s2n_errno)) {
 				case S2N_ERR_T_BLOCKED:
+					note_blocked(con_cx, blocked);
 					if (read_total == 0) {
+						con_cx->stats.eagain++;
 						*errorCodePtr = EAGAIN;
 						read_total = -1;
 					}
@@ -507,114 +1040,439 @@ static int s2n_common_chan_input(ClientData cdata, char* buf, int toRead, int* e
 	}
 
 	CLOGS(IO, "<-- toRead: %d returning %d", toRead, read_total);
+	TRACE(con_cx, TR_INPUT, 0, toRead, read_total, read_total == -1 ? s2n_errno : 0);
 	return read_total;
 }
 
 //>>>
-static int s2n_common_chan_output(ClientData cdata, const char* buf, int toWrite, int* errorCodePtr) //<<<
+static int con_send(struct con_cx* con_cx, const char* buf, int toWrite, int* errorCodePtr) //<<<
 {
-	struct con_cx*		con_cx = cdata;
 	s2n_blocked_status	blocked = S2N_NOT_BLOCKED;
-    int					bytes_written = 0;
+	int					bytes_written = 0;
 	int					remain = toWrite;
 
-	if (con_cx->write_closed) {
-		CLOGS(IO, "write closed");
-		*errorCodePtr = EPIPE;
-		return -1;
-	}
+	while (remain) {
+		const int	wrote = s2n_send(con_cx->s2n_con, buf+bytes_written, remain, &blocked);
+		CLOGS(IO, "\ts2n_send(%d) wrote %d bytes", remain, wrote);
+		if (wrote >= 0) {
+			bytes_written += wrote;
+			remain -= wrote;
+			con_cx->stats.write_count += wrote;
+		} else {
+			switch (s2n_error_get_type(s2n_errno)) {
+				case S2N_ERR_T_BLOCKED:
+					note_blocked(con_cx, blocked);
+					if (blocked == S2N_BLOCKED_ON_WRITE) {
+						if (bytes_written == 0) {
+							con_cx->stats.eagain++;
+							*errorCodePtr = EAGAIN;
+							bytes_written = -1;
+						}
+					}
+					return bytes_written;
 
-	CLOGS(IO, "--> toWrite: %d", toWrite);
-	if (g_unloading) {
-		CLOGS(IO, "unloading, returning ENOTCONN");
-		*errorCodePtr = ENOTCONN;
-		bytes_written = -1;
-		goto done;
-	}
+				case S2N_ERR_T_IO:
+					CLOGS(IO, "s2n_send error:%s  %s", Tcl_ErrnoId(), Tcl_ErrnoMsg(errno));
+					*errorCodePtr = errno;
+					return -1;
 
-	if (con_cx->handshake_done) {
-		while (remain) {
-			const int	wrote = s2n_send(con_cx->s2n_con, buf+bytes_written, remain, &blocked);
-			CLOGS(IO, "\ts2n_send(%d) wrote %d bytes", remain, wrote);
-			if (wrote >= 0) {
-				bytes_written += wrote;
-				remain -= wrote;
-				con_cx->write_count += wrote;
-			} else {
-				switch (s2n_error_get_type(s2n_errno)) {
-					case S2N_ERR_T_BLOCKED:
-						if (blocked == S2N_BLOCKED_ON_WRITE) {
-							if (bytes_written == 0) {
-								*errorCodePtr = EAGAIN;
-								bytes_written = -1;
-							}
-						}
-						goto done;
-
-					case S2N_ERR_T_IO:
-						CLOGS(IO, "s2n_send error:%s  %s", Tcl_ErrnoId(), Tcl_ErrnoMsg(errno));
-						*errorCodePtr = errno;
-						bytes_written = -1;
-						goto done;
-
-					default:
-						CLOGS(IO, "s2n_send error: %s", s2n_strerror(s2n_errno, "EN"));
-						*errorCodePtr = EIO;
-						bytes_written = -1;
-						goto done;
-				}
+				default:
+					CLOGS(IO, "s2n_send error: %s", s2n_strerror(s2n_errno, "EN"));
+					*errorCodePtr = EIO;
+					return -1;
 			}
 		}
-	} else {
-		CLOGS(IO, "handshake not done, returning EAGAIN");
-		*errorCodePtr = EAGAIN;
-		bytes_written = -1;
 	}
 
-done:
-	CLOGS(IO, "<-- toWrite: %d returning %d", toWrite, bytes_written);
 	return bytes_written;
 }
 
 //>>>
-static int s2n_common_chan_close2(ClientData cdata, Tcl_Interp* interp, int flags) //<<<
+static void pending_timer_cb(ClientData cdata) //<<<
 {
-	int				posixcode = 0;
 	struct con_cx*	con_cx = cdata;
 
-	CLOGS(IO, "--> %x", flags);
-	if (flags & TCL_CLOSE_READ) {
-		if (interp) {
-			Tcl_SetObjResult(interp, Tcl_ObjPrintf("s2n_common_chan_close2: Cannot close read side"));
-			Tcl_SetErrorCode(interp, "S2N", "CHAN", "CLOSE2", NULL);
-		}
-		posixcode = EINVAL;
-		goto finally;
-	} else if (flags & TCL_CLOSE_WRITE && !con_cx->write_closed) {
-		s2n_blocked_status	blocked = S2N_NOT_BLOCKED;
-		const int rc = s2n_shutdown_send(con_cx->s2n_con, &blocked);
-		if (rc == S2N_SUCCESS) {
-			con_cx->write_closed = 1;
-			if (con_cx->type == CHANTYPE_DIRECT) {
-				if (-1 == shutdown(con_cx->fd, SHUT_WR)) {
-					posixcode = errno;
-					goto set_interp_err_errno;
-				}
-			}
-		} else {
-			switch (s2n_error_get_type(s2n_errno)) {
-				case S2N_ERR_T_BLOCKED:
-				case S2N_ERR_T_CLOSED:
-					con_cx->write_closed = 1;
-					break;
+	con_cx->pending_timer = NULL;
+	if (con_cx->chan == NULL || con_cx->s2n_con == NULL) return;
+	if (s2n_peek(con_cx->s2n_con) == 0 && con_cx->rx_carry == NULL) return;		// Read since the timer was set
+	CLOGS(IO, "%u bytes pending in s2n, notifying readable", s2n_peek(con_cx->s2n_con));
+	Tcl_NotifyChannel(con_cx->chan, TCL_READABLE);	// Which updates the watch, rescheduling us if there is still more
+}
 
-				case S2N_ERR_T_IO:
-					posixcode = errno;
-					goto set_interp_err_s2n_errno;
+//>>>
+static void pending_cancel(struct con_cx* con_cx) //<<<
+{
+	if (con_cx->pending_timer) {
+		Tcl_DeleteTimerHandler(con_cx->pending_timer);
+		con_cx->pending_timer = NULL;
+	}
+}
 
-				case S2N_ERR_T_PROTO:
-					posixcode = EPROTO;
-					goto set_interp_err_s2n_errno;
+//>>>
+static void pending_watch(struct con_cx* con_cx, int mask) //<<<
+{
+	// Called with the channel's watch mask: if readable is wanted and s2n
+	// already holds decrypted plaintext, report it from the event loop (as
+	// Tcl does for its own buffers) instead of waiting for the socket.  The
+	// same goes for ciphertext carried over from another thread's ring.
+	con_cx->pending_watched = (mask & TCL_READABLE) != 0;
+	if (
+		con_cx->pending_watched &&
+		!con_cx->offload &&			// The I/O thread owns s2n_con
+		con_cx->s2n_con &&
+		(con_cx->rx_carry || (con_cx->handshake_done && s2n_peek(con_cx->s2n_con) > 0))
+	) {
+		if (con_cx->pending_timer == NULL)
+			con_cx->pending_timer = Tcl_CreateTimerHandler(0, pending_timer_cb, con_cx);
+	} else {
+		pending_cancel(con_cx);
+	}
+}
+
+//>>>
+static void coalesce_timer_cb(ClientData cdata);
+
+static void coalesce_schedule(struct con_cx* con_cx) //<<<
+{
+	// Tcl timers have millisecond resolution: round up, 0 flushes on the next trip through the event loop
+	if (con_cx->coalesce_timer == NULL)
+		con_cx->coalesce_timer = Tcl_CreateTimerHandler((con_cx->coalesce_delay + 999) / 1000, coalesce_timer_cb, con_cx);
+}
+
+//>>>
+static void coalesce_cancel(struct con_cx* con_cx) //<<<
+{
+	if (con_cx->coalesce_timer) {
+		Tcl_DeleteTimerHandler(con_cx->coalesce_timer);
+		con_cx->coalesce_timer = NULL;
+	}
+}
+
+//>>>
+static int coalesce_flush(struct con_cx* con_cx, int* errorCodePtr) //<<<
+{
+	// Returns 0 when nothing is left held, -1 otherwise (EAGAIN if the transport is full)
+	if (con_cx->coalesce_len == 0) return 0;
+
+	coalesce_cancel(con_cx);
+	const int	held = con_cx->coalesce_len;
+	const int	sent = con_send(con_cx, (const char*)con_cx->coalesce_buf, held, errorCodePtr);
+	TRACE(con_cx, TR_FLUSH, 0, held, sent, sent == -1 ? s2n_errno : 0);
+	if (sent == -1) return -1;
+
+	con_cx->stats.coalesce_flushes++;
+	con_cx->coalesce_len -= sent;
+	if (con_cx->coalesce_len) {
+		memmove(con_cx->coalesce_buf, con_cx->coalesce_buf + sent, con_cx->coalesce_len);
+		*errorCodePtr = EAGAIN;
+		return -1;
+	}
+
+	return 0;
+}
+
+//>>>
+static void coalesce_timer_cb(ClientData cdata) //<<<
+{
+	struct con_cx*	con_cx = cdata;
+	int				err = 0;
+
+	con_cx->coalesce_timer = NULL;
+	if (coalesce_flush(con_cx, &err) == -1 && err == EAGAIN)
+		coalesce_schedule(con_cx);		// Transport is full, try again later
+	// Other errors surface on the channel's next write, s2n_send fails the same way again
+}
+
+//>>>
+static int coalesce_before_read(struct con_cx* con_cx, int* errorCodePtr) //<<<
+{
+	// A blocking read may be waiting for the peer's reply to what is held,
+	// and the coalesce timer can't fire while the thread is blocked in it, so
+	// send held data first.  Returns -1 with *errorCodePtr set on failure.
+	int		err = 0;
+
+	if (con_cx->coalesce_len == 0 || !con_cx->blocking) return 0;
+	if (coalesce_flush(con_cx, &err) == -1 && err != EAGAIN) {
+		*errorCodePtr = err;
+		return -1;
+	}
+	return 0;
+}
+
+//>>>
+#define MAX_RECORD_PLAINTEXT	16384
+
+static int con_set_coalesce(Tcl_Interp* interp, struct con_cx* con_cx, const char* optname, const char* optval) //<<<
+{
+	int		code = TCL_OK;
+	int		v;
+	int		err = 0;
+
+	TEST_OK_LABEL(finally, code, Tcl_GetInt(interp, optval, &v));
+	if (con_cx->offload) THROW_PRINTF_LABEL(finally, code, "Can't set %s on an offloaded channel", optname);
+
+	if (strcmp(optname, "-coalesce_delay") == 0) {
+		if (v < 0) THROW_ERROR_LABEL(finally, code, "-coalesce_delay can't be negative");
+		con_cx->coalesce_delay = v;
+		if (con_cx->coalesce_timer) {
+			coalesce_cancel(con_cx);
+			coalesce_schedule(con_cx);
+		}
+	} else {
+		// A record carries at most 16 KiB of plaintext, holding more gains nothing
+		if (v < 0 || v > MAX_RECORD_PLAINTEXT) THROW_PRINTF_LABEL(finally, code, "-coalesce_bytes must be between 0 and %d", MAX_RECORD_PLAINTEXT);
+		if (v == con_cx->coalesce_bytes) goto finally;
+
+		if (con_cx->coalesce_len > v && coalesce_flush(con_cx, &err) == -1) {
+			Tcl_SetErrno(err);
+			THROW_POSIX_LABEL(finally, code, "Could not flush coalesced data");
+		}
+		if (v == 0 && con_cx->coalesce_len == 0) {
+			coalesce_cancel(con_cx);
+			ckfree(con_cx->coalesce_buf);
+			con_cx->coalesce_buf = NULL;
+		} else if (v > 0) {
+			con_cx->coalesce_buf = (uint8_t*)ckrealloc(con_cx->coalesce_buf, v);
+		}
+		con_cx->coalesce_bytes = v;
+	}
+
+finally:
+	return code;
+}
+
+//>>>
+static int s2n_common_chan_output(ClientData cdata, const char* buf, int toWrite, int* errorCodePtr) //<<<
+{
+	struct con_cx*		con_cx = cdata;
+	int					bytes_written = 0;
+
+	if (con_cx->write_closed) {
+		CLOGS(IO, "write closed");
+		*errorCodePtr = EPIPE;
+		return -1;
+	}
+
+	CLOGS(IO, "--> toWrite: %d", toWrite);
+	if (g_unloading) {
+		CLOGS(IO, "unloading, returning ENOTCONN");
+		*errorCodePtr = ENOTCONN;
+		bytes_written = -1;
+		goto done;
+	}
+
+	if (!con_cx->handshake_done) {
+		CLOGS(IO, "handshake not done, returning EAGAIN");
+		con_cx->stats.eagain++;
+		*errorCodePtr = EAGAIN;
+		bytes_written = -1;
+		goto done;
+	}
+
+	if (con_cx->offload) {
+		bytes_written = offload_output(con_cx, buf, toWrite, errorCodePtr);
+		goto done;
+	}
+
+	if (con_cx->coalesce_bytes) {
+		// Data held from earlier writes goes first, and if this write doesn't fit behind it, now
+		if (con_cx->coalesce_len + toWrite > con_cx->coalesce_bytes && coalesce_flush(con_cx, errorCodePtr) == -1) {
+			bytes_written = -1;
+			goto done;
+		}
+
+		if (toWrite < con_cx->coalesce_bytes) {
+			memcpy(con_cx->coalesce_buf + con_cx->coalesce_len, buf, toWrite);
+			con_cx->coalesce_len += toWrite;
+			con_cx->stats.coalesced++;
+			bytes_written = toWrite;
+
+			if (con_cx->coalesce_len == con_cx->coalesce_bytes) {
+				int		err = 0;
+				if (coalesce_flush(con_cx, &err) == -1 && err == EAGAIN) coalesce_schedule(con_cx);
+			} else {
+				coalesce_schedule(con_cx);
+			}
+			goto done;
+		}
+		// Writes that would fill a record by themselves aren't held
+	}
+
+	bytes_written = con_send(con_cx, buf, toWrite, errorCodePtr);
+
+done:
+	CLOGS(IO, "<-- toWrite: %d returning %d", toWrite, bytes_written);
+	TRACE(con_cx, TR_OUTPUT, 0, toWrite, bytes_written, bytes_written == -1 ? s2n_errno : 0);
+	return bytes_written;
+}
+
+//>>>
+#define LINGER_DEFAULT_MS	2000
+
+static int linger_step(struct con_cx* con_cx) //<<<
+{
+	// Returns the mask to wait for, or 0 when done.  Failures also end it,
+	// the channel is gone and there's nobody to report them to.  With
+	// linger_ms 0 it's done once the close_notify is sent, without the peer's.
+	s2n_blocked_status	blocked = S2N_NOT_BLOCKED;
+	int					err = 0;
+
+	if (con_cx->coalesce_len && coalesce_flush(con_cx, &err) == -1)
+		return err == EAGAIN ? TCL_WRITABLE : 0;
+
+	const int	rc = con_cx->linger_ms ?
+		s2n_shutdown(con_cx->s2n_con, &blocked) :
+		s2n_shutdown_send(con_cx->s2n_con, &blocked);
+	if (rc == S2N_SUCCESS) return 0;
+	if (s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED) return 0;
+	note_blocked(con_cx, blocked);
+	return blocked == S2N_BLOCKED_ON_WRITE ? TCL_WRITABLE : TCL_READABLE;
+}
+
+//>>>
+static void linger_finish(struct con_cx* con_cx) //<<<
+{
+	CLOGS(LIFECYCLE, "linger done: %s", clogs_name(con_cx));
+	if (con_cx->linger_timer) {
+		Tcl_DeleteTimerHandler(con_cx->linger_timer);
+		con_cx->linger_timer = NULL;
+	}
+	s2n_direct_chan_set_watch(con_cx, 0);
+	close(con_cx->fd);
+	free_con_cx(con_cx);
+}
+
+//>>>
+static void linger_handler(ClientData cdata, int mask) //<<<
+{
+	struct con_cx*	con_cx = cdata;
+	const int		want = linger_step(con_cx);
+
+	if (want == 0) {
+		linger_finish(con_cx);
+	} else {
+		s2n_direct_chan_set_watch(con_cx, want);
+	}
+}
+
+//>>>
+static void linger_timeout(ClientData cdata) //<<<
+{
+	struct con_cx*	con_cx = cdata;
+
+	// The peer didn't finish in time, give up on its close_notify (and anything still unsent)
+	con_cx->linger_timer = NULL;
+	linger_finish(con_cx);
+}
+
+//>>>
+static void linger_start(struct con_cx* con_cx) //<<<
+{
+	// The channel goes away now, but the connection stays until the
+	// close_notify exchange completes (after anything still held has been
+	// sent), or linger_ms passes, driven by the event loop.  With linger_ms
+	// 0 only what the socket takes straight away is sent.
+	s2n_direct_chan_set_watch(con_cx, 0);
+	coalesce_cancel(con_cx);
+	pending_cancel(con_cx);
+	Tcl_DeleteEvents(direct_ev_match, con_cx);		// Readiness for the channel that's gone
+	con_cx->chan = NULL;
+	con_cx->closed = 1;
+	con_cx->lingering = 1;
+	con_cx->linger_thread = Tcl_GetCurrentThread();
+	if (-1 == fcntl(con_cx->fd, F_SETFL, fcntl(con_cx->fd, F_GETFL) | O_NONBLOCK)) {
+		linger_finish(con_cx);
+		return;
+	}
+
+	const int	want = linger_step(con_cx);
+	if (want == 0 || con_cx->linger_ms == 0) {
+		linger_finish(con_cx);
+		return;
+	}
+	s2n_direct_chan_set_watch(con_cx, want);
+	con_cx->linger_timer = Tcl_CreateTimerHandler(con_cx->linger_ms, linger_timeout, con_cx);
+}
+
+//>>>
+static int s2n_common_chan_close2(ClientData cdata, Tcl_Interp* interp, int flags) //<<<
+{
+	int				posixcode = 0;
+	struct con_cx*	con_cx = cdata;
+
+	CLOGS(IO, "--> %x", flags);
+	TRACE(con_cx, TR_CLOSE, flags, 0, 0, 0);
+	if (con_cx->offload) {
+		if (flags) {
+			if (interp) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("s2n_common_chan_close2: Cannot half-close an offloaded channel"));
+				Tcl_SetErrorCode(interp, "S2N", "CHAN", "CLOSE2", NULL);
+			}
+			posixcode = EINVAL;
+			goto finally;
+		}
+		con_cx->closed = 1;
+		offload_close(con_cx);		// The I/O thread sends the close_notify, then this thread frees con_cx
+		goto finally;
+	}
+	// -uring channels don't linger: the ring sends what's staged (including
+	// the close_notify below) after the channel has gone, but nothing there
+	// would wait for the peer's close_notify
+	if (
+		flags == 0 &&
+		con_cx->type == CHANTYPE_DIRECT &&
+		con_cx->uring == NULL &&
+		con_cx->handshake_done &&
+		!con_cx->write_closed &&
+		!g_unloading
+	) {
+		linger_start(con_cx);		// Sends held data without blocking, frees con_cx when it's done
+		goto finally;
+	}
+	if (con_cx->coalesce_len && !con_cx->write_closed && !(flags & TCL_CLOSE_READ)) {
+		// Held data has to go out before the close_notify, and these can't
+		// linger to send it later (stacked and -uring channels, half-closes),
+		// so wait for the transport if it's full
+		int		err = 0;
+		if (con_cx->type == CHANTYPE_DIRECT) {
+			s2n_direct_chan_block_mode(con_cx, TCL_MODE_BLOCKING);
+		} else {
+			s2n_stacked_chan_block_mode(con_cx, TCL_MODE_BLOCKING);
+		}
+		if (coalesce_flush(con_cx, &err) == -1) CLOGS(IO, "flushing coalesced data failed: %s", Tcl_ErrnoMsg(err));
+	}
+	if (flags & TCL_CLOSE_READ) {
+		if (interp) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("s2n_common_chan_close2: Cannot close read side"));
+			Tcl_SetErrorCode(interp, "S2N", "CHAN", "CLOSE2", NULL);
+		}
+		posixcode = EINVAL;
+		goto finally;
+	} else if (flags & TCL_CLOSE_WRITE && !con_cx->write_closed) {
+		s2n_blocked_status	blocked = S2N_NOT_BLOCKED;
+		const int rc = s2n_shutdown_send(con_cx->s2n_con, &blocked);
+		if (rc == S2N_SUCCESS) {
+			con_cx->write_closed = 1;
+			if (con_cx->type == CHANTYPE_DIRECT) {
+				if (-1 == shutdown(con_cx->fd, SHUT_WR)) {
+					posixcode = errno;
+					goto set_interp_err_errno;
+				}
+			}
+		} else {
+			switch (s2n_error_get_type(s2n_errno)) {
+				case S2N_ERR_T_BLOCKED:
+				case S2N_ERR_T_CLOSED:
+					con_cx->write_closed = 1;
+					break;
+
+				case S2N_ERR_T_IO:
+					posixcode = errno;
+					goto set_interp_err_s2n_errno;
+
+				case S2N_ERR_T_PROTO:
+					posixcode = EPROTO;
+					goto set_interp_err_s2n_errno;
 
 				default:
 					posixcode = EINVAL;
@@ -624,35 +1482,17 @@ static int s2n_common_chan_close2(ClientData cdata, Tcl_Interp* interp, int flag
 
 	} else if (flags == 0) {
 		CLOGS(LIFECYCLE, "closing connection %s", S2N_CON_NAME(con_cx->s2n_con));
-		if (con_cx->write_closed) {
-			goto close_sock;
-		} else {
+		if (!con_cx->write_closed && con_cx->handshake_done) {
+			// Channels that can't linger (stacked ones, whose base channel
+			// Tcl closes next) send their close_notify without waiting for
+			// the peer's, which would block the event loop.  Failures don't
+			// stop the close, the connection is going away regardless.
 			s2n_blocked_status	blocked = S2N_NOT_BLOCKED;
-			CLOGS(IO, "calling s2n_shutdown %s", S2N_CON_NAME(con_cx->s2n_con));
-			const int rc = s2n_shutdown(con_cx->s2n_con, &blocked);
-			// TODO: Handle blocked?
-			if (rc == S2N_SUCCESS) {
-				goto close_sock;
-			} else {
-				switch (s2n_error_get_type(s2n_errno)) {
-					case S2N_ERR_T_BLOCKED:
-					case S2N_ERR_T_CLOSED:
-						goto close_sock;
-
-					case S2N_ERR_T_IO:
-						posixcode = errno;
-						goto set_interp_err_s2n_errno;
-
-					case S2N_ERR_T_PROTO:
-						posixcode = EPROTO;
-						goto set_interp_err_s2n_errno;
-
-					default:
-						posixcode = EINVAL;
-						goto set_interp_err_s2n_errno;
-				}
-			}
+			CLOGS(IO, "calling s2n_shutdown_send %s", S2N_CON_NAME(con_cx->s2n_con));
+			if (s2n_shutdown_send(con_cx->s2n_con, &blocked) != S2N_SUCCESS)
+				CLOGS(IO, "s2n_shutdown_send failed: %s", s2n_strerror(s2n_errno, "EN"));
 		}
+		goto close_sock;
 
 	} else {
 		if (interp) {
@@ -690,7 +1530,12 @@ close_sock:
 	{
 		const int is_direct	= con_cx->type == CHANTYPE_DIRECT;
 		int rc = 0;
-		if (is_direct) rc = close(con_cx->fd);
+		if (is_direct && con_cx->uring) {
+			uring_close(con_cx);		// Closes the fd once what's staged has been sent
+		} else if (is_direct) {
+			s2n_direct_chan_set_watch(con_cx, 0);
+			rc = close(con_cx->fd);
+		}
 		free_con_cx(con_cx);
 		con_cx = NULL;
 		if (is_direct && rc == -1) {
@@ -706,6 +1551,36 @@ static void s2n_common_chan_thread_action(ClientData cdata, int action) //<<<
 {
 	struct con_cx*	con_cx = cdata;
 	CLOGS(LIFECYCLE, "%s: %s", S2N_CON_NAME(con_cx->s2n_con), action_str(action));
+
+	// The coalescing and pending timers belong to the thread's notifier, as
+	// do a direct channel's file handler, io_uring ring and queued readiness
+	// events, so they move with the channel, and handshake admission control
+	// is per thread
+	const int	watched = con_cx->type == CHANTYPE_DIRECT && !con_cx->offload;
+
+	switch (action) {
+		case TCL_CHANNEL_THREAD_REMOVE:
+			coalesce_cancel(con_cx);
+			pending_cancel(con_cx);
+			if (watched) {
+				s2n_direct_chan_set_watch(con_cx, 0);		// Also resets the cached mask
+				Tcl_DeleteEvents(direct_ev_match, con_cx);
+			}
+			if (con_cx->uring) uring_detach(con_cx);
+			admission_thread_remove(con_cx);
+			break;
+		case TCL_CHANNEL_THREAD_INSERT:
+			if (con_cx->coalesce_len) coalesce_schedule(con_cx);
+			if (con_cx->use_uring && !con_cx->offload) uring_attach(con_cx);	// Else it stays on the fd path
+			if (watched) {
+				s2n_direct_chan_watch(con_cx, con_cx->watch_wanted);	// Which also sets the pending timer
+			} else {
+				pending_watch(con_cx, con_cx->pending_watched ? TCL_READABLE : 0);
+			}
+			if (con_cx->offload) offload_thread_insert(con_cx);
+			admission_thread_insert(con_cx);
+			break;
+	}
 }
 
 //>>>
@@ -715,7 +1590,7 @@ static int s2n_common_chan_seek(ClientData cdata, long offset, int mode, int* er
 
 	CLOGS(IO, "--> offset: %ld, mode: %d", offset, mode);
 	if (mode == SEEK_CUR) {
-		return con_cx->write_count;
+		return con_cx->stats.write_count;
 	}
 	*errorCodePtr = EINVAL;
 	return -1;
@@ -782,6 +1657,11 @@ static void forget_chan(struct con_cx* con_cx) //<<<
 
 	CLOGS(LIFECYCLE, "forgetting chan %s", clogs_name(con_cx));
 	Tcl_MutexLock(&g_init_mutex);
+	if (!con_cx->registered) {
+		// Unloading dropped it from another thread since the caller looked
+		Tcl_MutexUnlock(&g_init_mutex);
+		return;
+	}
 	he = Tcl_FindHashEntry(&g_managed_chans, con_cx);
 	if (!he) Tcl_Panic("forget_chan: not registered");
 	Tcl_DeleteHashEntry(he);
@@ -799,18 +1679,83 @@ Tcl_ObjType s2n_config_type = {
 	.dupIntRepProc	= dup_s2n_config_intrep,
 };
 
-static void free_s2n_config_intrep(Tcl_Obj* obj) //<<<
+static struct config_cx* config_cx_new(void) //<<<
 {
-	struct s2n_config*	config = NULL;
+	struct config_cx*	cfg = (struct config_cx*)ckalloc(sizeof *cfg);
 
+	*cfg = (struct config_cx){0};
+	atomic_init(&cfg->refcount, 1);
+	return cfg;
+}
+
+//>>>
+void config_cx_incref(struct config_cx* cfg) //<<<
+{
+	atomic_fetch_add(&cfg->refcount, 1);
+}
+
+//>>>
+void config_cx_decref(struct config_cx* cfg) //<<<
+{
+	if (atomic_fetch_sub(&cfg->refcount, 1) > 1) return;
+
+	CLOGS(LIFECYCLE, "freeing config_cx %s", clogs_name(cfg));
+	if (cfg->config) {
+		if (-1 == s2n_config_free(cfg->config))
+			Tcl_Panic("s2n_config_free failed: %s\n", s2n_strerror(s2n_errno, "EN"));
+		cfg->config = NULL;
+	}
+	for (int i=0; i<cfg->staplers_count; i++) {
+		ocsp_stapler_free(cfg->staplers[i]);
+		cfg->staplers[i] = NULL;
+	}
+	if (cfg->staplers) {
+		ckfree(cfg->staplers);
+		cfg->staplers = NULL;
+	}
+	if (cfg->ocsp_lock) {
+		ocsp_lock_free(cfg->ocsp_lock);
+		cfg->ocsp_lock = NULL;
+	}
+	if (cfg->session_cache) {
+		session_cache_free(cfg->session_cache);
+		cfg->session_cache = NULL;
+	}
+	if (cfg->sni) {
+		sni_map_free(cfg->sni);
+		cfg->sni = NULL;
+	}
+	if (cfg->cipher_preferences) {
+		ckfree(cfg->cipher_preferences);
+		cfg->cipher_preferences = NULL;
+	}
+	if (cfg->spec) {
+		ckfree(cfg->spec);
+		cfg->spec = NULL;
+	}
+	for (int i=0; i<cfg->certs_count; i++) {
+		if (-1 == s2n_cert_chain_and_key_free(cfg->certs[i]))
+			Tcl_Panic("s2n_cert_chain_and_key_free failed: %s\n", s2n_strerror(s2n_errno, "EN"));
+		cfg->certs[i] = NULL;
+	}
+	if (cfg->certs) {
+		ckfree(cfg->certs);
+		cfg->certs = NULL;
+	}
+	ckfree(cfg);
+}
+
+//>>>
+static void free_s2n_config_intrep(Tcl_Obj* obj) //<<<
+{
 	CLOGS(LIFECYCLE, "freeing config %s", clogs_name(obj));
 	forget_intrep(obj);
 	Tcl_ObjInternalRep*	ir = Tcl_FetchInternalRep(obj, &s2n_config_type);
 	if (ir) {
-		config = (struct s2n_config*)ir->twoPtrValue.ptr1;
-		if (config) {
-			s2n_config_free(config);
-			config = NULL;
+		struct config_cx*	cfg = (struct config_cx*)ir->twoPtrValue.ptr1;
+		if (cfg) {
+			config_cx_decref(cfg);
+			cfg = NULL;
 		}
 	}
 }
@@ -824,19 +1769,59 @@ static void dup_s2n_config_intrep(Tcl_Obj* src, Tcl_Obj* dst) //<<<
 }
 
 //>>>
-static int get_s2n_config_from_obj(Tcl_Interp* interp, Tcl_Obj* obj, struct s2n_config** config) //<<<
+static int set_alpn(Tcl_Interp* interp, Tcl_Obj* list, struct s2n_config* config, struct s2n_connection* s2n_con) //<<<
+{
+	// Set the ALPN preferences of either config or s2n_con
+	int				code = TCL_OK;
+	Tcl_Obj**		ov;
+	Tcl_Size		oc;
+	const char**	protocols = NULL;
+
+	TEST_OK_LABEL(finally, code, Tcl_ListObjGetElements(interp, list, &oc, &ov));
+	protocols = (const char**)ckalloc((oc ? oc : 1) * sizeof(protocols[0]));
+	for (Tcl_Size i=0; i<oc; i++) {
+		Tcl_Size	len;
+		protocols[i] = Tcl_GetStringFromObj(ov[i], &len);
+		if (len < 1 || len > 255) THROW_ERROR_LABEL(finally, code, "ALPN protocol names must be 1 to 255 bytes");
+	}
+
+	if (config) {
+		CHECK_S2N(finally, code, s2n_config_set_protocol_preferences(config, protocols, oc));
+	} else {
+		CHECK_S2N(finally, code, s2n_connection_set_protocol_preferences(s2n_con, protocols, oc));
+	}
+
+finally:
+	if (protocols) {
+		ckfree(protocols);
+		protocols = NULL;
+	}
+	return code;
+}
+
+//>>>
+int get_config_cx_from_obj(Tcl_Interp* interp, Tcl_Obj* obj, struct config_cx** config_cx) //<<<
 {
 	int					code = TCL_OK;
 	Tcl_DictSearch		search = {0};
 	Tcl_ObjInternalRep*	ir = Tcl_FetchInternalRep(obj, &s2n_config_type);
-	struct s2n_config*	c = NULL;
+	struct config_cx*	cfg = NULL;
+	Tcl_Obj*			truststore_key = NULL;
 
 	if (!ir) {
 		Tcl_Obj*		key = NULL;
 		Tcl_Obj*		val = NULL;
+		Tcl_Obj*		truststore = NULL;
 		int				done;
 
-		c = s2n_config_new();
+		// A truststore replaces the system trust store, so skip loading it
+		replace_tclobj(&truststore_key, Tcl_NewStringObj("truststore", -1));
+		TEST_OK_LABEL(finally, code, Tcl_DictObjGet(interp, obj, truststore_key, &truststore));
+
+		cfg = config_cx_new();
+		cfg->config = truststore ? s2n_config_new_minimal() : s2n_config_new();
+		struct s2n_config*	c = cfg->config;
+		CHECK_S2N(finally, code, s2n_config_set_ctx(c, cfg));		// For ocsp_handshake_enter to find cfg from a connection
 
 		TEST_OK_LABEL(finally, code, Tcl_DictObjFirst(interp, obj, &search, &key, &val, &done));
 		for (; !done; Tcl_DictObjNext(&search, &key, &val, &done)) {
@@ -844,12 +1829,28 @@ static int get_s2n_config_from_obj(Tcl_Interp* interp, Tcl_Obj* obj, struct s2n_
 				"session_tickets",
 				"ticket_lifetime",
 				"cipher_preferences",
+				"certificates",
+				"trust_pem",
+				"ticket_keys",
+				"truststore",
+				"session_cache",
+				"sni",
+				"alpn",
+				"serialization",
 				NULL
 			};
 			enum config {
 				CONFIG_SESSION_TICKETS,
 				CONFIG_TICKET_LIFETIME,
 				CONFIG_CIPHER_PREFERENCES,
+				CONFIG_CERTIFICATES,
+				CONFIG_TRUST_PEM,
+				CONFIG_TICKET_KEYS,
+				CONFIG_TRUSTSTORE,
+				CONFIG_SESSION_CACHE,
+				CONFIG_SNI,
+				CONFIG_ALPN,
+				CONFIG_SERIALIZATION,
 			} conf_name;
 			int conf_name_int;
 
@@ -861,7 +1862,7 @@ static int get_s2n_config_from_obj(Tcl_Interp* interp, Tcl_Obj* obj, struct s2n_
 				{
 					uint8_t	enabled;
 					TEST_OK_LABEL(finally, code, Tcl_GetBooleanFromObj(interp, val, &enabled));
-					CHECK_S2N(finally, code, s2n_config_set_session_cache_onoff(c, enabled));
+					CHECK_S2N(finally, code, s2n_config_set_session_tickets_onoff(c, enabled));
 					break;
 				}
 
@@ -872,7 +1873,7 @@ static int get_s2n_config_from_obj(Tcl_Interp* interp, Tcl_Obj* obj, struct s2n_
 					Tcl_WideInt	lifetime;
 
 					TEST_OK_LABEL(finally, code, Tcl_ListObjGetElements(interp, val, &oc, &ov));
-					if (oc != 2) THROW_ERROR_LABEL(finally, code, "ticket_lifetime must be a list of two integers", val);
+					if (oc != 2) THROW_ERROR_LABEL(finally, code, "ticket_lifetime must be a list of two integers");
 					TEST_OK_LABEL(finally, code, Tcl_GetWideIntFromObj(interp, ov[0], &lifetime));
 					CHECK_S2N(finally, code, s2n_config_set_ticket_encrypt_decrypt_key_lifetime(c, lifetime));
 					TEST_OK_LABEL(finally, code, Tcl_GetWideIntFromObj(interp, ov[1], &lifetime));
@@ -881,70 +1882,555 @@ static int get_s2n_config_from_obj(Tcl_Interp* interp, Tcl_Obj* obj, struct s2n_
 				}
 
 				case CONFIG_CIPHER_PREFERENCES:
-					CHECK_S2N(finally, code, s2n_config_set_cipher_preferences(c, Tcl_GetString(val)));
+				{
+					Tcl_Size	len;
+					const char*	policy = Tcl_GetStringFromObj(val, &len);
+
+					CHECK_S2N(finally, code, s2n_config_set_cipher_preferences(c, policy));
+					if (cfg->cipher_preferences) ckfree(cfg->cipher_preferences);
+					cfg->cipher_preferences = ckalloc(len+1);
+					memcpy(cfg->cipher_preferences, policy, len+1);
+					break;
+				}
+
+				case CONFIG_CERTIFICATES:
+				{
+					Tcl_Obj**	ov;
+					Tcl_Size	oc;
+
+					TEST_OK_LABEL(finally, code, Tcl_ListObjGetElements(interp, val, &oc, &ov));
+					cfg->certs = (struct s2n_cert_chain_and_key**)ckrealloc(cfg->certs, (cfg->certs_count + oc) * sizeof(cfg->certs[0]));
+					for (Tcl_Size i=0; i<oc; i++) {
+						Tcl_Obj**	pv;
+						Tcl_Size	pc;
+
+						TEST_OK_LABEL(finally, code, Tcl_ListObjGetElements(interp, ov[i], &pc, &pv));
+						if (pc != 2 && pc != 3) THROW_ERROR_LABEL(finally, code, "certificates must be a list of {chain_pem key_pem ?ocsp?} lists");
+
+						struct s2n_cert_chain_and_key*	chain_and_key = s2n_cert_chain_and_key_new();
+						if (chain_and_key == NULL) CHECK_S2N(finally, code, S2N_FAILURE);
+						cfg->certs[cfg->certs_count++] = chain_and_key;		// Owned by cfg from here, even if loading fails
+						CHECK_S2N(finally, code, s2n_cert_chain_and_key_load_pem(chain_and_key, Tcl_GetString(pv[0]), Tcl_GetString(pv[1])));
+						CHECK_S2N(finally, code, s2n_config_add_cert_chain_and_key_to_store(c, chain_and_key));
+						if (pc == 3) {
+							cfg->staplers = (struct ocsp_stapler**)ckrealloc(cfg->staplers, (cfg->staplers_count + 1) * sizeof(cfg->staplers[0]));
+							TEST_OK_LABEL(finally, code, ocsp_stapler_new(interp, cfg, chain_and_key, pv[2], &cfg->staplers[cfg->staplers_count]));
+							cfg->staplers_count++;
+						}
+					}
+					break;
+				}
+
+				case CONFIG_TRUST_PEM:
+					CHECK_S2N(finally, code, s2n_config_add_pem_to_trust_store(c, Tcl_GetString(val)));
+					break;
+
+				case CONFIG_TICKET_KEYS:
+				{
+					Tcl_Obj**	ov;
+					Tcl_Size	oc;
+
+					TEST_OK_LABEL(finally, code, Tcl_ListObjGetElements(interp, val, &oc, &ov));
+					CHECK_S2N(finally, code, s2n_config_set_session_tickets_onoff(c, 1));
+					for (Tcl_Size i=0; i<oc; i++) {
+						Tcl_Obj**		pv;
+						Tcl_Size		pc, name_len, secret_len;
+
+						TEST_OK_LABEL(finally, code, Tcl_ListObjGetElements(interp, ov[i], &pc, &pv));
+						if (pc != 2) THROW_ERROR_LABEL(finally, code, "ticket_keys must be a list of {name secret} pairs");
+						const char*		name	= Tcl_GetStringFromObj(pv[0], &name_len);
+						unsigned char*	secret	= Tcl_GetByteArrayFromObj(pv[1], &secret_len);
+						CHECK_S2N(finally, code, s2n_config_add_ticket_crypto_key(c, (const uint8_t*)name, name_len, secret, secret_len, 0));
+					}
+					break;
+				}
+
+				case CONFIG_TRUSTSTORE:
+					TEST_OK_LABEL(finally, code, truststore_attach(interp, c, val));
 					break;
 
-				default: THROW_ERROR_LABEL(finally, code, "Unhandled config", key);
+				case CONFIG_SESSION_CACHE:
+					if (cfg->session_cache) THROW_ERROR_LABEL(finally, code, "Duplicate session_cache");
+					TEST_OK_LABEL(finally, code, session_cache_new(interp, val, &cfg->session_cache));
+					CHECK_S2N(finally, code, s2n_config_set_session_tickets_onoff(c, 1));
+					break;
+
+				case CONFIG_SNI:
+				{
+					Tcl_DictSearch		sni_search = {0};
+					Tcl_Obj*			name;
+					Tcl_Obj*			sni_config;
+					int					sni_done;
+
+					if (cfg->sni) THROW_ERROR_LABEL(finally, code, "Duplicate sni");
+					cfg->sni = sni_map_new();
+					TEST_OK_LABEL(finally, code, Tcl_DictObjFirst(interp, val, &sni_search, &name, &sni_config, &sni_done));
+					for (; !sni_done; Tcl_DictObjNext(&sni_search, &name, &sni_config, &sni_done)) {
+						struct config_cx*	target = NULL;
+						if (
+							TCL_OK != (code = get_config_cx_from_obj(interp, sni_config, &target)) ||
+							TCL_OK != (code = sni_map_add(interp, cfg->sni, Tcl_GetString(name), target))
+						) {
+							Tcl_DictObjDone(&sni_search);
+							goto finally;
+						}
+					}
+					CHECK_S2N(finally, code, s2n_config_set_client_hello_cb(c, sni_client_hello_cb, cfg->sni));
+					break;
+				}
+
+				case CONFIG_ALPN:
+					TEST_OK_LABEL(finally, code, set_alpn(interp, val, c, NULL));
+					break;
+
+				case CONFIG_SERIALIZATION:
+				{
+					int	enabled;
+					TEST_OK_LABEL(finally, code, Tcl_GetBooleanFromObj(interp, val, &enabled));
+					CHECK_S2N(finally, code, s2n_config_set_serialization_version(c, enabled ? S2N_SERIALIZED_CONN_V1 : S2N_SERIALIZED_CONN_NONE));
+					break;
+				}
+
+				default: THROW_ERROR_LABEL(finally, code, "Unhandled config ", Tcl_GetString(key));
 			}
 		}
 
-		Tcl_GetString(obj);	// Ensure that the string rep is generated before we take over the intrep - we can't generate our own
-		Tcl_StoreInternalRep(obj, &s2n_config_type, &(Tcl_ObjInternalRep){.twoPtrValue.ptr1 = c});
-		c = NULL;		// Hand ownership to the intrep
+		Tcl_Size	speclen;
+		const char*	spec = Tcl_GetStringFromObj(obj, &speclen);	// Ensure that the string rep is generated before we take over the intrep - we can't generate our own
+		cfg->spec = ckalloc(speclen+1);
+		memcpy(cfg->spec, spec, speclen+1);
+		Tcl_StoreInternalRep(obj, &s2n_config_type, &(Tcl_ObjInternalRep){.twoPtrValue.ptr1 = cfg});
+		cfg = NULL;		// Hand our ref to the intrep
 		register_intrep(obj);
 		ir = Tcl_FetchInternalRep(obj, &s2n_config_type);
 		CLOGS(LIFECYCLE, "created config %s", clogs_name(obj));
 	}
 
-	*config = (struct s2n_config*)ir->twoPtrValue.ptr1;
+	*config_cx = (struct config_cx*)ir->twoPtrValue.ptr1;
+
+finally:
+	Tcl_DictObjDone(&search);
+	replace_tclobj(&truststore_key, NULL);
+	if (cfg) {
+		config_cx_decref(cfg);
+		cfg = NULL;
+	}
+	return code;
+}
+
+//>>>
+static int con_set_session(Tcl_Interp* interp, struct con_cx* con_cx, Tcl_Obj* hex) //<<<
+{
+	int				code = TCL_OK;
+	Tcl_Size		hexlen;
+	const char*		str = Tcl_GetStringFromObj(hex, &hexlen);
+	uint8_t*		session = NULL;
+
+	if (hexlen == 0) goto finally;		// No session to resume
+	if (hexlen % 2) THROW_ERROR_LABEL(finally, code, "-session must be hex encoded");
+
+	session = (uint8_t*)ckalloc(hexlen/2);
+	for (Tcl_Size i=0; i<hexlen/2; i++) {
+		unsigned int	byte;
+		if (1 != sscanf(str + i*2, "%2x", &byte)) THROW_ERROR_LABEL(finally, code, "-session must be hex encoded");
+		session[i] = byte;
+	}
+	CHECK_S2N(finally, code, s2n_connection_set_session(con_cx->s2n_con, session, hexlen/2));
+
+finally:
+	if (session) {
+		ckfree(session);
+		session = NULL;
+	}
+	return code;
+}
+
+//>>>
+static void con_set_config(struct con_cx* con_cx, struct config_cx* cfg) //<<<
+{
+	// The connection holds a ref on the config_cx, so the s2n_config can't be
+	// freed out from under it if the config Tcl_Obj loses its intrep
+	config_cx_incref(cfg);
+	if (con_cx->config_cx) config_cx_decref(con_cx->config_cx);
+	con_cx->config_cx = cfg;
+}
+
+//>>>
+void free_con_cx(struct con_cx* con_cx) //<<<
+{
+	CLOGS(LIFECYCLE, "free_con_cx: %s", clogs_name(con_cx));
+	if (con_cx->registered) forget_chan(con_cx);
+	admission_leave(con_cx);
+	if (con_cx->s2n_con) {
+		// TLS 1.3 tickets arrive after the handshake, save the latest one
+		if (con_cx->client && con_cx->handshake_done && con_cx->config_cx && con_cx->config_cx->session_cache)
+			session_cache_store(con_cx->config_cx->session_cache, con_cx->s2n_con);
+
+		CLOGS(LIFECYCLE, "Freeing s2n connection: %s", S2N_CON_NAME(con_cx->s2n_con));
+		if (-1 == s2n_connection_free(con_cx->s2n_con)) {
+			Tcl_Panic("s2n_connection_free failed: %s\n", s2n_strerror(s2n_errno, "EN"));
+		}
+		con_cx->s2n_con = NULL;
+	}
+	if (con_cx->config_cx) {
+		config_cx_decref(con_cx->config_cx);
+		con_cx->config_cx = NULL;
+	}
+	if (con_cx->shard) {
+		listen_shard_decref(con_cx->shard);
+		con_cx->shard = NULL;
+	}
+	coalesce_cancel(con_cx);
+	pending_cancel(con_cx);
+	Tcl_DeleteEvents(direct_ev_match, con_cx);		// Queued by the handler or direct_chan_refuse
+	offload_snapshot_free(con_cx);
+	if (con_cx->coalesce_buf) {
+		ckfree(con_cx->coalesce_buf);
+		con_cx->coalesce_buf = NULL;
+	}
+	if (con_cx->rx_carry) {
+		ckfree(con_cx->rx_carry);
+		con_cx->rx_carry = NULL;
+	}
+	if (con_cx->tx_carry) {
+		ckfree(con_cx->tx_carry);
+		con_cx->tx_carry = NULL;
+	}
+	ckfree(con_cx); con_cx = NULL;
+}
+
+//>>>
+static void account_sent(struct con_cx* con_cx, const uint8_t* buf, int sent) //<<<
+{
+	if (sent <= 0) return;
+	con_cx->stats.wire_out += sent;
+	con_cx->stats.records_out += scan_records(&con_cx->scan_out, buf, sent);
+}
+
+//>>>
+static void account_received(struct con_cx* con_cx, const uint8_t* buf, int got) //<<<
+{
+	if (got <= 0) return;
+	con_cx->stats.wire_in += got;
+	con_cx->stats.records_in += scan_records(&con_cx->scan_in, buf, got);
+}
+
+//>>>
+static int s2n_basechan_send(void* io_context, const uint8_t* buf, uint32_t len) //<<<
+{
+	struct con_cx*	con_cx = io_context;
+	con_cx->stats.write_syscalls++;
+	const int sent = Tcl_WriteRaw(con_cx->basechan, (char*)buf, len);
+	CLOGS(IO, "len: %d sent %d bytes", len, sent);
+	TRACE(con_cx, TR_SEND, 0, len, sent, sent < 0 ? Tcl_GetErrno() : 0);
+	account_sent(con_cx, buf, sent);
+	return sent;
+}
+
+//>>>
+static int s2n_basechan_recv(void* io_context, uint8_t* buf, uint32_t len) //<<<
+{
+	struct con_cx*	con_cx = io_context;
+	con_cx->stats.read_syscalls++;
+	const int got = Tcl_ReadRaw(con_cx->basechan, (char*)buf, len);
+	CLOGS(IO, "len %d got %d bytes", len, got);
+	TRACE(con_cx, TR_RECV, 0, len, got, got < 0 ? Tcl_GetErrno() : 0);
+	account_received(con_cx, buf, got);
+	return got;
+}
+
+//>>>
+static int s2n_fd_send(void* io_context, const uint8_t* buf, uint32_t len) //<<<
+{
+	struct con_cx*	con_cx = io_context;
+	ssize_t			sent;
+
+	// Does the same as s2n's own fd IO (which s2n_connection_set_fd would
+	// give us), but lets us account for the syscalls and bytes
+	do {
+		con_cx->stats.write_syscalls++;
+		sent = send(con_cx->fd, buf, len, MSG_NOSIGNAL);
+	} while (sent == -1 && errno == EINTR);
+	CLOGS(IO, "len: %d sent %zd bytes", len, sent);
+	TRACE(con_cx, TR_SEND, 0, len, sent, sent < 0 ? errno : 0);
+	account_sent(con_cx, buf, sent);
+	return sent;
+}
+
+//>>>
+static int s2n_fd_recv(void* io_context, uint8_t* buf, uint32_t len) //<<<
+{
+	struct con_cx*	con_cx = io_context;
+	ssize_t			got;
+
+	do {
+		con_cx->stats.read_syscalls++;
+		got = recv(con_cx->fd, buf, len, 0);
+	} while (got == -1 && errno == EINTR);
+	CLOGS(IO, "len %d got %zd bytes", len, got);
+	TRACE(con_cx, TR_RECV, 0, len, got, got < 0 ? errno : 0);
+	account_received(con_cx, buf, got);
+	return got;
+}
+
+//>>>
+static int s2n_uring_send(void* io_context, const uint8_t* buf, uint32_t len) //<<<
+{
+	struct con_cx*	con_cx = io_context;
+
+	while (con_cx->tx_carry) {
+		// Staged by the ring of a thread the channel has left, and already
+		// counted as sent there: it goes out before anything newer
+		ssize_t		sent;
+		do {
+			con_cx->stats.write_syscalls++;
+			sent = send(con_cx->fd, con_cx->tx_carry + con_cx->tx_carry_off, con_cx->tx_carry_len - con_cx->tx_carry_off, MSG_NOSIGNAL);
+		} while (sent == -1 && errno == EINTR);
+		if (sent == -1) return -1;
+		con_cx->tx_carry_off += sent;
+		if (con_cx->tx_carry_off == con_cx->tx_carry_len) {
+			ckfree(con_cx->tx_carry);
+			con_cx->tx_carry = NULL;
+		}
+	}
+
+	if (con_cx->uring == NULL) return s2n_fd_send(io_context, buf, len);	// Moved to a thread without a ring
+
+	// Staged for the ring rather than sent, the syscalls are counted by s2n::uring
+	const int sent = uring_send(con_cx, buf, len);
+	CLOGS(IO, "len: %d staged %d bytes", len, sent);
+	TRACE(con_cx, TR_SEND, 0, len, sent, sent < 0 ? errno : 0);
+	account_sent(con_cx, buf, sent);
+	return sent;
+}
+
+//>>>
+static int s2n_uring_recv(void* io_context, uint8_t* buf, uint32_t len) //<<<
+{
+	struct con_cx*	con_cx = io_context;
+	int				got;
+
+	if (con_cx->rx_carry) {
+		// Received by the ring of a thread the channel has left
+		got = len < con_cx->rx_carry_len - con_cx->rx_carry_off ? len : con_cx->rx_carry_len - con_cx->rx_carry_off;
+		memcpy(buf, con_cx->rx_carry + con_cx->rx_carry_off, got);
+		con_cx->rx_carry_off += got;
+		if (con_cx->rx_carry_off == con_cx->rx_carry_len) {
+			ckfree(con_cx->rx_carry);
+			con_cx->rx_carry = NULL;
+		}
+	} else if (con_cx->uring == NULL) {
+		return s2n_fd_recv(io_context, buf, len);
+	} else {
+		got = uring_recv(con_cx, buf, len);
+	}
+	CLOGS(IO, "len %d got %d bytes", len, got);
+	TRACE(con_cx, TR_RECV, 0, len, got, got < 0 ? errno : 0);
+	account_received(con_cx, buf, got);
+	return got;
+}
+
+//>>>
+static int con_use_uring(Tcl_Interp* interp, struct con_cx* con_cx) //<<<
+{
+	int		code = TCL_OK;
+
+	if (!uring_attach(con_cx)) goto finally;		// No io_uring here, stay on the fd path
+
+	CHECK_S2N(finally, code, s2n_connection_set_send_cb(con_cx->s2n_con, s2n_uring_send));
+	CHECK_S2N(finally, code, s2n_connection_set_recv_cb(con_cx->s2n_con, s2n_uring_recv));
+	con_cx->use_uring = 1;
+
+finally:
+	return code;
+}
+
+//>>>
+
+int direct_chan_accept(Tcl_Interp* interp, int fd, struct config_cx* cfg, struct listen_shard* shard, int uring, Tcl_Channel* chan) //<<<
+{
+	// Takes ownership of fd, a non-blocking connection accepted by a listener.
+	// Leaves *chan NULL if admission control turned the connection away.
+	int				code = TCL_OK;
+	struct con_cx*	con_cx = NULL;
+	const int		admission = admission_decide();
+
+	if (admission == -1) {
+		close(fd);
+		*chan = NULL;
+		goto finally;
+	}
+
+	con_cx = (struct con_cx*)ckalloc(sizeof *con_cx);
+	*con_cx = (struct con_cx){
+		.id				= atomic_fetch_add(&g_con_id, 1) + 1,
+		.type			= CHANTYPE_DIRECT,
+		.client			= 0,
+		.fd				= fd,
+		.blocked		= S2N_NOT_BLOCKED,
+		.blocking		= 0,
+		.connected		= 1,
+		.watch_mask		= -1,
+		.linger_ms		= LINGER_DEFAULT_MS,
+		.created_usec	= mono_usec(),
+		.stats.handshake_usec	= -1,
+		.shard			= shard,
+	};
+	listen_shard_incref(shard);
+	CLOGS(LIFECYCLE, "Created con_cx: %s", clogs_name(con_cx));
+
+	con_cx->s2n_con = s2n_connection_new(S2N_SERVER);
+	CHECK_S2N(finally, code, s2n_connection_set_config(con_cx->s2n_con, cfg->config));
+	con_set_config(con_cx, cfg);
+	CHECK_S2N(finally, code, s2n_connection_set_send_ctx(con_cx->s2n_con, con_cx));
+	CHECK_S2N(finally, code, s2n_connection_set_recv_ctx(con_cx->s2n_con, con_cx));
+	CHECK_S2N(finally, code, s2n_connection_set_send_cb(con_cx->s2n_con, s2n_fd_send));
+	CHECK_S2N(finally, code, s2n_connection_set_recv_cb(con_cx->s2n_con, s2n_fd_recv));
+	if (uring) TEST_OK_LABEL(finally, code, con_use_uring(interp, con_cx));
+
+	con_cx->chan = Tcl_CreateChannel(&s2n_direct_channel_type, clogs_name(con_cx), con_cx, TCL_READABLE | TCL_WRITABLE);
+	Tcl_RegisterChannel(interp, con_cx->chan);
+	register_chan(con_cx);
+	*chan = con_cx->chan;
+	Tcl_SetChannelOption(NULL, con_cx->chan, "-blocking", "0");		// Match the socket, so the handshake runs from the event loop
+
+	admission_enter(con_cx, admission);
+	if (admission == ADM_QUEUED) {
+		con_cx = NULL;		// Its handshake starts when admission control has room for it
+		goto finally;
+	}
+
+	// Start on the handshake, which will usually wait for the ClientHello
+	const int neg_rc = con_negotiate(con_cx);
+	if (neg_rc == S2N_SUCCESS) {
+		handshake_complete(con_cx);
+	} else if (s2n_error_get_type(s2n_errno) == S2N_ERR_T_BLOCKED) {
+		note_blocked(con_cx, con_cx->blocked);
+		s2n_direct_chan_set_watch(con_cx, con_cx->blocked == S2N_BLOCKED_ON_WRITE ? TCL_WRITABLE : TCL_READABLE);
+	} else {
+		Tcl_SetErrorCode(interp, "S2N", s2n_strerror_name(s2n_errno), NULL);
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("s2n_negotiate failed: %s", s2n_strerror(s2n_errno, "EN")));
+		Tcl_UnregisterChannel(interp, con_cx->chan);	// Closes fd and frees con_cx
+		*chan = NULL;
+		con_cx = NULL;
+		code = TCL_ERROR;
+		goto finally;
+	}
+
+	con_cx = NULL;		// Owned by the channel now
 
 finally:
-	Tcl_DictObjDone(&search);
-	if (c) {
-		if (-1 == s2n_config_free(c)) {
-			if (code == TCL_OK) {
-				code = TCL_ERROR;
-				Tcl_SetErrorCode(interp, "S2N", s2n_strerror_name(s2n_errno), NULL);
-				Tcl_SetObjResult(interp, Tcl_ObjPrintf("s2n_config_free failed: %s", s2n_strerror(s2n_errno, "EN")));
-				s2n_errno = S2N_ERR_T_OK;
-			}
+	if (con_cx) {
+		if (con_cx->chan == NULL) {
+			close(fd);
+			free_con_cx(con_cx);
 		}
-		c = NULL;
+		con_cx = NULL;
 	}
 	return code;
 }
 
 //>>>
-void free_con_cx(struct con_cx* con_cx) //<<<
+int direct_chan_adopt(Tcl_Interp* interp, int fd, int client, struct config_cx* cfg, const uint8_t* state, uint32_t len, Tcl_Channel* chan) //<<<
 {
-	CLOGS(LIFECYCLE, "free_con_cx: %s", clogs_name(con_cx));
-	if (con_cx->registered) forget_chan(con_cx);
-	if (con_cx->s2n_con) {
-		CLOGS(LIFECYCLE, "Freeing s2n connection: %s", S2N_CON_NAME(con_cx->s2n_con));
-		if (-1 == s2n_connection_free(con_cx->s2n_con)) {
-			Tcl_Panic("s2n_connection_free failed: %s\n", s2n_strerror(s2n_errno, "EN"));
-		}
-		con_cx->s2n_con = NULL;
+	// Takes ownership of fd, a connection whose TLS state another process
+	// serialised with direct_chan_serialize.  The handshake is already done.
+	int				code = TCL_OK;
+	struct con_cx*	con_cx = NULL;
+
+	if (-1 == fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK))
+		THROW_POSIX_LABEL(finally, code, "couldn't set the handed off socket non-blocking");
+
+	con_cx = (struct con_cx*)ckalloc(sizeof *con_cx);
+	*con_cx = (struct con_cx){
+		.id				= atomic_fetch_add(&g_con_id, 1) + 1,
+		.type			= CHANTYPE_DIRECT,
+		.client			= client,
+		.fd				= fd,
+		.blocked		= S2N_NOT_BLOCKED,
+		.blocking		= 0,
+		.connected		= 1,
+		.watch_mask		= -1,
+		.linger_ms		= LINGER_DEFAULT_MS,
+		.created_usec	= mono_usec(),
+		.stats.handshake_usec	= 0,		// Another process paid for it
+		.handshake_done	= 1,
+	};
+	CLOGS(LIFECYCLE, "Adopted con_cx: %s", clogs_name(con_cx));
+
+	con_cx->s2n_con = s2n_connection_new(client ? S2N_CLIENT : S2N_SERVER);
+	if (cfg) {
+		CHECK_S2N(finally, code, s2n_connection_set_config(con_cx->s2n_con, cfg->config));
+		con_set_config(con_cx, cfg);
 	}
-	ckfree(con_cx); con_cx = NULL;
-}
+	CHECK_S2N(finally, code, s2n_connection_deserialize(con_cx->s2n_con, (uint8_t*)state, len));
+	CHECK_S2N(finally, code, s2n_connection_set_send_ctx(con_cx->s2n_con, con_cx));
+	CHECK_S2N(finally, code, s2n_connection_set_recv_ctx(con_cx->s2n_con, con_cx));
+	CHECK_S2N(finally, code, s2n_connection_set_send_cb(con_cx->s2n_con, s2n_fd_send));
+	CHECK_S2N(finally, code, s2n_connection_set_recv_cb(con_cx->s2n_con, s2n_fd_recv));
 
-//>>>
-static int s2n_basechan_send(void* io_context, const uint8_t* buf, uint32_t len) //<<<
-{
-	struct con_cx*	con_cx = io_context;
-	const int sent = Tcl_WriteRaw(con_cx->basechan, (char*)buf, len);
-	CLOGS(IO, "len: %d sent %d bytes", len, sent);
-	return sent;
+	con_cx->chan = Tcl_CreateChannel(&s2n_direct_channel_type, clogs_name(con_cx), con_cx, TCL_READABLE | TCL_WRITABLE);
+	Tcl_RegisterChannel(interp, con_cx->chan);
+	register_chan(con_cx);
+	*chan = con_cx->chan;
+	Tcl_SetChannelOption(NULL, con_cx->chan, "-blocking", "0");
+
+	con_cx = NULL;		// Owned by the channel now
+	fd = -1;
+
+finally:
+	if (fd != -1) close(fd);
+	if (con_cx) {
+		free_con_cx(con_cx);
+		con_cx = NULL;
+	}
+	return code;
 }
 
 //>>>
-static int s2n_basechan_recv(void* io_context, uint8_t* buf, uint32_t len) //<<<
+static struct con_cx* get_con_cx(Tcl_Interp* interp, Tcl_Obj* channame);
+
+int direct_chan_serialize(Tcl_Interp* interp, Tcl_Obj* channame, uint32_t max_len, struct con_cx** res, Tcl_Obj** state) //<<<
 {
-	struct con_cx*	con_cx = io_context;
-	const int got = Tcl_ReadRaw(con_cx->basechan, (char*)buf, len);
-	CLOGS(IO, "len %d got %d bytes", len, got);
-	return got;
+	// On success the s2n connection is spent: the caller must pass on the fd
+	// and state, then close the channel, which won't send a close_notify.
+	// Errors (including a state longer than max_len) leave it usable.
+	int				code = TCL_OK;
+	struct con_cx*	con_cx = get_con_cx(interp, channame);
+	uint32_t		len = 0;
+	int				err = 0;
+
+	if (con_cx == NULL) {
+		code = TCL_ERROR;
+		goto finally;
+	}
+	if (con_cx->type != CHANTYPE_DIRECT)		THROW_ERROR_LABEL(finally, code, "Only channels created by s2n::socket or a listener can be handed off");
+	if (!con_cx->handshake_done)				THROW_ERROR_LABEL(finally, code, "Can't hand off before the handshake completes");
+	if (con_cx->offload || con_cx->uring)		THROW_ERROR_LABEL(finally, code, "Can't hand off a channel using -offload or -uring");
+	if (con_cx->read_closed || con_cx->write_closed)	THROW_ERROR_LABEL(finally, code, "Can't hand off a closing channel");
+	if (Tcl_InputBuffered(con_cx->chan) > 0)	THROW_ERROR_LABEL(finally, code, "Can't hand off a channel with unread data");
+
+	// Whatever the script wrote has to be on the wire first, the state only covers the keys and sequence numbers
+	if (Tcl_Flush(con_cx->chan) != TCL_OK) THROW_POSIX_LABEL(finally, code, "flush");
+	if (con_cx->coalesce_len && coalesce_flush(con_cx, &err) == -1 && err != EAGAIN) {
+		Tcl_SetErrno(err);
+		THROW_POSIX_LABEL(finally, code, "flush");
+	}
+	if (Tcl_OutputBuffered(con_cx->chan) > 0 || con_cx->coalesce_len)
+		THROW_ERROR_LABEL(finally, code, "Can't hand off a channel with unsent data, try again when it's writable");
+
+	CHECK_S2N(finally, code, s2n_connection_serialization_length(con_cx->s2n_con, &len));
+	if (len > max_len) THROW_ERROR_LABEL(finally, code, "Handoff data too long");
+	replace_tclobj(state, Tcl_NewByteArrayObj(NULL, 0));
+	uint8_t*	buf = Tcl_SetByteArrayLength(*state, len);
+	CHECK_S2N(finally, code, s2n_connection_serialize(con_cx->s2n_con, buf, len));
+
+	con_cx->write_closed = 1;		// Close without a close_notify: the connection carries on elsewhere
+	s2n_direct_chan_set_watch(con_cx, 0);
+	*res = con_cx;
+
+finally:
+	return code;
 }
 
 //>>>
@@ -960,6 +2446,10 @@ OBJCMD(push_cmd) //<<<
 		"-role",
 		"-servername",
 		"-prefer",
+		"-session",
+		"-alpn",
+		"-coalesce_bytes",
+		"-coalesce_delay",
 		NULL
 	};
 	enum opt {
@@ -967,12 +2457,17 @@ OBJCMD(push_cmd) //<<<
 		OPT_ROLE,
 		OPT_SERVERNAME,
 		OPT_PREFER,
+		OPT_SESSION,
+		OPT_ALPN,
+		OPT_COALESCE_BYTES,
+		OPT_COALESCE_DELAY,
 	};
 	static const char* s2n_role_str[] = { "client", "server", NULL };
 	enum role { ROLE_CLIENT, ROLE_SERVER } role = ROLE_CLIENT;
 	int				roleint;
 	struct con_cx	*con_cx = NULL;
 	int				stacked = 0;
+	int				session_given = 0;
 
 	enum {A_cmd, A_CHAN, A_args};
 	CHECK_MIN_ARGS_LABEL(finally, code, "channelName ?-opt val ...?");
@@ -986,11 +2481,21 @@ OBJCMD(push_cmd) //<<<
 
 	con_cx = (struct con_cx*)ckalloc(sizeof *con_cx);
 	*con_cx = (struct con_cx){
-		.type		= CHANTYPE_STACKED,
-		.basechan	= basechan,
-		.blocked	= S2N_NOT_BLOCKED,
+		.id				= atomic_fetch_add(&g_con_id, 1) + 1,
+		.type			= CHANTYPE_STACKED,
+		.basechan		= basechan,
+		.blocked		= S2N_NOT_BLOCKED,
+		.created_usec	= mono_usec(),
+		.stats.handshake_usec	= -1,
 	};
 	CLOGS(LIFECYCLE, "Created con_cx: %s", clogs_name(con_cx));
+	{
+		Tcl_DString	blocking;
+		Tcl_DStringInit(&blocking);
+		if (Tcl_GetChannelOption(NULL, basechan, "-blocking", &blocking) == TCL_OK)
+			con_cx->blocking = strcmp(Tcl_DStringValue(&blocking), "1") == 0;
+		Tcl_DStringFree(&blocking);
+	}
 
 	// Need to scan the options first to get the role
 	for (i=A_args; i<objc; i++) {
@@ -1006,6 +2511,10 @@ OBJCMD(push_cmd) //<<<
 			case OPT_CONFIG:
 			case OPT_SERVERNAME:
 			case OPT_PREFER:
+			case OPT_SESSION:
+			case OPT_ALPN:
+			case OPT_COALESCE_BYTES:
+			case OPT_COALESCE_DELAY:
 				i++; break;
 
 			default:
@@ -1014,6 +2523,7 @@ OBJCMD(push_cmd) //<<<
 	}
 
 	con_cx->s2n_con = s2n_connection_new(role == ROLE_CLIENT ? S2N_CLIENT : S2N_SERVER);
+	con_cx->client = role == ROLE_CLIENT;
 	CLOGS(LIFECYCLE, "Created s2n connection: %s", S2N_CON_NAME(con_cx->s2n_con));
 
 	for (i=A_args; i<objc; i++) {
@@ -1024,11 +2534,11 @@ OBJCMD(push_cmd) //<<<
 			case OPT_ROLE:	i++; break;		// Handled above
 			case OPT_CONFIG: //<<<
 			{
-				struct s2n_config*	config = NULL;
+				struct config_cx*	cfg = NULL;
 				if (i == objc-1) THROW_ERROR_LABEL(finally, code, "Missing value for -config", NULL);
-				TEST_OK_LABEL(finally, code, get_s2n_config_from_obj(interp, objv[++i], &config));
-				// TODO: need to take a ref on the config obj, in the stack chan's instance data?
-				TEST_OK_LABEL(finally, code, s2n_connection_set_config(con_cx->s2n_con, config));
+				TEST_OK_LABEL(finally, code, get_config_cx_from_obj(interp, objv[++i], &cfg));
+				CHECK_S2N(finally, code, s2n_connection_set_config(con_cx->s2n_con, cfg->config));
+				con_set_config(con_cx, cfg);
 				break;
 			}
 			//>>>
@@ -1054,10 +2564,31 @@ OBJCMD(push_cmd) //<<<
 				break;
 			}
 			//>>>
+			case OPT_SESSION: //<<<
+				if (i == objc-1) THROW_ERROR_LABEL(finally, code, "Missing value for -session", NULL);
+				TEST_OK_LABEL(finally, code, con_set_session(interp, con_cx, objv[++i]));
+				session_given = 1;
+				break;
+			//>>>
+			case OPT_ALPN: //<<<
+				if (i == objc-1) THROW_ERROR_LABEL(finally, code, "Missing value for -alpn", NULL);
+				TEST_OK_LABEL(finally, code, set_alpn(interp, objv[++i], NULL, con_cx->s2n_con));
+				break;
+			//>>>
+			case OPT_COALESCE_BYTES:
+			case OPT_COALESCE_DELAY: //<<<
+				if (i == objc-1) THROW_ERROR_LABEL(finally, code, "Missing value for ", Tcl_GetString(objv[i]));
+				TEST_OK_LABEL(finally, code, con_set_coalesce(interp, con_cx, Tcl_GetString(objv[i]), Tcl_GetString(objv[i+1])));
+				i++;
+				break;
+			//>>>
 			default: THROW_ERROR_LABEL(finally, code, "Unhandled option", objv[i]);
 		}
 	}
 
+	if (con_cx->client && !session_given && con_cx->config_cx && con_cx->config_cx->session_cache)
+		session_cache_offer(con_cx->config_cx->session_cache, con_cx->s2n_con);
+
 	// Wire up IO callbacks to read and write to the base chan
 	CHECK_S2N(finally, code, s2n_connection_set_send_ctx(con_cx->s2n_con, con_cx));
 	CHECK_S2N(finally, code, s2n_connection_set_recv_ctx(con_cx->s2n_con, con_cx));
@@ -1065,17 +2596,18 @@ OBJCMD(push_cmd) //<<<
 	CHECK_S2N(finally, code, s2n_connection_set_recv_cb(con_cx->s2n_con, s2n_basechan_recv));
 
 	CLOGS(HANDSHAKE, "s2n_negotiate");
-    const int neg_rc = s2n_negotiate(con_cx->s2n_con, &con_cx->blocked);
+	const int neg_rc = con_negotiate(con_cx);
 
 	if (neg_rc == S2N_SUCCESS) {
 		CLOGS(HANDSHAKE, "s2n_negotiate success");
-		con_cx->handshake_done = 1;
+		handshake_complete(con_cx);
 	} else {
 		CLOGS(HANDSHAKE, "s2n_strerror_name: %s: %s", s2n_strerror_name(s2n_errno), s2n_strerror(s2n_errno, "EN"));
 		switch (s2n_error_get_type(s2n_errno)) {
 			case S2N_ERR_T_BLOCKED:
 			{
 				int		mask = 0;
+				note_blocked(con_cx, con_cx->blocked);
 				switch (con_cx->blocked) {
 					case S2N_BLOCKED_ON_READ:	mask |= TCL_READABLE; break;
 					case S2N_BLOCKED_ON_WRITE:	mask |= TCL_WRITABLE; break;
@@ -1121,6 +2653,11 @@ OBJCMD(socket_cmd) //<<<
 		"-config",
 		"-servername",
 		"-prefer",
+		"-session",
+		"-alpn",
+		"-coalesce_bytes",
+		"-coalesce_delay",
+		"-uring",
 		NULL
 	};
 	enum opt {
@@ -1128,10 +2665,16 @@ OBJCMD(socket_cmd) //<<<
 		OPT_CONFIG,
 		OPT_SERVERNAME,
 		OPT_PREFER,
+		OPT_SESSION,
+		OPT_ALPN,
+		OPT_COALESCE_BYTES,
+		OPT_COALESCE_DELAY,
+		OPT_URING,
 	};
 	struct con_cx		*con_cx = NULL;
 	int					registered = 0;
 	int					async = 0;
+	int					uring = 0;
 	struct addrinfo*	addrs = NULL;
 	struct addrinfo		static_addr = {0};
 	struct sockaddr_un	uds = {
@@ -1139,6 +2682,7 @@ OBJCMD(socket_cmd) //<<<
 	};
 	int					s = -1;	// socket
 	int					connected = 0;
+	int					session_given = 0;
 
 	enum {A_cmd, A_x, A_y, A_args};
 	CHECK_MIN_ARGS_LABEL(finally, code, "?-opt val ...? host port");
@@ -1147,9 +2691,15 @@ OBJCMD(socket_cmd) //<<<
 
 	con_cx = (struct con_cx*)ckalloc(sizeof *con_cx);
 	*con_cx = (struct con_cx){
-		.type		= CHANTYPE_DIRECT,
-		.blocked	= S2N_NOT_BLOCKED,
-		.blocking	= 1,
+		.id				= atomic_fetch_add(&g_con_id, 1) + 1,
+		.type			= CHANTYPE_DIRECT,
+		.client			= 1,
+		.blocked		= S2N_NOT_BLOCKED,
+		.blocking		= 1,
+		.watch_mask		= -1,
+		.linger_ms		= LINGER_DEFAULT_MS,
+		.created_usec	= mono_usec(),
+		.stats.handshake_usec	= -1,
 	};
 	CLOGS(LIFECYCLE, "Created con_cx: %s", clogs_name(con_cx));
 
@@ -1212,11 +2762,11 @@ OBJCMD(socket_cmd) //<<<
 			//>>>
 			case OPT_CONFIG: //<<<
 			{
-				struct s2n_config*	config = NULL;
+				struct config_cx*	cfg = NULL;
 				if (i == objc-1) THROW_ERROR_LABEL(finally, code, "Missing value for -config", NULL);
-				TEST_OK_LABEL(finally, code, get_s2n_config_from_obj(interp, objv[++i], &config));
-				// TODO: need to take a ref on the config obj, in the stack chan's instance data?
-				TEST_OK_LABEL(finally, code, s2n_connection_set_config(con_cx->s2n_con, config));
+				TEST_OK_LABEL(finally, code, get_config_cx_from_obj(interp, objv[++i], &cfg));
+				CHECK_S2N(finally, code, s2n_connection_set_config(con_cx->s2n_con, cfg->config));
+				con_set_config(con_cx, cfg);
 				break;
 			}
 			//>>>
@@ -1242,10 +2792,36 @@ OBJCMD(socket_cmd) //<<<
 				break;
 			}
 			//>>>
+			case OPT_SESSION: //<<<
+				if (i == objc-1) THROW_ERROR_LABEL(finally, code, "Missing value for -session", NULL);
+				TEST_OK_LABEL(finally, code, con_set_session(interp, con_cx, objv[++i]));
+				session_given = 1;
+				break;
+			//>>>
+			case OPT_ALPN: //<<<
+				if (i == objc-1) THROW_ERROR_LABEL(finally, code, "Missing value for -alpn", NULL);
+				TEST_OK_LABEL(finally, code, set_alpn(interp, objv[++i], NULL, con_cx->s2n_con));
+				break;
+			//>>>
+			case OPT_COALESCE_BYTES:
+			case OPT_COALESCE_DELAY: //<<<
+				if (i == objc-1) THROW_ERROR_LABEL(finally, code, "Missing value for ", Tcl_GetString(objv[i]));
+				TEST_OK_LABEL(finally, code, con_set_coalesce(interp, con_cx, Tcl_GetString(objv[i]), Tcl_GetString(objv[i+1])));
+				i++;
+				break;
+			//>>>
+			case OPT_URING: //<<<
+				if (i == objc-1) THROW_ERROR_LABEL(finally, code, "Missing value for -uring", NULL);
+				TEST_OK_LABEL(finally, code, Tcl_GetBooleanFromObj(interp, objv[++i], &uring));
+				break;
+			//>>>
 			default: THROW_ERROR_LABEL(finally, code, "Unhandled option", objv[i]);
 		}
 	}
 
+	if (!session_given && con_cx->config_cx && con_cx->config_cx->session_cache)
+		session_cache_offer(con_cx->config_cx->session_cache, con_cx->s2n_con);
+
 	for (struct addrinfo* addr=addrs; addr; addr=addr->ai_next) {
 		s = socket(addr->ai_family, addr->ai_socktype | (async ? SOCK_NONBLOCK : 0) | SOCK_CLOEXEC, addr->ai_protocol);
 
@@ -1274,7 +2850,11 @@ OBJCMD(socket_cmd) //<<<
 
 	CLOGS(IO, "setting fd: %d", s);
 	con_cx->fd = s;		s = -1;		// Hand ownership to the channel driver context
-	CHECK_S2N(finally, code, s2n_connection_set_fd(con_cx->s2n_con, con_cx->fd));
+	CHECK_S2N(finally, code, s2n_connection_set_send_ctx(con_cx->s2n_con, con_cx));
+	CHECK_S2N(finally, code, s2n_connection_set_recv_ctx(con_cx->s2n_con, con_cx));
+	CHECK_S2N(finally, code, s2n_connection_set_send_cb(con_cx->s2n_con, s2n_fd_send));
+	CHECK_S2N(finally, code, s2n_connection_set_recv_cb(con_cx->s2n_con, s2n_fd_recv));
+	if (uring) TEST_OK_LABEL(finally, code, con_use_uring(interp, con_cx));
 
 	con_cx->chan = Tcl_CreateChannel(&s2n_direct_channel_type, clogs_name(con_cx), con_cx, TCL_READABLE | TCL_WRITABLE);
 	Tcl_RegisterChannel(interp, con_cx->chan);
@@ -1284,21 +2864,22 @@ OBJCMD(socket_cmd) //<<<
 	if (async) {
 		CLOGS(IO, "async mode, registering watch for %s", mask_str(TCL_WRITABLE));
 		// TODO: this errors in epoll_ctl with EBADF for -async, investigate the mess: https://cr.yp.to/docs/connect.html
-		Tcl_CreateFileHandler(con_cx->fd, TCL_WRITABLE, s2n_direct_chan_handler, con_cx);
+		s2n_direct_chan_set_watch(con_cx, TCL_WRITABLE);
 	} else {
 		con_cx->connected = 1;
 
 		CLOGS(HANDSHAKE, "s2n_negotiate");
-		const int neg_rc = s2n_negotiate(con_cx->s2n_con, &con_cx->blocked);
+		const int neg_rc = con_negotiate(con_cx);
 
 		if (neg_rc == S2N_SUCCESS) {
 			CLOGS(HANDSHAKE, "s2n_negotiate success");
-			con_cx->handshake_done = 1;
+			handshake_complete(con_cx);
 		} else {
 			switch (s2n_error_get_type(s2n_errno)) {
 				case S2N_ERR_T_BLOCKED:
 				{
 					int		mask = 0;
+					note_blocked(con_cx, con_cx->blocked);
 					switch (con_cx->blocked) {
 						case S2N_BLOCKED_ON_READ:	mask |= TCL_READABLE; break;
 						case S2N_BLOCKED_ON_WRITE:	mask |= TCL_WRITABLE; break;
@@ -1306,7 +2887,7 @@ OBJCMD(socket_cmd) //<<<
 					}
 					if (mask) {
 						CLOGS(HANDSHAKE, "s2n_negotiate blocked on %s, registering watch for %s", con_cx->blocked == S2N_BLOCKED_ON_READ ? "read" : "write", mask_str(mask));
-						Tcl_CreateFileHandler(con_cx->fd, mask, s2n_direct_chan_handler, con_cx);
+						s2n_direct_chan_set_watch(con_cx, mask);
 					}
 					break;
 				}
@@ -1360,6 +2941,387 @@ finally:
 	return code;
 }
 
+//>>>
+OBJCMD(stats_cmd) //<<<
+{
+	int					code = TCL_OK;
+	struct con_stats	total = {0};
+	Tcl_WideInt			channels = 0;
+	Tcl_WideInt			handshakes = 0;
+	Tcl_WideInt			closing = 0;
+	Tcl_HashEntry*		he;
+	Tcl_HashSearch		search;
+
+	enum {A_cmd, A_objc};
+	CHECK_ARGS_LABEL(finally, code, "");
+
+	// g_init_mutex keeps the con_cxs alive, but their counters are plain
+	// fields updated without it by the threads that own them (and by the
+	// offload I/O thread), so the totals are approximate: a snapshot that
+	// may miss increments in flight on other threads
+	Tcl_MutexLock(&g_init_mutex);
+	for (he = Tcl_FirstHashEntry(&g_managed_chans, &search); he; he = Tcl_NextHashEntry(&search)) {
+		const struct con_cx*	con_cx = (struct con_cx*)Tcl_GetHashValue(he);
+		const struct con_stats*	s = &con_cx->stats;
+
+		if (con_cx->closed) {
+			// Registered until freed, but no longer a channel
+			closing++;
+			continue;
+		}
+		channels++;
+		total.write_count		+= s->write_count;
+		total.read_count		+= s->read_count;
+		total.wire_out			+= s->wire_out;
+		total.wire_in			+= s->wire_in;
+		total.records_out		+= s->records_out;
+		total.records_in		+= s->records_in;
+		total.write_syscalls	+= s->write_syscalls;
+		total.read_syscalls		+= s->read_syscalls;
+		total.blocked_on_write	+= s->blocked_on_write;
+		total.blocked_on_read	+= s->blocked_on_read;
+		total.eagain			+= s->eagain;
+		total.negotiate_calls	+= s->negotiate_calls;
+		total.coalesced			+= s->coalesced;
+		total.coalesce_flushes	+= s->coalesce_flushes;
+		if (s->handshake_usec >= 0) {
+			handshakes++;
+			total.handshake_usec += s->handshake_usec;
+		}
+	}
+	Tcl_MutexUnlock(&g_init_mutex);
+
+	Tcl_Obj*	d = stats_obj(&total);
+	Tcl_DictObjPut(NULL, d, Tcl_NewStringObj("channels", -1),   Tcl_NewWideIntObj(channels));
+	Tcl_DictObjPut(NULL, d, Tcl_NewStringObj("handshakes", -1), Tcl_NewWideIntObj(handshakes));
+	Tcl_DictObjPut(NULL, d, Tcl_NewStringObj("closing", -1),    Tcl_NewWideIntObj(closing));
+	Tcl_SetObjResult(interp, d);
+
+finally:
+	return code;
+}
+
+//>>>
+static struct con_cx* get_con_cx(Tcl_Interp* interp, Tcl_Obj* channame) //<<<
+{
+	Tcl_Channel		chan = Tcl_GetChannel(interp, Tcl_GetString(channame), NULL);
+
+	if (chan == NULL) return NULL;
+
+	const Tcl_ChannelType*	type = Tcl_GetChannelType(chan);
+	if (type != &s2n_stacked_channel_type && type != &s2n_direct_channel_type) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("\"%s\" is not an s2n channel", Tcl_GetString(channame)));
+		Tcl_SetErrorCode(interp, "S2N", "NOT_S2N_CHAN", Tcl_GetString(channame), NULL);
+		return NULL;
+	}
+
+	return (struct con_cx*)Tcl_GetChannelInstanceData(chan);
+}
+
+//>>>
+OBJCMD(trace_cmd) //<<<
+{
+	int				code = TCL_OK;
+	static const char* ops[] = {
+		"on",
+		"off",
+		"dump",
+		NULL
+	};
+	enum op {
+		OP_ON,
+		OP_OFF,
+		OP_DUMP,
+	};
+	int				opint;
+
+	enum {A_cmd, A_OP, A_args};
+	CHECK_MIN_ARGS_LABEL(finally, code, "on|off|dump ?-chan channelName?");
+
+	TEST_OK_LABEL(finally, code, Tcl_GetIndexFromObj(interp, objv[A_OP], ops, "op", TCL_EXACT, &opint));
+	switch ((enum op)opint) {
+		case OP_ON:
+		case OP_OFF:
+			if (objc != A_args) {
+				Tcl_WrongNumArgs(interp, A_args, objv, "");
+				code = TCL_ERROR;
+				goto finally;
+			}
+			atomic_store_explicit(&g_trace_on, opint == OP_ON, memory_order_relaxed);
+			break;
+
+		case OP_DUMP:
+		{
+			struct con_cx*	con_cx = NULL;
+
+			if (objc == A_args+2 && strcmp(Tcl_GetString(objv[A_args]), "-chan") == 0) {
+				con_cx = get_con_cx(interp, objv[A_args+1]);
+				if (con_cx == NULL) {
+					code = TCL_ERROR;
+					goto finally;
+				}
+			} else if (objc != A_args) {
+				Tcl_WrongNumArgs(interp, A_args, objv, "?-chan channelName?");
+				code = TCL_ERROR;
+				goto finally;
+			}
+			Tcl_SetObjResult(interp, trace_dump(con_cx != NULL, con_cx ? con_cx->id : 0));
+			break;
+		}
+
+		default: THROW_ERROR_LABEL(finally, code, "Unhandled op");
+	}
+
+finally:
+	return code;
+}
+
+//>>>
+OBJCMD(truststore_cmd) //<<<
+{
+	int			code = TCL_OK;
+	Tcl_Obj*	src[3] = {NULL};		// file dir pem
+	Tcl_Obj*	spec = NULL;
+	static const char* opts[] = {
+		"-file",
+		"-dir",
+		"-pem",
+		NULL
+	};
+	static const char* keys[] = {"file", "dir", "pem"};
+
+	enum {A_cmd, A_args};
+	CHECK_MIN_ARGS_LABEL(finally, code, "?-file path? ?-dir path? ?-pem pem?");
+	if ((objc - A_args) % 2) THROW_ERROR_LABEL(finally, code, "Missing value for ", Tcl_GetString(objv[objc-1]));
+
+	for (int i=A_args; i<objc; i+=2) {
+		int		opt;
+		TEST_OK_LABEL(finally, code, Tcl_GetIndexFromObj(interp, objv[i], opts, "option", TCL_EXACT, &opt));
+		src[opt] = objv[i+1];
+	}
+
+	// Return the canonical spec, suitable for the truststore config key
+	replace_tclobj(&spec, Tcl_NewDictObj());
+	for (int i=0; i<3; i++)
+		if (src[i]) TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, spec, Tcl_NewStringObj(keys[i], -1), src[i]));
+
+	TEST_OK_LABEL(finally, code, truststore_attach(interp, NULL, spec));
+	Tcl_SetObjResult(interp, spec);
+
+finally:
+	replace_tclobj(&spec, NULL);
+	return code;
+}
+
+//>>>
+OBJCMD(session_cache_cmd) //<<<
+{
+	int					code = TCL_OK;
+	struct config_cx*	cfg = NULL;
+
+	enum {A_cmd, A_CONFIG, A_objc};
+	CHECK_ARGS_LABEL(finally, code, "config");
+
+	TEST_OK_LABEL(finally, code, get_config_cx_from_obj(interp, objv[A_CONFIG], &cfg));
+	if (cfg->session_cache == NULL) THROW_ERROR_LABEL(finally, code, "config has no session_cache");
+
+	Tcl_SetObjResult(interp, session_cache_stats(cfg->session_cache));
+
+finally:
+	return code;
+}
+
+//>>>
+OBJCMD(sni_cmd) //<<<
+{
+	int					code = TCL_OK;
+	struct config_cx*	cfg = NULL;
+
+	enum {A_cmd, A_CONFIG, A_objc};
+	CHECK_ARGS_LABEL(finally, code, "config");
+
+	TEST_OK_LABEL(finally, code, get_config_cx_from_obj(interp, objv[A_CONFIG], &cfg));
+	if (cfg->sni == NULL) THROW_ERROR_LABEL(finally, code, "config has no sni map");
+
+	Tcl_SetObjResult(interp, sni_map_stats(cfg->sni));
+
+finally:
+	return code;
+}
+
+//>>>
+OBJCMD(memory_cmd) //<<<
+{
+	int		code = TCL_OK;
+
+	enum {A_cmd, A_objc};
+	CHECK_ARGS_LABEL(finally, code, "");
+
+	Tcl_SetObjResult(interp, mem_stats());
+
+finally:
+	return code;
+}
+
+//>>>
+OBJCMD(uring_cmd) //<<<
+{
+	int		code = TCL_OK;
+
+	enum {A_cmd, A_objc};
+	CHECK_ARGS_LABEL(finally, code, "");
+
+	Tcl_SetObjResult(interp, uring_stats());
+
+finally:
+	return code;
+}
+
+//>>>
+OBJCMD(recv_cmd) //<<<
+{
+	int					code = TCL_OK;
+	struct con_cx*		con_cx = NULL;
+	Tcl_Obj*			res = NULL;
+	int					maxbytes;
+	int					got = 0;
+	int					alloc = 0;
+	uint8_t*			buf = NULL;
+	s2n_blocked_status	blocked = S2N_NOT_BLOCKED;
+
+	enum {A_cmd, A_CHAN, A_MAXBYTES, A_objc};
+	CHECK_ARGS_LABEL(finally, code, "channelName maxbytes");
+
+	con_cx = get_con_cx(interp, objv[A_CHAN]);
+	if (con_cx == NULL) {
+		code = TCL_ERROR;
+		goto finally;
+	}
+	TEST_OK_LABEL(finally, code, Tcl_GetIntFromObj(interp, objv[A_MAXBYTES], &maxbytes));
+	if (maxbytes < 0) THROW_ERROR_LABEL(finally, code, "maxbytes can't be negative");
+
+	replace_tclobj(&res, Tcl_NewByteArrayObj(NULL, 0));
+
+	if (maxbytes == 0) goto done;
+
+	const int	buffered = Tcl_InputBuffered(con_cx->chan);
+	if (buffered > 0) {
+		// Earlier reads through the channel left data in its buffers, which
+		// comes before anything s2n still holds
+		alloc = buffered < maxbytes ? buffered : maxbytes;
+		buf = Tcl_SetByteArrayLength(res, alloc);
+		got = Tcl_Read(con_cx->chan, (char*)buf, alloc);
+		if (got < 0) THROW_POSIX_LABEL(finally, code, "recv");
+		goto done;
+	}
+
+	// s2n_recv returns at most a record at a time, so don't allocate for more
+	alloc = maxbytes < MAX_RECORD_PLAINTEXT ? maxbytes : MAX_RECORD_PLAINTEXT;
+	buf = Tcl_SetByteArrayLength(res, alloc);
+
+	if (con_cx->read_closed) goto eof;
+	if (!con_cx->handshake_done) goto done;		// Nothing to read yet, as for a channel read before the handshake
+
+	if (con_cx->offload) {
+		int		err = 0;
+		got = offload_input(con_cx, (char*)buf, alloc, &err);
+		if (got == 0) goto eof;
+		if (got < 0) {
+			got = 0;
+			if (err != EAGAIN) {
+				Tcl_SetErrno(err);
+				THROW_POSIX_LABEL(finally, code, "recv failed");
+			}
+		}
+		goto done;
+	}
+
+	{
+		int		err = 0;
+		if (coalesce_before_read(con_cx, &err) == -1) {
+			Tcl_SetErrno(err);
+			THROW_POSIX_LABEL(finally, code, "recv failed");
+		}
+	}
+
+	got = s2n_recv(con_cx->s2n_con, buf, alloc, &blocked);
+	TRACE(con_cx, TR_INPUT, 0, alloc, got, got < 0 ? s2n_errno : 0);
+	if (got > 0) {
+		con_cx->stats.read_count += got;
+	} else if (got == 0) {
+		con_cx->read_closed = 1;
+		goto eof;
+	} else {
+		got = 0;
+		switch (s2n_error_get_type(s2n_errno)) {
+			case S2N_ERR_T_BLOCKED:
+				note_blocked(con_cx, blocked);
+				con_cx->stats.eagain++;
+				break;
+			case S2N_ERR_T_CLOSED:
+				con_cx->read_closed = 1;
+				goto eof;
+			default:
+				Tcl_SetErrorCode(interp, "S2N", s2n_strerror_name(s2n_errno), NULL);
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("recv failed: %s", s2n_strerror(s2n_errno, "EN")));
+				code = TCL_ERROR;
+				goto finally;
+		}
+	}
+	goto done;
+
+eof:
+	{
+		// Read through the channel so that it sees the EOF too, and [eof $chan] agrees
+		char	dummy;
+		got = 0;
+		Tcl_Read(con_cx->chan, &dummy, 1);
+	}
+
+done:
+	if (got < alloc / 2) {
+		// Shrinking in place keeps the allocation, copy small results out of it
+		replace_tclobj(&res, Tcl_NewByteArrayObj(buf, got));
+	} else {
+		Tcl_SetByteArrayLength(res, got);
+	}
+	Tcl_SetObjResult(interp, res);
+
+finally:
+	replace_tclobj(&res, NULL);
+	return code;
+}
+
+//>>>
+OBJCMD(flush_cmd) //<<<
+{
+	int				code = TCL_OK;
+	struct con_cx*	con_cx = NULL;
+	int				err = 0;
+
+	enum {A_cmd, A_CHAN, A_objc};
+	CHECK_ARGS_LABEL(finally, code, "channelName");
+
+	con_cx = get_con_cx(interp, objv[A_CHAN]);
+	if (con_cx == NULL) {
+		code = TCL_ERROR;
+		goto finally;
+	}
+
+	// Tcl's buffers first, so that what they hold joins the coalesced data
+	if (Tcl_Flush(con_cx->chan) != TCL_OK) THROW_POSIX_LABEL(finally, code, "flush");
+	if (coalesce_flush(con_cx, &err) == -1) {
+		if (err != EAGAIN) {
+			Tcl_SetErrno(err);
+			THROW_POSIX_LABEL(finally, code, "flush");
+		}
+		coalesce_schedule(con_cx);		// Non-blocking and the transport is full: finish in the background
+	}
+
+finally:
+	return code;
+}
+
 //>>>
 
 static struct cmd {
@@ -1370,6 +3332,22 @@ static struct cmd {
 	{NS "::push",				push_cmd,				NULL},
 	{NS "::socket",				socket_cmd,				NULL},
 	{NS "::openssl_version",	openssl_version_cmd,	NULL},
+	{NS "::cpu_features",		cpu_features_cmd,		NULL},
+	{NS "::cipherbench",		cipherbench_cmd,		NULL},
+	{NS "::stats",				stats_cmd,				NULL},
+	{NS "::trace",				trace_cmd,				NULL},
+	{NS "::memory",				memory_cmd,				NULL},
+	{NS "::truststore",			truststore_cmd,			NULL},
+	{NS "::session_cache",		session_cache_cmd,		NULL},
+	{NS "::sni",				sni_cmd,				NULL},
+	{NS "::recv",				recv_cmd,				NULL},
+	{NS "::uring",				uring_cmd,				NULL},
+	{NS "::warmup",				warmup_cmd,				NULL},
+	{NS "::handoff",			handoff_cmd,			NULL},
+	{NS "::admission",			admission_cmd,			NULL},
+	{NS "::pool",				pool_cmd,				NULL},
+	{NS "::flush",				flush_cmd,				NULL},
+	{NS "::listener",			listener_cmd,			NULL},
 	{0}
 };
 // Script API >>>
@@ -1391,7 +3369,7 @@ DLLEXPORT int S2n_Init(Tcl_Interp* interp) //<<<
 	if (!g_init) {
 		CLOGS(LIFECYCLE, "calling s2n_init");
 		Tcl_InitHashTable(&g_managed_chans, TCL_ONE_WORD_KEYS);
-		if (-1 == s2n_init()) {
+		if (-1 == mem_install() || -1 == s2n_init()) {
 			code = TCL_ERROR;
 			Tcl_SetErrorCode(interp, "S2N", s2n_strerror_name(s2n_errno), NULL);
 			Tcl_SetObjResult(interp, Tcl_ObjPrintf("s2n_init failed: %s", s2n_strerror(s2n_errno, "EN")));
@@ -1403,6 +3381,8 @@ DLLEXPORT int S2n_Init(Tcl_Interp* interp) //<<<
 	Tcl_MutexUnlock(&g_init_mutex);
 	if (code != TCL_OK) goto finally;
 
+	TEST_OK_LABEL(finally, code, warmup_init(interp));
+
 	l = (struct interp_cx*)ckalloc(sizeof *l);
 	*l = (struct interp_cx){0};
 
@@ -1478,6 +3458,7 @@ DLLEXPORT int S2n_Unload(Tcl_Interp* interp, int flags) //<<<
 
 	if (flags == TCL_UNLOAD_DETACH_FROM_PROCESS) {
 		g_unloading = 1;
+		offload_cleanup();
 
 		Tcl_MutexLock(&g_intreps_mutex);
 		if (g_intreps_init) {
@@ -1496,6 +3477,8 @@ DLLEXPORT int S2n_Unload(Tcl_Interp* interp, int flags) //<<<
 		Tcl_MutexFinalize(&g_intreps_mutex);
 		g_intreps_mutex = NULL;
 
+		truststore_cleanup();
+
 		Tcl_MutexLock(&g_init_mutex);
 		if (g_init) {
 			Tcl_HashEntry*	he;
@@ -1503,7 +3486,20 @@ DLLEXPORT int S2n_Unload(Tcl_Interp* interp, int flags) //<<<
 			CLOGS(LIFECYCLE, "closing managed channels");
 			while ((he = Tcl_FirstHashEntry(&g_managed_chans, &search))) {
 				struct con_cx*	con_cx = (struct con_cx*)Tcl_GetHashValue(he);
-				if (con_cx->type == CHANTYPE_STACKED) {
+				if (con_cx->chan == NULL) {
+					// Closed and lingering: abandon the close_notify exchange.
+					// Its handlers belong to the thread it lingers in, so only
+					// that thread can tear it down: other threads' connections
+					// are shut down, which fails their linger_step there
+					CLOGS(LIFECYCLE, "dropping lingering connection: %s", clogs_name(con_cx));
+					Tcl_DeleteHashEntry(he);
+					con_cx->registered = 0;
+					if (con_cx->linger_thread == Tcl_GetCurrentThread()) {
+						linger_finish(con_cx);
+					} else {
+						shutdown(con_cx->fd, SHUT_RDWR);
+					}
+				} else if (con_cx->type == CHANTYPE_STACKED) {
 					CLOGS(LIFECYCLE, "unstacking stacked channel: %s", clogs_name(con_cx));
 					Tcl_UnstackChannel(interp, con_cx->chan);
 				} else {
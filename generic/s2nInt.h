@@ -1,6 +1,6 @@
 #ifndef _S2NINT_H
 #define _S2NINT_H
-#define _POSIX_C_SOURCE 200112L		// maybe _GNU_SOURCE?
+#define _POSIX_C_SOURCE 200809L		// maybe _GNU_SOURCE?
 #include "tclstuff.h"
 #include <s2n.h>
 #include <stdint.h>
@@ -15,6 +15,7 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 #include "tip445.h"
 #include "clogs.h"
 
@@ -68,6 +69,23 @@ enum {
 	L_size
 };
 
+// Must match with trace_type_str[] in trace.c
+enum trace_type {
+	TR_WATCH,			// mask: forwarded, req: requested by Tcl
+	TR_WATCH_UPDATE,	// mask: newly registered with the notifier for a direct channel
+	TR_HANDLER,			// mask: reported to Tcl, req: ready on the transport
+	TR_NOTIFY,			// mask: passed to Tcl_NotifyChannel
+	TR_NEGOTIATE,		// mask: s2n_blocked_status, done: s2n_negotiate result
+	TR_HANDSHAKE_DONE,	// done: handshake usec
+	TR_INPUT,			// req: toRead, done: returned
+	TR_OUTPUT,			// req: toWrite, done: returned
+	TR_SEND,			// req: len, done: sent (ciphertext, err is errno)
+	TR_RECV,			// req: len, done: got (ciphertext, err is errno)
+	TR_CLOSE,			// mask: close2 flags
+	TR_FLUSH,			// req: coalesced bytes held, done: sent
+	TR_size
+};
+
 struct interp_cx {
 	Tcl_Obj*	lit[L_size];
 };
@@ -77,22 +95,135 @@ enum chantype {
 	CHANTYPE_DIRECT,
 };
 
+// Where a connection is with handshake admission control
+enum admission_state {
+	ADM_NONE,			// Not counted: no limit was set when it was accepted, or its handshake is done
+	ADM_ACTIVE,			// Counted against the thread's max_handshakes
+	ADM_QUEUED,			// Waiting for its handshake to be started
+	ADM_MOVED,			// Taken out of a queue by a transfer to another thread, rejoins the new thread's
+};
+
+// Shared by the config Tcl_Obj intrep and the connections using it
+struct ocsp_stapler;
+struct ocsp_lock;
+struct session_cache;
+struct sni_map;
+struct listen_shard;
+struct offload;
+struct uring_con;
+
+struct config_cx {
+	struct s2n_config*				config;
+	atomic_int						refcount;
+	struct s2n_cert_chain_and_key**	certs;			// Owned, must outlive config
+	int								certs_count;
+	struct ocsp_stapler**			staplers;		// Refresh the OCSP responses stapled for certs
+	int								staplers_count;
+	struct ocsp_lock*				ocsp_lock;		// Handshakes hold it while staplers may swap, NULL without staplers
+	struct session_cache*			session_cache;	// Client sessions to resume, by servername
+	struct sni_map*					sni;			// Server configs to switch to, by servername
+	char*							cipher_preferences;	// The policy set on config, NULL for s2n's default
+	char*							spec;			// The config value it was made from, which other threads make their own from
+};
+
+struct con_stats {
+	uint64_t				write_count;	// Number of plaintext bytes written
+	uint64_t				read_count;		// Number of plaintext bytes read
+	uint64_t				wire_out;		// Ciphertext bytes sent
+	uint64_t				wire_in;		// Ciphertext bytes received
+	uint64_t				records_out;	// TLS records sent
+	uint64_t				records_in;		// TLS records received
+	uint64_t				write_syscalls;	// Writes issued on the fd (direct) or basechan (stacked)
+	uint64_t				read_syscalls;	// Reads issued on the fd (direct) or basechan (stacked)
+	uint64_t				blocked_on_write;
+	uint64_t				blocked_on_read;
+	uint64_t				eagain;			// EAGAIN returns to the Tcl channel layer
+	uint64_t				negotiate_calls;
+	uint64_t				coalesced;		// Writes held back to share a record with later writes
+	uint64_t				coalesce_flushes;	// Held writes sent as a batch
+	int64_t					handshake_usec;	// Time taken by the handshake, -1 until it completes
+};
+
+#define HS_TIMELINE_MAX	16
+
+// A handshake message observed after a call to s2n_negotiate, and when
+struct hs_event {
+	const char*				what;			// Static string from s2n_connection_get_last_message_name, or START / DONE
+	int64_t					usec;			// Wall clock, microseconds since the epoch
+};
+
+// Tracks TLS record boundaries in a byte stream, to count records
+struct record_scan {
+	uint32_t				remain;			// Body bytes left in the current record
+	uint8_t					hdr_len;		// Header bytes seen so far for the next record
+	uint8_t					hdr[5];
+};
+
 struct con_cx {
+	uint32_t				id;				// Process unique, identifies the connection in traces
 	struct s2n_connection*	s2n_con;
+	struct config_cx*		config_cx;		// Holds a ref, NULL when using the default config
 	enum chantype			type;
+	int						client;
 	Tcl_Channel				chan;
 	Tcl_Channel				basechan;
 	s2n_blocked_status		blocked;
 
+	int						blocking;		// The channel's blocking mode (the base channel's, for stacked)
+
 	// For direct channels
 	int						fd;
-	int						blocking;
 	int						connected;
+	int						watch_mask;		// Mask currently registered with the notifier for fd, -1 if none
+	int						watch_wanted;	// Mask last passed to the channel's watchProc
+	size_t					watch_updates;	// Number of times the notifier registration for fd was changed
+
+	// Output coalescing, off when coalesce_bytes is 0
+	int						coalesce_bytes;	// Capacity of coalesce_buf
+	int						coalesce_delay;	// Microseconds held data may wait for more
+	int						coalesce_len;	// Bytes held in coalesce_buf
+	uint8_t*				coalesce_buf;
+	Tcl_TimerToken			coalesce_timer;
 
-	size_t					write_count;	// Number of plaintext bytes written
-	size_t					read_count;		// Number of plaintext bytes read
+	// Plaintext s2n has decrypted but the channel hasn't read yet doesn't make
+	// the socket readable, so a timer reports it while readable is watched
+	int						pending_watched;	// Readable is in the channel's watch mask
+	Tcl_TimerToken			pending_timer;
+
+	// Closing direct channels finish the close_notify exchange from the event loop
+	int						linger_ms;		// At most this long, 0 to send close_notify without waiting for the peer's
+	int						lingering;		// The channel is gone, fd's handler is linger_handler
+	Tcl_ThreadId			linger_thread;	// Whose event loop drives it
+	Tcl_TimerToken			linger_timer;
+
+	struct con_stats		stats;
+	int64_t					created_usec;	// Monotonic time the con_cx was created
+	struct record_scan		scan_out;
+	struct record_scan		scan_in;
+	struct hs_event			hs_timeline[HS_TIMELINE_MAX];
+	int						hs_timeline_len;
+
+	struct listen_shard*	shard;			// Holds a ref, the listener that accepted the connection, if any
+	struct offload*			offload;		// Serviced by the background I/O thread, if set
+	char**					offload_opts;	// Common option values read from s2n_con when it was offloaded
+	struct uring_con*		uring;			// Socket I/O goes through the thread's io_uring, if set
+	int						use_uring;		// Attach to the ring of whichever thread has the channel
+	uint8_t*				rx_carry;		// Received through a ring the channel has left, for s2n to read first
+	uint32_t				rx_carry_len;
+	uint32_t				rx_carry_off;
+	uint8_t*				tx_carry;		// Ciphertext a ring the channel has left didn't send, goes out first
+	uint32_t				tx_carry_len;
+	uint32_t				tx_carry_off;
+
+	// Handshake admission control, for connections accepted by listeners
+	enum admission_state	admission;
+	int64_t					admission_usec;	// Monotonic time it joined the queue, or its handshake started
+	struct con_cx*			queue_next;		// In the queue, or the handshakes in progress
+	struct con_cx*			queue_prev;
 
 	int						handshake_done;
+	int						closed;			// The channel is gone, the connection lingers or the I/O thread finishes it
+	const char*				handshake_error;	// Static string, why a handshake driven by the event loop failed
 	int						read_closed;
 	int						write_closed;
 	int						registered;
@@ -109,12 +240,148 @@ extern "C" {
 
 #define NS	"::s2n"
 
+static inline int64_t mono_usec(void) //<<<
+{
+	struct timespec	ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//>>>
+static inline int64_t wall_usec(void) //<<<
+{
+	struct timespec	ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//>>>
+
 // s2n.c internal interface <<<
+MODULE_SCOPE int g_unloading;
 MODULE_SCOPE void register_intrep(Tcl_Obj* obj);
 MODULE_SCOPE void free_interp_cx(ClientData cdata, Tcl_Interp* interp);
 MODULE_SCOPE void free_con_cx(struct con_cx* con_cx);
+MODULE_SCOPE void config_cx_incref(struct config_cx* cfg);
+MODULE_SCOPE void config_cx_decref(struct config_cx* cfg);
+MODULE_SCOPE int get_config_cx_from_obj(Tcl_Interp* interp, Tcl_Obj* obj, struct config_cx** config_cx);
+MODULE_SCOPE int direct_chan_accept(Tcl_Interp* interp, int fd, struct config_cx* cfg, struct listen_shard* shard, int uring, Tcl_Channel* chan);
+MODULE_SCOPE void direct_chan_ready(struct con_cx* con_cx, int mask);
+MODULE_SCOPE void direct_chan_refuse(struct con_cx* con_cx);
+MODULE_SCOPE int direct_chan_adopt(Tcl_Interp* interp, int fd, int client, struct config_cx* cfg, const uint8_t* state, uint32_t len, Tcl_Channel* chan);
+MODULE_SCOPE int direct_chan_serialize(Tcl_Interp* interp, Tcl_Obj* channame, uint32_t max_len, struct con_cx** res, Tcl_Obj** state);
 // s2n.c internal interface >>>
 
+// trace.c internal interface <<<
+MODULE_SCOPE atomic_int g_trace_on;
+MODULE_SCOPE void trace_record(uint32_t con_id, enum trace_type type, int mask, int64_t req, int64_t done, int err);
+MODULE_SCOPE Tcl_Obj* trace_dump(int filter, uint32_t con_id);
+
+#define TRACE(con_cx, type, mask, req, done, err) \
+	do { \
+		if (atomic_load_explicit(&g_trace_on, memory_order_relaxed)) \
+			trace_record((con_cx)->id, (type), (mask), (req), (done), (err)); \
+	} while (0)
+// trace.c internal interface >>>
+
+// mem.c internal interface <<<
+MODULE_SCOPE int mem_install(void);
+MODULE_SCOPE Tcl_Obj* mem_stats(void);
+// mem.c internal interface >>>
+
+// truststore.c internal interface <<<
+MODULE_SCOPE int truststore_attach(Tcl_Interp* interp, struct s2n_config* config, Tcl_Obj* spec);
+MODULE_SCOPE void truststore_cleanup_handler(ClientData cdata);
+MODULE_SCOPE void truststore_cleanup(void);
+// truststore.c internal interface >>>
+
+// ocsp.c internal interface <<<
+MODULE_SCOPE int ocsp_stapler_new(Tcl_Interp* interp, struct config_cx* cfg, struct s2n_cert_chain_and_key* chain, Tcl_Obj* spec, struct ocsp_stapler** res);
+MODULE_SCOPE void ocsp_stapler_free(struct ocsp_stapler* s);
+MODULE_SCOPE void ocsp_lock_free(struct ocsp_lock* lock);
+MODULE_SCOPE void ocsp_handshake_enter(struct s2n_connection* s2n_con);
+MODULE_SCOPE void ocsp_handshake_switch(struct config_cx* cfg);
+MODULE_SCOPE void ocsp_handshake_leave(void);
+// ocsp.c internal interface >>>
+
+// session_cache.c internal interface <<<
+MODULE_SCOPE int session_cache_new(Tcl_Interp* interp, Tcl_Obj* spec, struct session_cache** res);
+MODULE_SCOPE void session_cache_free(struct session_cache* cache);
+MODULE_SCOPE void session_cache_offer(struct session_cache* cache, struct s2n_connection* s2n_con);
+MODULE_SCOPE void session_cache_store(struct session_cache* cache, struct s2n_connection* s2n_con);
+MODULE_SCOPE void session_cache_handshake(struct session_cache* cache, int resumed);
+MODULE_SCOPE Tcl_Obj* session_cache_stats(struct session_cache* cache);
+// session_cache.c internal interface >>>
+
+// sni.c internal interface <<<
+MODULE_SCOPE struct sni_map* sni_map_new(void);
+MODULE_SCOPE void sni_map_free(struct sni_map* map);
+MODULE_SCOPE int sni_map_add(Tcl_Interp* interp, struct sni_map* map, const char* name, struct config_cx* cfg);
+MODULE_SCOPE int sni_client_hello_cb(struct s2n_connection* s2n_con, void* ctx);
+MODULE_SCOPE Tcl_Obj* sni_map_stats(struct sni_map* map);
+// sni.c internal interface >>>
+
+// sockopt.c internal interface <<<
+#define SOCKOPT_NAMES	"nodelay quickack sndbuf rcvbuf keepalive keepidle keepintvl keepcnt user_timeout busy_poll peername sockname tcp_info"
+MODULE_SCOPE int sockopt_get(Tcl_Interp* interp, int fd, const char* optname, Tcl_DString* val, int* code);
+MODULE_SCOPE void sockopt_get_all(int fd, Tcl_DString* val);
+MODULE_SCOPE int sockopt_set(Tcl_Interp* interp, int fd, const char* optname, const char* optval, int* code);
+// sockopt.c internal interface >>>
+
+// listen.c internal interface <<<
+MODULE_SCOPE void listen_shard_incref(struct listen_shard* shard);
+MODULE_SCOPE void listen_shard_decref(struct listen_shard* shard);
+MODULE_SCOPE void listen_shard_handshake(struct listen_shard* shard);
+MODULE_SCOPE OBJCMD(listener_cmd);
+// listen.c internal interface >>>
+
+// offload.c internal interface <<<
+MODULE_SCOPE int offload_attach(Tcl_Interp* interp, struct con_cx* con_cx);
+MODULE_SCOPE int offload_input(struct con_cx* con_cx, char* buf, int toRead, int* errorCodePtr);
+MODULE_SCOPE int offload_output(struct con_cx* con_cx, const char* buf, int toWrite, int* errorCodePtr);
+MODULE_SCOPE void offload_watch(struct con_cx* con_cx, int mask);
+MODULE_SCOPE void offload_thread_insert(struct con_cx* con_cx);
+MODULE_SCOPE void offload_close(struct con_cx* con_cx);
+MODULE_SCOPE void offload_cleanup(void);
+// offload.c internal interface >>>
+
+// uring.c internal interface <<<
+MODULE_SCOPE int uring_attach(struct con_cx* con_cx);
+MODULE_SCOPE void uring_detach(struct con_cx* con_cx);
+MODULE_SCOPE int uring_send(struct con_cx* con_cx, const uint8_t* buf, uint32_t len);
+MODULE_SCOPE int uring_recv(struct con_cx* con_cx, uint8_t* buf, uint32_t len);
+MODULE_SCOPE void uring_watch(struct con_cx* con_cx, int mask);
+MODULE_SCOPE void uring_close(struct con_cx* con_cx);
+MODULE_SCOPE Tcl_Obj* uring_stats(void);
+// uring.c internal interface >>>
+
+// cipherbench.c internal interface <<<
+MODULE_SCOPE OBJCMD(cipherbench_cmd);
+MODULE_SCOPE OBJCMD(cpu_features_cmd);
+// cipherbench.c internal interface >>>
+
+// warmup.c internal interface <<<
+MODULE_SCOPE int warmup_init(Tcl_Interp* interp);
+MODULE_SCOPE OBJCMD(warmup_cmd);
+// warmup.c internal interface >>>
+
+// handoff.c internal interface <<<
+MODULE_SCOPE OBJCMD(handoff_cmd);
+// handoff.c internal interface >>>
+
+// admission.c internal interface <<<
+MODULE_SCOPE int admission_decide(void);
+MODULE_SCOPE void admission_enter(struct con_cx* con_cx, int state);
+MODULE_SCOPE void admission_leave(struct con_cx* con_cx);
+MODULE_SCOPE void admission_thread_remove(struct con_cx* con_cx);
+MODULE_SCOPE void admission_thread_insert(struct con_cx* con_cx);
+MODULE_SCOPE OBJCMD(admission_cmd);
+// admission.c internal interface >>>
+
+// pool.c internal interface <<<
+MODULE_SCOPE OBJCMD(pool_cmd);
+// pool.c internal interface >>>
+
 extern DLLEXPORT int S2n_Init(Tcl_Interp * interp);
 
 #ifdef __cplusplus
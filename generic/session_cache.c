@@ -0,0 +1,193 @@
+#include "s2nInt.h"
+
+// Client session cache.  Remembers the most recent session (ticket) for each
+// servername a client config has connected to, and offers it to the next
+// connection to that servername, so that reconnects resume rather than doing a
+// full handshake, skipping the certificate chain transfer and validation (and
+// the key exchange).  Entries expire after the config's ttl or the ticket's
+// lifetime hint, whichever is sooner.
+
+#define SESSION_CACHE_DEFAULT_MAX	1024
+#define SESSION_CACHE_DEFAULT_TTL	3600
+
+struct session_entry {
+	int64_t		expires;		// mono_usec()
+	int64_t		stored;			// mono_usec(), for evicting the oldest
+	uint32_t	len;
+	uint8_t		data[];
+};
+
+struct session_cache {
+	Tcl_Mutex				mutex;		// Configs are shared by channels, which can move between threads
+	Tcl_HashTable			entries;	// servername -> struct session_entry*
+	int						max;
+	int						ttl;		// Seconds
+	atomic_uint_fast64_t	hits;
+	atomic_uint_fast64_t	misses;
+	atomic_uint_fast64_t	stores;
+	atomic_uint_fast64_t	resumed;
+	atomic_uint_fast64_t	full;
+};
+
+int session_cache_new(Tcl_Interp* interp, Tcl_Obj* spec, struct session_cache** res) //<<<
+{
+	int						code = TCL_OK;
+	struct session_cache*	cache = NULL;
+	Tcl_DictSearch			search = {0};
+	Tcl_Obj*				k;
+	Tcl_Obj*				v;
+	int						done;
+	int						max = SESSION_CACHE_DEFAULT_MAX;
+	int						ttl = SESSION_CACHE_DEFAULT_TTL;
+	static const char* keys[] = {"max", "ttl", NULL};
+	enum {K_MAX, K_TTL};
+
+	TEST_OK_LABEL(finally, code, Tcl_DictObjFirst(interp, spec, &search, &k, &v, &done));
+	for (; !done; Tcl_DictObjNext(&search, &k, &v, &done)) {
+		int		idx;
+		TEST_OK_LABEL(finally, code, Tcl_GetIndexFromObj(interp, k, keys, "session_cache setting", TCL_EXACT, &idx));
+		switch (idx) {
+			case K_MAX: TEST_OK_LABEL(finally, code, Tcl_GetIntFromObj(interp, v, &max)); break;
+			case K_TTL: TEST_OK_LABEL(finally, code, Tcl_GetIntFromObj(interp, v, &ttl)); break;
+		}
+	}
+	if (max < 1) THROW_ERROR_LABEL(finally, code, "session_cache max must be at least 1");
+	if (ttl < 1) THROW_ERROR_LABEL(finally, code, "session_cache ttl must be at least 1 second");
+
+	cache = (struct session_cache*)ckalloc(sizeof *cache);
+	*cache = (struct session_cache){
+		.max	= max,
+		.ttl	= ttl,
+	};
+	Tcl_InitHashTable(&cache->entries, TCL_STRING_KEYS);
+
+	*res = cache;
+	cache = NULL;
+
+finally:
+	Tcl_DictObjDone(&search);
+	return code;
+}
+
+//>>>
+void session_cache_free(struct session_cache* cache) //<<<
+{
+	Tcl_HashEntry*	he;
+	Tcl_HashSearch	search;
+
+	for (he = Tcl_FirstHashEntry(&cache->entries, &search); he; he = Tcl_NextHashEntry(&search))
+		ckfree(Tcl_GetHashValue(he));
+	Tcl_DeleteHashTable(&cache->entries);
+	Tcl_MutexFinalize(&cache->mutex);
+	ckfree(cache);
+}
+
+//>>>
+void session_cache_offer(struct session_cache* cache, struct s2n_connection* s2n_con) //<<<
+{
+	const char*		servername = s2n_get_server_name(s2n_con);
+	Tcl_HashEntry*	he;
+	int				hit = 0;
+
+	if (servername == NULL) return;		// Nothing to key it on
+
+	Tcl_MutexLock(&cache->mutex);
+	he = Tcl_FindHashEntry(&cache->entries, servername);
+	if (he) {
+		struct session_entry*	e = Tcl_GetHashValue(he);
+
+		if (e->expires > mono_usec() && S2N_SUCCESS == s2n_connection_set_session(s2n_con, e->data, e->len)) {
+			hit = 1;
+		} else {
+			ckfree(e);
+			Tcl_DeleteHashEntry(he);
+		}
+	}
+	Tcl_MutexUnlock(&cache->mutex);
+
+	atomic_fetch_add_explicit(hit ? &cache->hits : &cache->misses, 1, memory_order_relaxed);
+}
+
+//>>>
+void session_cache_store(struct session_cache* cache, struct s2n_connection* s2n_con) //<<<
+{
+	const char*				servername = s2n_get_server_name(s2n_con);
+	const int				len = s2n_connection_get_session_length(s2n_con);
+	struct session_entry*	e = NULL;
+	Tcl_HashEntry*			he;
+	int						isnew;
+
+	if (servername == NULL || len <= 0) return;
+
+	e = (struct session_entry*)ckalloc(sizeof *e + len);
+	if (s2n_connection_get_session(s2n_con, e->data, len) != len) {
+		ckfree(e);
+		return;
+	}
+
+	int64_t		ttl = cache->ttl;
+	const int64_t	hint = s2n_connection_get_session_ticket_lifetime_hint(s2n_con);
+	if (hint > 0 && hint < ttl) ttl = hint;
+
+	e->len = len;
+	e->stored = mono_usec();
+	e->expires = e->stored + ttl * 1000000;
+
+	Tcl_MutexLock(&cache->mutex);
+	if (!Tcl_FindHashEntry(&cache->entries, servername) && cache->entries.numEntries >= cache->max) {
+		// Full: evict the oldest entry (expired entries are evicted as they're found)
+		Tcl_HashSearch	search;
+		Tcl_HashEntry*	oldest = NULL;
+		int64_t			oldest_stored = INT64_MAX;
+
+		for (he = Tcl_FirstHashEntry(&cache->entries, &search); he; he = Tcl_NextHashEntry(&search)) {
+			const struct session_entry*	o = Tcl_GetHashValue(he);
+			if (o->stored < oldest_stored) {
+				oldest_stored = o->stored;
+				oldest = he;
+			}
+		}
+		if (oldest) {
+			ckfree(Tcl_GetHashValue(oldest));
+			Tcl_DeleteHashEntry(oldest);
+		}
+	}
+	he = Tcl_CreateHashEntry(&cache->entries, servername, &isnew);
+	if (!isnew) ckfree(Tcl_GetHashValue(he));
+	Tcl_SetHashValue(he, e);
+	Tcl_MutexUnlock(&cache->mutex);
+
+	atomic_fetch_add_explicit(&cache->stores, 1, memory_order_relaxed);
+}
+
+//>>>
+void session_cache_handshake(struct session_cache* cache, int resumed) //<<<
+{
+	atomic_fetch_add_explicit(resumed ? &cache->resumed : &cache->full, 1, memory_order_relaxed);
+}
+
+//>>>
+Tcl_Obj* session_cache_stats(struct session_cache* cache) //<<<
+{
+	Tcl_Obj*	res = Tcl_NewDictObj();
+
+	Tcl_MutexLock(&cache->mutex);
+	const Tcl_Size	entries = cache->entries.numEntries;
+	Tcl_MutexUnlock(&cache->mutex);
+
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("entries", -1), Tcl_NewWideIntObj(entries));
+#define STAT(name) \
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj(#name, -1), Tcl_NewWideIntObj(atomic_load_explicit(&cache->name, memory_order_relaxed)))
+	STAT(hits);
+	STAT(misses);
+	STAT(stores);
+	STAT(resumed);
+	STAT(full);
+#undef STAT
+
+	return res;
+}
+
+//>>>
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
@@ -0,0 +1,185 @@
+#include "s2nInt.h"
+
+// Server name indication map: selects the config (and so the certificate
+// chain, and anything else a config sets) for a server connection from the
+// name the client asked for, in s2n's client hello callback, before any
+// script code sees the connection.  Names are matched case insensitively, first
+// exactly and then against a wildcard for the first label ("*.example.com"
+// matches "www.example.com", but not "example.com" or "a.b.example.com").
+// Connections for names not in the map keep the config they were created with.
+
+#define SNI_MISSES_MAX		1024	// Distinct unmatched names counted individually
+
+struct sni_entry {
+	struct config_cx*		cfg;	// Holds a ref
+	atomic_uint_fast64_t	hits;
+};
+
+struct sni_map {
+	Tcl_HashTable			names;			// Lowercased name -> struct sni_entry*
+	Tcl_Mutex				mutex;			// Protects misses
+	Tcl_HashTable			misses;			// Lowercased name -> count
+	uint64_t				other_misses;	// Misses for names beyond SNI_MISSES_MAX
+	atomic_uint_fast64_t	no_sni;			// Client hellos without a server name
+};
+
+static void lowercase(Tcl_DString* ds, const char* name) //<<<
+{
+	Tcl_DStringInit(ds);
+	Tcl_DStringAppend(ds, name, -1);
+	for (char* p = Tcl_DStringValue(ds); *p; p++)
+		if (*p >= 'A' && *p <= 'Z') *p += 'a' - 'A';
+}
+
+//>>>
+struct sni_map* sni_map_new(void) //<<<
+{
+	struct sni_map*	map = (struct sni_map*)ckalloc(sizeof *map);
+
+	*map = (struct sni_map){0};
+	Tcl_InitHashTable(&map->names, TCL_STRING_KEYS);
+	Tcl_InitHashTable(&map->misses, TCL_STRING_KEYS);
+	return map;
+}
+
+//>>>
+void sni_map_free(struct sni_map* map) //<<<
+{
+	Tcl_HashEntry*	he;
+	Tcl_HashSearch	search;
+
+	for (he = Tcl_FirstHashEntry(&map->names, &search); he; he = Tcl_NextHashEntry(&search)) {
+		struct sni_entry*	e = Tcl_GetHashValue(he);
+		config_cx_decref(e->cfg);
+		ckfree(e);
+	}
+	Tcl_DeleteHashTable(&map->names);
+	Tcl_DeleteHashTable(&map->misses);
+	Tcl_MutexFinalize(&map->mutex);
+	ckfree(map);
+}
+
+//>>>
+int sni_map_add(Tcl_Interp* interp, struct sni_map* map, const char* name, struct config_cx* cfg) //<<<
+{
+	int				code = TCL_OK;
+	Tcl_DString		lower;
+	Tcl_HashEntry*	he;
+	int				isnew;
+
+	lowercase(&lower, name);
+	const char*	n = Tcl_DStringValue(&lower);
+
+	if (n[0] == 0) THROW_ERROR_LABEL(finally, code, "sni names can't be empty");
+	if (strchr(n, '*') && !(n[0] == '*' && n[1] == '.' && strchr(n+1, '*') == NULL))
+		THROW_PRINTF_LABEL(finally, code, "Bad sni wildcard \"%s\", only a leading \"*.\" is supported", name);
+	if (cfg->sni) THROW_ERROR_LABEL(finally, code, "sni configs can't have their own sni maps");
+
+	he = Tcl_CreateHashEntry(&map->names, n, &isnew);
+	if (!isnew) THROW_PRINTF_LABEL(finally, code, "Duplicate sni name \"%s\"", name);
+
+	struct sni_entry*	e = (struct sni_entry*)ckalloc(sizeof *e);
+	*e = (struct sni_entry){.cfg = cfg};
+	config_cx_incref(cfg);
+	Tcl_SetHashValue(he, e);
+
+finally:
+	Tcl_DStringFree(&lower);
+	return code;
+}
+
+//>>>
+static struct sni_entry* lookup(struct sni_map* map, const char* name) //<<<
+{
+	Tcl_HashEntry*	he = Tcl_FindHashEntry(&map->names, name);
+
+	if (he == NULL) {
+		const char*	dot = strchr(name, '.');
+		if (dot && dot != name) {
+			Tcl_DString	wild;
+			Tcl_DStringInit(&wild);
+			Tcl_DStringAppend(&wild, "*", 1);
+			Tcl_DStringAppend(&wild, dot, -1);
+			he = Tcl_FindHashEntry(&map->names, Tcl_DStringValue(&wild));
+			Tcl_DStringFree(&wild);
+		}
+	}
+
+	return he ? (struct sni_entry*)Tcl_GetHashValue(he) : NULL;
+}
+
+//>>>
+int sni_client_hello_cb(struct s2n_connection* s2n_con, void* ctx) //<<<
+{
+	struct sni_map*		map = ctx;
+	const char*			name = s2n_get_server_name(s2n_con);
+	Tcl_DString			lower;
+
+	if (name == NULL || name[0] == 0) {
+		atomic_fetch_add_explicit(&map->no_sni, 1, memory_order_relaxed);
+		return S2N_SUCCESS;
+	}
+
+	lowercase(&lower, name);
+	struct sni_entry*	e = lookup(map, Tcl_DStringValue(&lower));
+
+	if (e) {
+		atomic_fetch_add_explicit(&e->hits, 1, memory_order_relaxed);
+		Tcl_DStringFree(&lower);
+		ocsp_handshake_switch(e->cfg);		// Its staples are the ones s2n reads from here
+		return s2n_connection_set_config(s2n_con, e->cfg->config);
+	}
+
+	Tcl_MutexLock(&map->mutex);
+	Tcl_HashEntry*	he = Tcl_FindHashEntry(&map->misses, Tcl_DStringValue(&lower));
+	if (he == NULL && map->misses.numEntries < SNI_MISSES_MAX) {
+		int		isnew;
+		he = Tcl_CreateHashEntry(&map->misses, Tcl_DStringValue(&lower), &isnew);
+		Tcl_SetHashValue(he, (void*)(uintptr_t)0);
+	}
+	if (he) {
+		Tcl_SetHashValue(he, (void*)((uintptr_t)Tcl_GetHashValue(he) + 1));
+	} else {
+		map->other_misses++;
+	}
+	Tcl_MutexUnlock(&map->mutex);
+	Tcl_DStringFree(&lower);
+
+	return S2N_SUCCESS;
+}
+
+//>>>
+Tcl_Obj* sni_map_stats(struct sni_map* map) //<<<
+{
+	Tcl_Obj*		res = Tcl_NewDictObj();
+	Tcl_Obj*		hits = Tcl_NewDictObj();
+	Tcl_Obj*		misses = Tcl_NewDictObj();
+	Tcl_HashEntry*	he;
+	Tcl_HashSearch	search;
+
+	for (he = Tcl_FirstHashEntry(&map->names, &search); he; he = Tcl_NextHashEntry(&search)) {
+		struct sni_entry*	e = Tcl_GetHashValue(he);
+		Tcl_DictObjPut(NULL, hits,
+				Tcl_NewStringObj(Tcl_GetHashKey(&map->names, he), -1),
+				Tcl_NewWideIntObj(atomic_load_explicit(&e->hits, memory_order_relaxed)));
+	}
+
+	Tcl_MutexLock(&map->mutex);
+	for (he = Tcl_FirstHashEntry(&map->misses, &search); he; he = Tcl_NextHashEntry(&search))
+		Tcl_DictObjPut(NULL, misses,
+				Tcl_NewStringObj(Tcl_GetHashKey(&map->misses, he), -1),
+				Tcl_NewWideIntObj((uintptr_t)Tcl_GetHashValue(he)));
+	const uint64_t	other_misses = map->other_misses;
+	Tcl_MutexUnlock(&map->mutex);
+
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("hits", -1),			hits);
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("misses", -1),		misses);
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("other_misses", -1),	Tcl_NewWideIntObj(other_misses));
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("no_sni", -1),		Tcl_NewWideIntObj(atomic_load_explicit(&map->no_sni, memory_order_relaxed)));
+
+	return res;
+}
+
+//>>>
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
@@ -0,0 +1,228 @@
+#define _DEFAULT_SOURCE		// For struct tcp_info
+#include "s2nInt.h"
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Socket level options for direct channels: TCP tuning knobs that can be set
+// and read back with chan configure, and read-only views of the socket
+// (addresses and the kernel's TCP_INFO), so that TLS performance can be
+// correlated with what the transport is doing.  Options the platform doesn't
+// have are still recognised, but fail with ENOTSUP.
+
+#ifndef TCP_QUICKACK
+#define TCP_QUICKACK		-1
+#endif
+#ifndef TCP_KEEPIDLE
+#define TCP_KEEPIDLE		-1
+#endif
+#ifndef TCP_KEEPINTVL
+#define TCP_KEEPINTVL		-1
+#endif
+#ifndef TCP_KEEPCNT
+#define TCP_KEEPCNT			-1
+#endif
+#ifndef TCP_USER_TIMEOUT
+#define TCP_USER_TIMEOUT	-1
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL		-1
+#endif
+
+enum sockopt_kind {
+	SK_BOOL,
+	SK_INT,
+	SK_PEERNAME,		// The rest are read-only
+	SK_SOCKNAME,
+	SK_TCP_INFO,
+};
+
+static const struct sockopt_def {
+	const char*			name;
+	enum sockopt_kind	kind;
+	int					level;
+	int					opt;
+} sockopts[] = {
+	{"-nodelay",		SK_BOOL,		IPPROTO_TCP,	TCP_NODELAY},
+	{"-quickack",		SK_BOOL,		IPPROTO_TCP,	TCP_QUICKACK},
+	{"-sndbuf",			SK_INT,			SOL_SOCKET,		SO_SNDBUF},
+	{"-rcvbuf",			SK_INT,			SOL_SOCKET,		SO_RCVBUF},
+	{"-keepalive",		SK_BOOL,		SOL_SOCKET,		SO_KEEPALIVE},
+	{"-keepidle",		SK_INT,			IPPROTO_TCP,	TCP_KEEPIDLE},
+	{"-keepintvl",		SK_INT,			IPPROTO_TCP,	TCP_KEEPINTVL},
+	{"-keepcnt",		SK_INT,			IPPROTO_TCP,	TCP_KEEPCNT},
+	{"-user_timeout",	SK_INT,			IPPROTO_TCP,	TCP_USER_TIMEOUT},
+	{"-busy_poll",		SK_INT,			SOL_SOCKET,		SO_BUSY_POLL},
+	{"-peername",		SK_PEERNAME,	0,				0},
+	{"-sockname",		SK_SOCKNAME,	0,				0},
+	{"-tcp_info",		SK_TCP_INFO,	0,				0},
+	{NULL}
+};
+
+static int find(const char* optname) //<<<
+{
+	for (int i=0; sockopts[i].name; i++)
+		if (strcmp(optname, sockopts[i].name) == 0) return i;
+	return -1;
+}
+
+//>>>
+static void append_sockaddr(Tcl_DString* val, const struct sockaddr_storage* sa, socklen_t len) //<<<
+{
+	// Like the -peername and -sockname of Tcl's sockets, except that the host
+	// is the address again rather than a reverse lookup, which could block
+	if (sa->ss_family == AF_UNIX) {
+		const struct sockaddr_un*	un = (const struct sockaddr_un*)sa;
+		Tcl_DStringAppendElement(val, len > offsetof(struct sockaddr_un, sun_path) ? un->sun_path : "");
+		return;
+	}
+
+	char	host[INET6_ADDRSTRLEN];
+	char	serv[8];
+	if (getnameinfo((const struct sockaddr*)sa, len, host, sizeof host, serv, sizeof serv, NI_NUMERICHOST | NI_NUMERICSERV)) return;
+	Tcl_DStringAppendElement(val, host);
+	Tcl_DStringAppendElement(val, host);
+	Tcl_DStringAppendElement(val, serv);
+}
+
+//>>>
+static int get_tcp_info(int fd, Tcl_DString* val) //<<<
+{
+#ifdef TCP_INFO
+	struct tcp_info	ti;
+	socklen_t		len = sizeof ti;
+
+	if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == -1) return -1;
+
+	Tcl_Obj*	d = Tcl_NewDictObj();
+	Tcl_IncrRefCount(d);
+#define FIELD(name, v) Tcl_DictObjPut(NULL, d, Tcl_NewStringObj(name, -1), Tcl_NewWideIntObj((Tcl_WideInt)(v)))
+	FIELD("state",			ti.tcpi_state);
+	FIELD("rtt_usec",		ti.tcpi_rtt);
+	FIELD("rttvar_usec",	ti.tcpi_rttvar);
+	FIELD("rto_usec",		ti.tcpi_rto);
+	FIELD("snd_cwnd",		ti.tcpi_snd_cwnd);
+	FIELD("snd_ssthresh",	ti.tcpi_snd_ssthresh);
+	FIELD("snd_mss",		ti.tcpi_snd_mss);
+	FIELD("rcv_mss",		ti.tcpi_rcv_mss);
+	FIELD("pmtu",			ti.tcpi_pmtu);
+	FIELD("unacked",		ti.tcpi_unacked);
+	FIELD("lost",			ti.tcpi_lost);
+	FIELD("retransmits",	ti.tcpi_retransmits);
+	FIELD("total_retrans",	ti.tcpi_total_retrans);
+#undef FIELD
+	Tcl_DStringAppend(val, Tcl_GetString(d), -1);
+	Tcl_DecrRefCount(d);
+	return 0;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+//>>>
+static int get(int fd, const struct sockopt_def* def, Tcl_DString* val) //<<<
+{
+	struct sockaddr_storage	sa;
+	socklen_t				len = sizeof sa;
+	int						v;
+	socklen_t				vlen = sizeof v;
+	char					buf[TCL_INTEGER_SPACE];
+
+	switch (def->kind) {
+		case SK_PEERNAME:
+			if (getpeername(fd, (struct sockaddr*)&sa, &len) == -1) return -1;
+			append_sockaddr(val, &sa, len);
+			return 0;
+
+		case SK_SOCKNAME:
+			if (getsockname(fd, (struct sockaddr*)&sa, &len) == -1) return -1;
+			append_sockaddr(val, &sa, len);
+			return 0;
+
+		case SK_TCP_INFO:
+			return get_tcp_info(fd, val);
+
+		case SK_BOOL:
+		case SK_INT:
+			if (def->opt == -1) {
+				errno = ENOTSUP;
+				return -1;
+			}
+			if (getsockopt(fd, def->level, def->opt, &v, &vlen) == -1) return -1;
+			snprintf(buf, sizeof buf, "%d", def->kind == SK_BOOL ? !!v : v);
+			Tcl_DStringAppend(val, buf, -1);
+			return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+//>>>
+int sockopt_get(Tcl_Interp* interp, int fd, const char* optname, Tcl_DString* val, int* code) //<<<
+{
+	// Returns 1 if optname is a socket option, with the outcome in *code
+	const int	idx = find(optname);
+
+	if (idx == -1) return 0;
+
+	*code = TCL_OK;
+	if (get(fd, &sockopts[idx], val) == -1) {
+		if (interp) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("can't get %s: %s", optname + 1, Tcl_PosixError(interp)));
+		}
+		*code = TCL_ERROR;
+	}
+	return 1;
+}
+
+//>>>
+void sockopt_get_all(int fd, Tcl_DString* val) //<<<
+{
+	// Only the options that apply to this socket (a unix socket has no TCP options)
+	for (int i=0; sockopts[i].name; i++) {
+		Tcl_DString	ds;
+
+		Tcl_DStringInit(&ds);
+		if (get(fd, &sockopts[i], &ds) == 0) {
+			Tcl_DStringAppendElement(val, sockopts[i].name);
+			Tcl_DStringAppendElement(val, Tcl_DStringValue(&ds));
+		}
+		Tcl_DStringFree(&ds);
+	}
+}
+
+//>>>
+int sockopt_set(Tcl_Interp* interp, int fd, const char* optname, const char* optval, int* code) //<<<
+{
+	// Returns 1 if optname is a settable socket option, with the outcome in *code
+	const int	idx = find(optname);
+
+	if (idx == -1 || sockopts[idx].kind > SK_INT) return 0;
+
+	const struct sockopt_def*	def = &sockopts[idx];
+	int							v;
+
+	*code = TCL_OK;
+	if (def->kind == SK_BOOL) {
+		TEST_OK_LABEL(finally, *code, Tcl_GetBoolean(interp, optval, &v));
+	} else {
+		TEST_OK_LABEL(finally, *code, Tcl_GetInt(interp, optval, &v));
+		if (v < 0) THROW_PRINTF_LABEL(finally, *code, "%s can't be negative", optname);
+	}
+
+	if (def->opt == -1) {
+		errno = ENOTSUP;
+	} else if (setsockopt(fd, def->level, def->opt, &v, sizeof v) == 0) {
+		goto finally;
+	}
+	if (interp) Tcl_SetObjResult(interp, Tcl_ObjPrintf("can't set %s: %s", optname + 1, Tcl_PosixError(interp)));
+	*code = TCL_ERROR;
+
+finally:
+	return 1;
+}
+
+//>>>
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
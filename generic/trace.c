@@ -0,0 +1,111 @@
+#include "s2nInt.h"
+
+// Runtime event trace: a per-thread ring of fixed size binary records,
+// written only by the thread that owns the channels, so no locking is
+// needed.  When tracing is off the TRACE macro costs one relaxed load.
+
+#define TRACE_RING_SIZE	4096	// Must be a power of 2
+
+struct trace_ev {
+	int64_t		usec;		// Monotonic
+	uint32_t	con_id;
+	uint16_t	type;		// enum trace_type
+	int16_t		mask;
+	int64_t		req;
+	int64_t		done;
+	int32_t		err;		// s2n_errno for s2n calls, errno for syscalls
+};
+
+struct trace_ring {
+	uint64_t		head;		// Total events recorded, next slot is head & (TRACE_RING_SIZE-1)
+	struct trace_ev	ev[TRACE_RING_SIZE];
+};
+
+atomic_int		g_trace_on = 0;
+static _Thread_local struct trace_ring*	t_ring = NULL;
+
+// Must be kept in sync with enum trace_type in s2nInt.h
+static const char* trace_type_str[TR_size] = {
+	"watch",			// TR_WATCH
+	"watch_update",		// TR_WATCH_UPDATE
+	"handler",			// TR_HANDLER
+	"notify",			// TR_NOTIFY
+	"negotiate",		// TR_NEGOTIATE
+	"handshake_done",	// TR_HANDSHAKE_DONE
+	"input",			// TR_INPUT
+	"output",			// TR_OUTPUT
+	"send",				// TR_SEND
+	"recv",				// TR_RECV
+	"close",			// TR_CLOSE
+	"flush",			// TR_FLUSH
+};
+
+static void free_trace_ring(ClientData cdata) //<<<
+{
+	struct trace_ring*	ring = cdata;
+
+	if (t_ring == ring) t_ring = NULL;
+	ckfree(ring);
+}
+
+//>>>
+void trace_record(uint32_t con_id, enum trace_type type, int mask, int64_t req, int64_t done, int err) //<<<
+{
+	struct trace_ring*	ring = t_ring;
+
+	if (ring == NULL) {
+		ring = (struct trace_ring*)ckalloc(sizeof *ring);
+		ring->head = 0;
+		t_ring = ring;
+		Tcl_CreateThreadExitHandler(free_trace_ring, ring);
+	}
+
+	ring->ev[ring->head++ & (TRACE_RING_SIZE-1)] = (struct trace_ev){
+		.usec	= mono_usec(),
+		.con_id	= con_id,
+		.type	= type,
+		.mask	= mask,
+		.req	= req,
+		.done	= done,
+		.err	= err,
+	};
+}
+
+//>>>
+Tcl_Obj* trace_dump(int filter, uint32_t con_id) //<<<
+{
+	Tcl_Obj*					res = Tcl_NewListObj(0, NULL);
+	const struct trace_ring*	ring = t_ring;
+
+	if (ring == NULL) return res;
+
+	const uint64_t	first = ring->head > TRACE_RING_SIZE ? ring->head - TRACE_RING_SIZE : 0;
+	for (uint64_t i=first; i<ring->head; i++) {
+		const struct trace_ev*	ev = &ring->ev[i & (TRACE_RING_SIZE-1)];
+		Tcl_Obj*				e = NULL;
+
+		if (filter && ev->con_id != con_id) continue;
+
+		e = Tcl_NewDictObj();
+		Tcl_DictObjPut(NULL, e, Tcl_NewStringObj("usec", -1),	Tcl_NewWideIntObj(ev->usec));
+		Tcl_DictObjPut(NULL, e, Tcl_NewStringObj("con", -1),	Tcl_NewWideIntObj(ev->con_id));
+		Tcl_DictObjPut(NULL, e, Tcl_NewStringObj("event", -1),	Tcl_NewStringObj(ev->type < TR_size ? trace_type_str[ev->type] : "<unknown>", -1));
+		Tcl_DictObjPut(NULL, e, Tcl_NewStringObj("mask", -1),	Tcl_NewIntObj(ev->mask));
+		Tcl_DictObjPut(NULL, e, Tcl_NewStringObj("req", -1),	Tcl_NewWideIntObj(ev->req));
+		Tcl_DictObjPut(NULL, e, Tcl_NewStringObj("done", -1),	Tcl_NewWideIntObj(ev->done));
+		if (ev->err == 0) {
+			Tcl_DictObjPut(NULL, e, Tcl_NewStringObj("err", -1), Tcl_NewStringObj("", 0));
+		} else if (ev->type == TR_SEND || ev->type == TR_RECV) {
+			Tcl_DictObjPut(NULL, e, Tcl_NewStringObj("err", -1), Tcl_NewStringObj(strerror(ev->err), -1));
+		} else {
+			Tcl_DictObjPut(NULL, e, Tcl_NewStringObj("err", -1), Tcl_NewStringObj(s2n_strerror_name(ev->err), -1));
+		}
+		Tcl_ListObjAppendElement(NULL, res, e);
+	}
+
+	return res;
+}
+
+//>>>
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
@@ -0,0 +1,294 @@
+#include "s2nInt.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <limits.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+// Shared trust stores.  s2n builds a separate X509_STORE for every s2n_config,
+// and s2n_config_new eagerly parses the whole system CA bundle into it.
+// Instead, a truststore is materialized once per process into a hashed
+// certificate directory (each CA in its own <subject hash>.<n> file), and
+// configs that use it are created without the system certs and just point a
+// hash_dir lookup at that directory: attaching costs nothing, and verification
+// loads only the CAs actually needed to verify a peer's chain.  A truststore
+// given as an already hashed directory is used in place.
+//
+// Truststores are keyed by their canonical spec and live until the package is
+// unloaded from the process (or the process exits), when the materialized
+// directories are removed.
+
+struct truststore {
+	char*		dir;		// Caller's hashed directory, used as is
+	char*		tmpdir;		// Materialized from file and pem sources
+	int			certs;		// Certificates in tmpdir
+};
+
+TCL_DECLARE_MUTEX(g_truststores_mutex);
+static Tcl_HashTable	g_truststores;
+static int				g_truststores_init = 0;
+
+static void remove_tmpdir(const char* path) //<<<
+{
+	DIR*			d = opendir(path);
+	struct dirent*	e;
+
+	if (d) {
+		while ((e = readdir(d))) {
+			if (e->d_name[0] == '.') continue;
+			char	file[PATH_MAX];
+			snprintf(file, sizeof file, "%s/%s", path, e->d_name);
+			unlink(file);
+		}
+		closedir(d);
+	}
+	rmdir(path);
+}
+
+//>>>
+static void free_truststore(struct truststore* ts) //<<<
+{
+	if (ts->tmpdir) {
+		remove_tmpdir(ts->tmpdir);
+		ckfree(ts->tmpdir);
+		ts->tmpdir = NULL;
+	}
+	if (ts->dir) {
+		ckfree(ts->dir);
+		ts->dir = NULL;
+	}
+	ckfree(ts);
+}
+
+//>>>
+static char* ckstrdup(const char* str) //<<<
+{
+	const size_t	len = strlen(str);
+	char*			dup = ckalloc(len+1);
+
+	memcpy(dup, str, len+1);
+	return dup;
+}
+
+//>>>
+static int add_certs(Tcl_Interp* interp, struct truststore* ts, BIO* in, const char* source) //<<<
+{
+	int		code = TCL_OK;
+	X509*	x = NULL;
+	FILE*	out = NULL;
+	int		found = 0;
+
+	while ((x = PEM_read_bio_X509(in, NULL, NULL, NULL))) {
+		const unsigned long	hash = X509_NAME_hash(X509_get_subject_name(x));
+		char				path[PATH_MAX];
+		int					fd = -1;
+
+		// Several CAs can share a subject hash: take the first free suffix
+		for (int n=0; fd == -1; n++) {
+			snprintf(path, sizeof path, "%s/%08lx.%d", ts->tmpdir, hash, n);
+			fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+			if (fd == -1 && errno != EEXIST) THROW_POSIX_LABEL(finally, code, "Could not create truststore file");
+		}
+		out = fdopen(fd, "w");
+		if (out == NULL) {
+			close(fd);
+			THROW_POSIX_LABEL(finally, code, "Could not open truststore file");
+		}
+		if (!PEM_write_X509(out, x)) THROW_ERROR_LABEL(finally, code, "Could not write truststore file");
+		if (fclose(out)) {
+			out = NULL;
+			THROW_POSIX_LABEL(finally, code, "Could not write truststore file");
+		}
+		out = NULL;
+		X509_free(x);
+		x = NULL;
+		ts->certs++;
+		found++;
+	}
+	ERR_clear_error();		// Running out of PEM blocks leaves an error on the queue
+
+	if (found == 0) THROW_PRINTF_LABEL(finally, code, "No certificates found in %s", source);
+
+finally:
+	if (out) {
+		fclose(out);
+		out = NULL;
+	}
+	if (x) {
+		X509_free(x);
+		x = NULL;
+	}
+	return code;
+}
+
+//>>>
+static int make_truststore(Tcl_Interp* interp, Tcl_Obj* file, Tcl_Obj* dir, Tcl_Obj* pem, struct truststore** res) //<<<
+{
+	int					code = TCL_OK;
+	struct truststore*	ts = (struct truststore*)ckalloc(sizeof *ts);
+	BIO*				in = NULL;
+
+	*ts = (struct truststore){0};
+
+	if (dir) {
+		struct stat	st;
+		if (stat(Tcl_GetString(dir), &st) == -1) THROW_POSIX_LABEL(finally, code, "Could not access truststore dir");
+		if (!S_ISDIR(st.st_mode)) THROW_PRINTF_LABEL(finally, code, "Truststore dir \"%s\" is not a directory", Tcl_GetString(dir));
+		ts->dir = ckstrdup(Tcl_GetString(dir));
+	}
+
+	if (file || pem) {
+		const char*	tmp = getenv("TMPDIR");
+		char		template[PATH_MAX];
+
+		snprintf(template, sizeof template, "%s/s2n-truststore-XXXXXX", tmp && *tmp ? tmp : "/tmp");
+		if (mkdtemp(template) == NULL) THROW_POSIX_LABEL(finally, code, "Could not create truststore dir");
+		ts->tmpdir = ckstrdup(template);
+
+		if (file) {
+			in = BIO_new_file(Tcl_GetString(file), "r");
+			if (in == NULL) {
+				ERR_clear_error();
+				THROW_PRINTF_LABEL(finally, code, "Could not open truststore file \"%s\"", Tcl_GetString(file));
+			}
+			TEST_OK_LABEL(finally, code, add_certs(interp, ts, in, Tcl_GetString(file)));
+			BIO_free(in);
+			in = NULL;
+		}
+
+		if (pem) {
+			Tcl_Size	len;
+			const char*	str = Tcl_GetStringFromObj(pem, &len);
+			in = BIO_new_mem_buf(str, len);
+			if (in == NULL) THROW_ERROR_LABEL(finally, code, "Could not allocate BIO");
+			TEST_OK_LABEL(finally, code, add_certs(interp, ts, in, "pem"));
+			BIO_free(in);
+			in = NULL;
+		}
+	}
+
+	*res = ts;
+	ts = NULL;
+
+finally:
+	if (in) {
+		BIO_free(in);
+		in = NULL;
+	}
+	if (ts) {
+		free_truststore(ts);
+		ts = NULL;
+	}
+	return code;
+}
+
+//>>>
+static int parse_spec(Tcl_Interp* interp, Tcl_Obj* spec, Tcl_Obj* val[3], Tcl_Obj** canonical) //<<<
+{
+	int				code = TCL_OK;
+	Tcl_Obj*		res = NULL;
+	Tcl_DictSearch	search = {0};
+	Tcl_Obj*		k;
+	Tcl_Obj*		v;
+	int				done;
+	static const char* keys[] = {"file", "dir", "pem", NULL};
+
+	TEST_OK_LABEL(finally, code, Tcl_DictObjFirst(interp, spec, &search, &k, &v, &done));
+	for (; !done; Tcl_DictObjNext(&search, &k, &v, &done)) {
+		int		idx;
+		TEST_OK_LABEL(finally, code, Tcl_GetIndexFromObj(interp, k, keys, "truststore source", TCL_EXACT, &idx));
+		val[idx] = v;		// Borrowed from spec
+	}
+	if (!val[0] && !val[1] && !val[2]) THROW_ERROR_LABEL(finally, code, "truststore needs at least one of file, dir or pem");
+
+	// Build the canonical form, sources in a fixed order, so equivalent specs share a truststore
+	replace_tclobj(&res, Tcl_NewListObj(0, NULL));
+	for (int i=0; i<3; i++) {
+		if (val[i] == NULL) continue;
+		TEST_OK_LABEL(finally, code, Tcl_ListObjAppendElement(interp, res, Tcl_NewStringObj(keys[i], -1)));
+		TEST_OK_LABEL(finally, code, Tcl_ListObjAppendElement(interp, res, val[i]));
+	}
+
+	replace_tclobj(canonical, res);
+
+finally:
+	Tcl_DictObjDone(&search);
+	replace_tclobj(&res, NULL);
+	return code;
+}
+
+//>>>
+int truststore_attach(Tcl_Interp* interp, struct s2n_config* config, Tcl_Obj* spec) //<<<
+{
+	int					code = TCL_OK;
+	Tcl_Obj*			canonical = NULL;
+	Tcl_HashEntry*		he = NULL;
+	struct truststore*	ts = NULL;
+	int					isnew;
+	int					locked = 0;
+	Tcl_Obj*			src[3] = {NULL};		// file dir pem
+
+	TEST_OK_LABEL(finally, code, parse_spec(interp, spec, src, &canonical));
+
+	Tcl_MutexLock(&g_truststores_mutex);
+	locked = 1;
+	if (!g_truststores_init) {
+		Tcl_InitHashTable(&g_truststores, TCL_STRING_KEYS);
+		Tcl_CreateExitHandler(truststore_cleanup_handler, NULL);
+		g_truststores_init = 1;
+	}
+
+	he = Tcl_CreateHashEntry(&g_truststores, Tcl_GetString(canonical), &isnew);
+	if (isnew) {
+		if (TCL_OK != (code = make_truststore(interp, src[0], src[1], src[2], &ts))) {
+			Tcl_DeleteHashEntry(he);
+			goto finally;
+		}
+		Tcl_SetHashValue(he, ts);
+	} else {
+		ts = (struct truststore*)Tcl_GetHashValue(he);
+	}
+
+	if (config) {
+		if (ts->dir)    CHECK_S2N(finally, code, s2n_config_set_verification_ca_location(config, NULL, ts->dir));
+		if (ts->tmpdir) CHECK_S2N(finally, code, s2n_config_set_verification_ca_location(config, NULL, ts->tmpdir));
+	}
+
+finally:
+	if (locked) {
+		Tcl_MutexUnlock(&g_truststores_mutex);
+		locked = 0;
+	}
+	replace_tclobj(&canonical, NULL);
+	return code;
+}
+
+//>>>
+void truststore_cleanup_handler(ClientData cdata) //<<<
+{
+	Tcl_MutexLock(&g_truststores_mutex);
+	if (g_truststores_init) {
+		Tcl_HashEntry*	he;
+		Tcl_HashSearch	search;
+
+		for (he = Tcl_FirstHashEntry(&g_truststores, &search); he; he = Tcl_NextHashEntry(&search))
+			free_truststore((struct truststore*)Tcl_GetHashValue(he));
+		Tcl_DeleteHashTable(&g_truststores);
+		g_truststores_init = 0;
+	}
+	Tcl_MutexUnlock(&g_truststores_mutex);
+}
+
+//>>>
+void truststore_cleanup(void) //<<<
+{
+	Tcl_DeleteExitHandler(truststore_cleanup_handler, NULL);
+	truststore_cleanup_handler(NULL);
+	Tcl_MutexFinalize(&g_truststores_mutex);
+	g_truststores_mutex = NULL;
+}
+
+//>>>
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
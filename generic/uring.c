@@ -0,0 +1,757 @@
+#include "s2nInt.h"
+
+// io_uring transport for direct channels.  Instead of a recv or send syscall
+// for every record, each thread has a ring that the channels in it queue
+// their socket I/O on, and all of the operations queued while the event loop
+// runs are submitted together in one io_uring_enter when it is about to wait
+// again.  Receives pick their buffer from a ring of buffers registered with
+// the kernel when the data arrives, so idle connections don't pin a buffer.
+// Sends collect the records s2n produces into a staging buffer per
+// connection, so a handler's worth of writes goes out as one send.
+//
+// The s2n callbacks can't wait for the kernel, so a send is reported as done
+// once it is staged (errors surface on the next one), and a receive returns
+// what an earlier completion delivered, or EAGAIN after queueing a recv.
+// Readiness for the channel comes from completions rather than the notifier:
+// a Tcl event source reaps the completion queue (woken by an eventfd
+// registered with the ring) and runs the channel's handler for connections
+// that have become readable or writable.  Where io_uring isn't available
+// (not built with liburing, or the kernel refuses to set up a ring) channels
+// stay on the plain fd path.
+//
+// A ring belongs to its thread, so a channel moved to another thread leaves
+// it first: what it has in flight is cancelled, ciphertext not yet sent is
+// carried over to go out before anything else, and received data s2n hasn't
+// read yet is carried over to be read before the socket.  Leaving never
+// waits for the peer.  The new thread attaches it to its own ring.
+// Connections still on a ring when its thread exits are detached (or, for
+// closed channels, have what they queued cancelled) before the ring goes.
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#define UR_ENTRIES		256
+#define UR_BUFS			128			// Receive buffers registered per thread, a power of 2
+#define UR_BUF_SIZE		16384
+#define UR_BGID			0
+#define UR_STAGE_SIZE	32768		// Staged ciphertext per connection
+
+enum ur_op {
+	UR_OP_RECV		= 1,
+	UR_OP_SEND		= 2,
+	UR_OP_POLL		= 3,
+	UR_OP_CANCEL	= 4,
+	UR_OP_MASK		= 7,
+};
+
+struct uring_con {
+	struct con_cx*			con_cx;			// NULL once the channel has closed
+	struct uring_thread*	ut;
+	int						fd;
+	int						ops;			// Operations in flight
+
+	// Receive
+	int						recv_inflight;
+	int						rx_bid;			// -1 if no buffer holds received data
+	uint32_t				rx_len;
+	uint32_t				rx_off;
+	int						rx_eof;
+	int						rx_err;
+
+	// Send: tx is in flight, stage collects what comes next
+	uint8_t*				tx;
+	uint32_t				tx_len;
+	uint32_t				tx_off;
+	uint8_t*				stage;
+	uint32_t				stage_len;
+	int						tx_err;
+
+	int						poll_inflight;
+	int						writable_known;	// The connect has completed
+	int						watch;			// Mask the channel is interested in
+
+	int						detaching;		// Leaving the ring, don't queue anything more
+	int						on_ready;
+	int						on_dirty;
+	int						on_starved;
+	struct uring_con*		next_ready;		// Completions changed its readiness
+	struct uring_con*		next_dirty;		// Has operations to queue before the next submit
+	struct uring_con*		next_starved;	// A recv found no free buffer, retry when one comes back
+	struct uring_con*		prev;			// All of the thread's connections
+	struct uring_con*		next;
+};
+
+struct uring_thread {
+	struct io_uring			ring;
+	struct io_uring_buf_ring*	br;
+	uint8_t*				bufs;
+	int						evfd;
+	struct uring_con*		ready;
+	struct uring_con*		checking;		// What check_proc took from ready and hasn't got to yet
+	struct uring_con*		dirty;
+	struct uring_con*		starved;
+	struct uring_con*		cons;
+	uint64_t				submits;
+	uint64_t				completions;
+};
+
+static _Thread_local struct uring_thread*	t_uring = NULL;
+static _Thread_local int					t_uring_failed = 0;
+
+static void reap(struct uring_thread* ut);
+
+static struct io_uring_sqe* get_sqe(struct uring_thread* ut) //<<<
+{
+	struct io_uring_sqe*	sqe = io_uring_get_sqe(&ut->ring);
+
+	if (sqe == NULL) {
+		// The submission queue is full: submit what's there early
+		io_uring_submit(&ut->ring);
+		ut->submits++;
+		sqe = io_uring_get_sqe(&ut->ring);
+	}
+	return sqe;
+}
+
+//>>>
+static int queue_op(struct uring_con* ur, enum ur_op op) //<<<
+{
+	struct io_uring_sqe*	sqe = get_sqe(ur->ut);
+
+	if (sqe == NULL) return -1;
+
+	switch (op) {
+		case UR_OP_RECV:
+			io_uring_prep_recv(sqe, ur->fd, NULL, UR_BUF_SIZE, 0);
+			sqe->flags |= IOSQE_BUFFER_SELECT;
+			sqe->buf_group = UR_BGID;
+			ur->recv_inflight = 1;
+			break;
+		case UR_OP_SEND:
+			io_uring_prep_send(sqe, ur->fd, ur->tx + ur->tx_off, ur->tx_len - ur->tx_off, MSG_NOSIGNAL);
+			break;
+		case UR_OP_POLL:
+			io_uring_prep_poll_add(sqe, ur->fd, POLLOUT);
+			ur->poll_inflight = 1;
+			break;
+		default:
+			return -1;
+	}
+	io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)ur | op);
+	ur->ops++;
+	return 0;
+}
+
+//>>>
+static void cancel_op(struct uring_con* ur, enum ur_op op) //<<<
+{
+	struct io_uring_sqe*	sqe = get_sqe(ur->ut);
+
+	if (sqe == NULL) return;
+	io_uring_prep_cancel64(sqe, (uint64_t)(uintptr_t)ur | op, 0);
+	io_uring_sqe_set_data64(sqe, UR_OP_CANCEL);
+}
+
+//>>>
+static void mark_dirty(struct uring_con* ur) //<<<
+{
+	if (ur->on_dirty) return;
+	ur->on_dirty = 1;
+	ur->next_dirty = ur->ut->dirty;
+	ur->ut->dirty = ur;
+}
+
+//>>>
+static void mark_ready(struct uring_con* ur) //<<<
+{
+	if (ur->on_ready || ur->con_cx == NULL) return;
+	ur->on_ready = 1;
+	ur->next_ready = ur->ut->ready;
+	ur->ut->ready = ur;
+}
+
+//>>>
+static int ready_mask(struct uring_con* ur) //<<<
+{
+	int		mask = 0;
+
+	if (ur->rx_bid != -1 || ur->rx_eof || ur->rx_err) mask |= TCL_READABLE;
+	if ((ur->writable_known && ur->stage_len < UR_STAGE_SIZE) || ur->tx_err) mask |= TCL_WRITABLE;
+	return mask;
+}
+
+//>>>
+static void release_rx(struct uring_con* ur) //<<<
+{
+	// Give the receive buffer back to the kernel, and to a connection waiting for one
+	struct uring_thread*	ut = ur->ut;
+	struct uring_con*		starved = ut->starved;
+
+	io_uring_buf_ring_add(ut->br, ut->bufs + (size_t)ur->rx_bid * UR_BUF_SIZE, UR_BUF_SIZE, ur->rx_bid, io_uring_buf_ring_mask(UR_BUFS), 0);
+	io_uring_buf_ring_advance(ut->br, 1);
+	ur->rx_bid = -1;
+
+	if (starved) {
+		ut->starved = starved->next_starved;
+		starved->on_starved = 0;
+		mark_dirty(starved);
+	}
+}
+
+//>>>
+static void unlink_con(struct uring_con* ur) //<<<
+{
+	// Take ur off its thread's lists
+	struct uring_thread*	ut = ur->ut;
+	struct uring_con**		p;
+
+	if (ur->on_ready) {
+		for (p = &ut->ready; *p && *p != ur; p = &(*p)->next_ready);
+		if (*p == NULL) for (p = &ut->checking; *p && *p != ur; p = &(*p)->next_ready);
+		if (*p) *p = ur->next_ready;
+		ur->on_ready = 0;
+	}
+	if (ur->on_dirty) {
+		for (p = &ut->dirty; *p && *p != ur; p = &(*p)->next_dirty);
+		if (*p) *p = ur->next_dirty;
+		ur->on_dirty = 0;
+	}
+	if (ur->on_starved) {
+		for (p = &ut->starved; *p && *p != ur; p = &(*p)->next_starved);
+		if (*p) *p = ur->next_starved;
+		ur->on_starved = 0;
+	}
+	if (ur->prev) ur->prev->next = ur->next; else ut->cons = ur->next;
+	if (ur->next) ur->next->prev = ur->prev;
+	ur->prev = ur->next = NULL;
+}
+
+//>>>
+static void maybe_free(struct uring_con* ur) //<<<
+{
+	// A closed channel's connection goes once everything it queued has completed
+	if (ur->con_cx || ur->ops || ur->on_dirty || ur->on_ready || ur->stage_len) return;
+
+	unlink_con(ur);
+	close(ur->fd);
+	if (ur->rx_bid != -1) release_rx(ur);
+	if (ur->tx)    ckfree(ur->tx);
+	if (ur->stage) ckfree(ur->stage);
+	ckfree(ur);
+}
+
+//>>>
+static void flush_dirty(struct uring_thread* ut) //<<<
+{
+	// Queue the sends and receives connections have been waiting on
+	struct uring_con*	ur;
+
+	while ((ur = ut->dirty)) {
+		ut->dirty = ur->next_dirty;
+		ur->on_dirty = 0;
+
+		if (ur->tx == NULL && ur->stage_len && !ur->tx_err) {
+			ur->tx = ur->stage;
+			ur->tx_len = ur->stage_len;
+			ur->tx_off = 0;
+			ur->stage = NULL;
+			ur->stage_len = 0;
+			if (queue_op(ur, UR_OP_SEND) == -1) ur->tx_err = EAGAIN;
+		}
+		if (ur->con_cx && (ur->watch & TCL_READABLE) && !ur->recv_inflight && ready_mask(ur) == 0)
+			queue_op(ur, UR_OP_RECV);
+
+		if (ur->tx_err && ur->con_cx == NULL) {
+			if (ur->stage) { ckfree(ur->stage); ur->stage = NULL; }
+			ur->stage_len = 0;
+		}
+		maybe_free(ur);
+	}
+}
+
+//>>>
+static void complete(struct uring_thread* ut, struct io_uring_cqe* cqe) //<<<
+{
+	const uint64_t		data = io_uring_cqe_get_data64(cqe);
+	const enum ur_op	op = data & UR_OP_MASK;
+	struct uring_con*	ur = (struct uring_con*)(uintptr_t)(data & ~(uint64_t)UR_OP_MASK);
+
+	ut->completions++;
+	if (op == UR_OP_CANCEL || ur == NULL) return;
+	ur->ops--;
+
+	switch (op) {
+		case UR_OP_RECV:
+			ur->recv_inflight = 0;
+			if (cqe->res > 0) {
+				ur->rx_bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+				ur->rx_len = cqe->res;
+				ur->rx_off = 0;
+				if (ur->con_cx == NULL) release_rx(ur);
+			} else if (cqe->res == 0) {
+				ur->rx_eof = 1;
+			} else if (cqe->res == -ENOBUFS) {
+				// All the buffers are holding data: retry when release_rx returns one, not straight away
+				if (ur->con_cx && !ur->on_starved) {
+					ur->on_starved = 1;
+					ur->next_starved = ur->ut->starved;
+					ur->ut->starved = ur;
+				}
+			} else if (cqe->res != -ECANCELED) {
+				ur->rx_err = -cqe->res;
+			}
+			break;
+
+		case UR_OP_SEND:
+			if (cqe->res == -ECANCELED) break;		// uring_detach hands tx back, closed channels drop it
+			if (cqe->res < 0) {
+				ur->tx_err = -cqe->res;
+			} else {
+				ur->tx_off += cqe->res;
+				if (ur->tx_off < ur->tx_len) {
+					// Short send, the rest has to go before anything staged
+					if (ur->detaching || ur->tx_err) break;
+					if (queue_op(ur, UR_OP_SEND) == -1) ur->tx_err = EAGAIN;
+					break;
+				}
+			}
+			ckfree(ur->tx);
+			ur->tx = NULL;
+			if (ur->stage_len) mark_dirty(ur);
+			break;
+
+		case UR_OP_POLL:
+			ur->poll_inflight = 0;
+			if (cqe->res >= 0) {
+				// Connected: from here the ring does the waiting, so the socket can block
+				ur->writable_known = 1;
+				fcntl(ur->fd, F_SETFL, fcntl(ur->fd, F_GETFL) & ~O_NONBLOCK);
+			} else if (cqe->res != -ECANCELED) {
+				ur->tx_err = -cqe->res;
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	mark_ready(ur);
+	maybe_free(ur);
+}
+
+//>>>
+static void reap(struct uring_thread* ut) //<<<
+{
+	struct io_uring_cqe*	cqe;
+	unsigned				head;
+	unsigned				count = 0;
+
+	io_uring_for_each_cqe(&ut->ring, head, cqe) {
+		complete(ut, cqe);
+		count++;
+	}
+	io_uring_cq_advance(&ut->ring, count);
+}
+
+//>>>
+static void submit(struct uring_thread* ut) //<<<
+{
+	flush_dirty(ut);
+	if (io_uring_sq_ready(&ut->ring)) {
+		io_uring_submit(&ut->ring);
+		ut->submits++;
+	}
+}
+
+//>>>
+static void wait_for(struct uring_con* ur, int want) //<<<
+{
+	// Blocking channels: run the ring until ur is ready for want
+	struct uring_thread*	ut = ur->ut;
+
+	while (!(ready_mask(ur) & want)) {
+		if (want & TCL_READABLE && !ur->recv_inflight) queue_op(ur, UR_OP_RECV);
+		if (want & TCL_WRITABLE && !ur->writable_known && !ur->poll_inflight) queue_op(ur, UR_OP_POLL);
+		flush_dirty(ut);
+		io_uring_submit_and_wait(&ut->ring, 1);
+		ut->submits++;
+		reap(ut);
+	}
+}
+
+//>>>
+static void evfd_handler(ClientData cdata, int mask) //<<<
+{
+	struct uring_thread*	ut = cdata;
+	uint64_t				v;
+
+	while (read(ut->evfd, &v, sizeof v) == -1 && errno == EINTR);
+	reap(ut);
+}
+
+//>>>
+static void setup_proc(ClientData cdata, int flags) //<<<
+{
+	struct uring_thread*	ut = cdata;
+
+	if (!(flags & TCL_FILE_EVENTS)) return;
+
+	// Everything the channels queued in this pass of the event loop goes in one submit
+	submit(ut);
+
+	for (struct uring_con* ur = ut->ready; ur; ur = ur->next_ready) {
+		if (ready_mask(ur) & ur->watch) {
+			Tcl_Time	block = {0, 0};
+			Tcl_SetMaxBlockTime(&block);
+			break;
+		}
+	}
+}
+
+//>>>
+static void check_proc(ClientData cdata, int flags) //<<<
+{
+	struct uring_thread*	ut = cdata;
+	struct uring_con*		ur;
+
+	if (!(flags & TCL_FILE_EVENTS)) return;
+
+	reap(ut);
+
+	// Handlers can move other channels to another thread, which takes them
+	// off the list, so it lives in ut rather than here
+	ut->checking = ut->ready;
+	ut->ready = NULL;
+
+	while ((ur = ut->checking)) {
+		ut->checking = ur->next_ready;
+		ur->on_ready = 0;
+
+		const int	mask = ur->con_cx ? ready_mask(ur) & ur->watch : 0;
+		if (mask) {
+			direct_chan_ready(ur->con_cx, mask);
+		} else {
+			maybe_free(ur);
+		}
+	}
+}
+
+//>>>
+static void free_uring_thread(ClientData cdata) //<<<
+{
+	struct uring_thread*	ut = cdata;
+	struct uring_con*		ur;
+	struct uring_con*		next;
+
+	// Thread exit handlers run before Tcl closes the thread's channels, so
+	// live ones go back to the fd path for that.  Detaching runs the ring,
+	// which can free closed channels' connections, so start over each time
+	for (;;) {
+		for (ur = ut->cons; ur && ur->con_cx == NULL; ur = ur->next);
+		if (ur == NULL) break;
+		uring_detach(ur->con_cx);
+	}
+
+	// Closed channels' sends to peers that aren't reading could wait forever: cancel them
+	while (ut->cons) {
+		for (ur = ut->cons; ur; ur = ur->next) {
+			ur->tx_err = ECANCELED;
+			if (ur->stage) { ckfree(ur->stage); ur->stage = NULL; }
+			ur->stage_len = 0;
+			if (ur->tx)            cancel_op(ur, UR_OP_SEND);
+			if (ur->recv_inflight) cancel_op(ur, UR_OP_RECV);
+			if (ur->poll_inflight) cancel_op(ur, UR_OP_POLL);
+		}
+		ut->ready = ut->dirty = ut->starved = NULL;
+		for (ur = ut->cons; ur; ur = next) {
+			next = ur->next;
+			ur->on_ready = ur->on_dirty = ur->on_starved = 0;
+			maybe_free(ur);
+		}
+		if (ut->cons == NULL) break;
+		io_uring_submit_and_wait(&ut->ring, 1);
+		reap(ut);
+	}
+
+	Tcl_DeleteEventSource(setup_proc, check_proc, ut);
+	Tcl_DeleteFileHandler(ut->evfd);
+	io_uring_unregister_eventfd(&ut->ring);
+	close(ut->evfd);
+	io_uring_free_buf_ring(&ut->ring, ut->br, UR_BUFS, UR_BGID);
+	io_uring_queue_exit(&ut->ring);
+	ckfree(ut->bufs);
+	ckfree(ut);
+	t_uring = NULL;
+}
+
+//>>>
+static struct uring_thread* get_uring_thread(void) //<<<
+{
+	struct uring_thread*	ut = t_uring;
+	int						rc;
+
+	if (ut || t_uring_failed) return ut;
+
+	ut = ckalloc(sizeof *ut);
+	*ut = (struct uring_thread){.evfd = -1};
+
+	if (io_uring_queue_init(UR_ENTRIES, &ut->ring, 0) < 0) {
+		ckfree(ut);
+		t_uring_failed = 1;
+		return NULL;
+	}
+
+	ut->br = io_uring_setup_buf_ring(&ut->ring, UR_BUFS, UR_BGID, 0, &rc);
+	ut->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ut->br == NULL || ut->evfd == -1 || io_uring_register_eventfd(&ut->ring, ut->evfd) < 0) {
+		if (ut->evfd != -1) close(ut->evfd);
+		if (ut->br) io_uring_free_buf_ring(&ut->ring, ut->br, UR_BUFS, UR_BGID);
+		io_uring_queue_exit(&ut->ring);
+		ckfree(ut);
+		t_uring_failed = 1;
+		return NULL;
+	}
+
+	ut->bufs = ckalloc((size_t)UR_BUFS * UR_BUF_SIZE);
+	for (int i=0; i<UR_BUFS; i++)
+		io_uring_buf_ring_add(ut->br, ut->bufs + (size_t)i * UR_BUF_SIZE, UR_BUF_SIZE, i, io_uring_buf_ring_mask(UR_BUFS), i);
+	io_uring_buf_ring_advance(ut->br, UR_BUFS);
+
+	Tcl_CreateFileHandler(ut->evfd, TCL_READABLE, evfd_handler, ut);
+	Tcl_CreateEventSource(setup_proc, check_proc, ut);
+	Tcl_CreateThreadExitHandler(free_uring_thread, ut);
+	t_uring = ut;
+
+	return ut;
+}
+
+//>>>
+int uring_attach(struct con_cx* con_cx) //<<<
+{
+	// Returns 1 if con_cx now does its socket I/O through the thread's ring, 0 to stay on the fd path
+	struct uring_thread*	ut = get_uring_thread();
+
+	if (ut == NULL) return 0;
+
+	struct uring_con*	ur = ckalloc(sizeof *ur);
+	*ur = (struct uring_con){
+		.con_cx			= con_cx,
+		.ut				= ut,
+		.fd				= con_cx->fd,
+		.rx_bid			= -1,
+		.writable_known	= con_cx->connected || con_cx->blocking,	// Blocking connects have finished
+		.next			= ut->cons,
+	};
+	if (ur->next) ur->next->prev = ur;
+	ut->cons = ur;
+	if (ur->writable_known) fcntl(ur->fd, F_SETFL, fcntl(ur->fd, F_GETFL) & ~O_NONBLOCK);
+	con_cx->uring = ur;
+
+	if (con_cx->tx_carry) {
+		// Left unsent by the ring of the thread the channel came from, it goes first
+		ur->tx = con_cx->tx_carry;
+		ur->tx_off = con_cx->tx_carry_off;
+		ur->tx_len = con_cx->tx_carry_len;
+		con_cx->tx_carry = NULL;
+		if (queue_op(ur, UR_OP_SEND) == -1) ur->tx_err = EAGAIN;
+	}
+
+	return 1;
+}
+
+//>>>
+void uring_detach(struct con_cx* con_cx) //<<<
+{
+	// Moves con_cx off the thread's ring, onto the fd path: cancels what it
+	// has in flight, and leaves ciphertext not yet sent in con_cx->tx_carry
+	// and data received but not yet read in con_cx->rx_carry.  Only the
+	// cancellations are waited for, which complete without the peer, so a
+	// peer that isn't reading can't hold the thread here.  The socket is
+	// blocking once the ring knows it's connected (a non-blocking socket
+	// makes io_uring fail sends and receives with EAGAIN rather than wait).
+	struct uring_con*		ur = con_cx->uring;
+	struct uring_thread*	ut = ur->ut;
+
+	ur->watch = 0;
+	ur->detaching = 1;
+	if (ur->recv_inflight) cancel_op(ur, UR_OP_RECV);
+	if (ur->poll_inflight) cancel_op(ur, UR_OP_POLL);
+	if (ur->tx)            cancel_op(ur, UR_OP_SEND);
+	while (ur->ops) {
+		io_uring_submit_and_wait(&ut->ring, 1);
+		ut->submits++;
+		reap(ut);
+	}
+
+	if (!ur->tx_err && ((ur->tx && ur->tx_off < ur->tx_len) || ur->stage_len)) {
+		// What s2n was told was sent: the rest of the send in flight, then what was staged after it
+		const uint32_t	tx_n = ur->tx ? ur->tx_len - ur->tx_off : 0;
+		const uint32_t	have = con_cx->tx_carry ? con_cx->tx_carry_len - con_cx->tx_carry_off : 0;
+		uint8_t*		carry = ckalloc(have + tx_n + ur->stage_len);
+
+		if (con_cx->tx_carry) {
+			memcpy(carry, con_cx->tx_carry + con_cx->tx_carry_off, have);
+			ckfree(con_cx->tx_carry);
+		}
+		if (tx_n)          memcpy(carry + have, ur->tx + ur->tx_off, tx_n);
+		if (ur->stage_len) memcpy(carry + have + tx_n, ur->stage, ur->stage_len);
+		con_cx->tx_carry = carry;
+		con_cx->tx_carry_len = have + tx_n + ur->stage_len;
+		con_cx->tx_carry_off = 0;
+	}
+
+	if (ur->rx_bid != -1) {
+		const uint32_t	n = ur->rx_len - ur->rx_off;
+		uint8_t*		carry = ckalloc(con_cx->rx_carry_len - con_cx->rx_carry_off + n);
+		uint32_t		have = 0;
+
+		if (con_cx->rx_carry) {
+			have = con_cx->rx_carry_len - con_cx->rx_carry_off;
+			memcpy(carry, con_cx->rx_carry + con_cx->rx_carry_off, have);
+			ckfree(con_cx->rx_carry);
+		}
+		memcpy(carry + have, ut->bufs + (size_t)ur->rx_bid * UR_BUF_SIZE + ur->rx_off, n);
+		con_cx->rx_carry = carry;
+		con_cx->rx_carry_len = have + n;
+		con_cx->rx_carry_off = 0;
+		release_rx(ur);
+	}
+
+	if (ur->writable_known && !con_cx->blocking)
+		fcntl(ur->fd, F_SETFL, fcntl(ur->fd, F_GETFL) | O_NONBLOCK);
+
+	unlink_con(ur);
+	if (ur->tx)    ckfree(ur->tx);
+	if (ur->stage) ckfree(ur->stage);
+	ckfree(ur);
+	con_cx->uring = NULL;
+	con_cx->watch_mask = -1;		// Nothing watches the fd yet
+}
+
+//>>>
+int uring_send(struct con_cx* con_cx, const uint8_t* buf, uint32_t len) //<<<
+{
+	struct uring_con*	ur = con_cx->uring;
+
+	if (ur->tx_err) {
+		errno = ur->tx_err;
+		return -1;
+	}
+	if (ur->stage_len == UR_STAGE_SIZE || !ur->writable_known) {
+		if (!con_cx->blocking) {
+			mark_dirty(ur);
+			errno = EAGAIN;
+			return -1;
+		}
+		mark_dirty(ur);
+		wait_for(ur, TCL_WRITABLE);
+		if (ur->tx_err) {
+			errno = ur->tx_err;
+			return -1;
+		}
+	}
+
+	if (ur->stage == NULL) ur->stage = ckalloc(UR_STAGE_SIZE);
+	const uint32_t	n = len < UR_STAGE_SIZE - ur->stage_len ? len : UR_STAGE_SIZE - ur->stage_len;
+	memcpy(ur->stage + ur->stage_len, buf, n);
+	ur->stage_len += n;
+	mark_dirty(ur);
+
+	return n;
+}
+
+//>>>
+int uring_recv(struct con_cx* con_cx, uint8_t* buf, uint32_t len) //<<<
+{
+	struct uring_con*	ur = con_cx->uring;
+
+	if (ur->rx_bid == -1 && !ur->rx_eof && !ur->rx_err) {
+		if (!ur->recv_inflight) queue_op(ur, UR_OP_RECV);
+		if (!con_cx->blocking) {
+			errno = EAGAIN;
+			return -1;
+		}
+		wait_for(ur, TCL_READABLE);
+	}
+
+	if (ur->rx_bid != -1) {
+		const uint8_t*	data = ur->ut->bufs + (size_t)ur->rx_bid * UR_BUF_SIZE;
+		const uint32_t	n = len < ur->rx_len - ur->rx_off ? len : ur->rx_len - ur->rx_off;
+		memcpy(buf, data + ur->rx_off, n);
+		ur->rx_off += n;
+		if (ur->rx_off == ur->rx_len) {
+			release_rx(ur);
+			if (ur->watch & TCL_READABLE) mark_dirty(ur);	// Keep a receive queued while the channel wants data
+		}
+		return n;
+	}
+	if (ur->rx_err) {
+		errno = ur->rx_err;
+		return -1;
+	}
+	return 0;
+}
+
+//>>>
+void uring_watch(struct con_cx* con_cx, int mask) //<<<
+{
+	struct uring_con*	ur = con_cx->uring;
+
+	ur->watch = mask;
+	if (mask & TCL_READABLE && !ur->recv_inflight && ready_mask(ur) == 0) mark_dirty(ur);
+	if (mask & TCL_WRITABLE && !ur->writable_known && !ur->poll_inflight) queue_op(ur, UR_OP_POLL);
+	if (ready_mask(ur) & mask) mark_ready(ur);
+}
+
+//>>>
+void uring_close(struct con_cx* con_cx) //<<<
+{
+	// Takes over the fd: staged data is still sent, then the socket is closed
+	struct uring_con*	ur = con_cx->uring;
+
+	con_cx->uring = NULL;
+	ur->con_cx = NULL;
+	ur->watch = 0;
+	if (ur->recv_inflight) cancel_op(ur, UR_OP_RECV);
+	if (ur->poll_inflight) cancel_op(ur, UR_OP_POLL);
+	if (ur->rx_bid != -1) release_rx(ur);
+	if (ur->stage_len) mark_dirty(ur);
+	maybe_free(ur);
+}
+
+//>>>
+Tcl_Obj* uring_stats(void) //<<<
+{
+	struct uring_thread*	ut = t_uring;
+	Tcl_Obj*				res = Tcl_NewDictObj();
+
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("available", -1), Tcl_NewBooleanObj(!t_uring_failed));
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("submits", -1), Tcl_NewWideIntObj(ut ? ut->submits : 0));
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("completions", -1), Tcl_NewWideIntObj(ut ? ut->completions : 0));
+	return res;
+}
+
+//>>>
+#else
+int uring_attach(struct con_cx* con_cx) { return 0; }
+void uring_detach(struct con_cx* con_cx) {}
+int uring_send(struct con_cx* con_cx, const uint8_t* buf, uint32_t len) { errno = ENOTSUP; return -1; }
+int uring_recv(struct con_cx* con_cx, uint8_t* buf, uint32_t len) { errno = ENOTSUP; return -1; }
+void uring_watch(struct con_cx* con_cx, int mask) {}
+void uring_close(struct con_cx* con_cx) {}
+Tcl_Obj* uring_stats(void) //<<<
+{
+	Tcl_Obj*	res = Tcl_NewDictObj();
+
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("available", -1), Tcl_NewBooleanObj(0));
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("submits", -1), Tcl_NewWideIntObj(0));
+	Tcl_DictObjPut(NULL, res, Tcl_NewStringObj("completions", -1), Tcl_NewWideIntObj(0));
+	return res;
+}
+
+//>>>
+#endif
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
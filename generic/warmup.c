@@ -0,0 +1,156 @@
+#include "s2nInt.h"
+
+// Eager initialisation, so that the first real connection doesn't pay for
+// what s2n and aws-lc set up lazily: the calling thread's DRBG state, the
+// cipher suite and signature tables behind a security policy, the first use
+// of each primitive (and the CPU dispatch behind it), and our allocator's
+// per-thread pools.  Configs given to s2n::warmup have already been built
+// (certificates and trust stores loaded) by the time they are here; those
+// with certificates also get a handshake with themselves over a socketpair,
+// which runs everything a real handshake does.
+
+#define WARMUP_MAX_ROUNDS		64			// s2n_negotiate calls per side before giving up
+
+static _Thread_local int	t_warmed = 0;
+
+static int pump(struct s2n_connection* con, int* done) //<<<
+{
+	s2n_blocked_status	blocked = S2N_NOT_BLOCKED;
+
+	if (*done) return 0;
+	ocsp_handshake_enter(con);
+	const int	rc = s2n_negotiate(con, &blocked);
+	ocsp_handshake_leave();
+	if (rc == S2N_SUCCESS) {
+		*done = 1;
+		return 0;
+	}
+	return s2n_error_get_type(s2n_errno) == S2N_ERR_T_BLOCKED ? 0 : -1;
+}
+
+//>>>
+static int self_handshake(Tcl_Interp* interp, struct config_cx* cfg) //<<<
+{
+	// Handshake cfg with itself: it serves, a throwaway client config with
+	// the same security policy (so they're sure to agree on one) connects
+	int						code = TCL_OK;
+	int						sv[2] = {-1, -1};
+	struct s2n_config*		client_config = NULL;
+	struct s2n_connection*	client = NULL;
+	struct s2n_connection*	server = NULL;
+	int						client_done = 0;
+	int						server_done = 0;
+	s2n_blocked_status		blocked = S2N_NOT_BLOCKED;
+	uint8_t					byte = 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) == -1)
+		THROW_POSIX_LABEL(finally, code, "warmup: couldn't create socketpair");
+
+	client_config = s2n_config_new_minimal();		// It won't verify anything, so no need for the system trust store
+	if (client_config == NULL) THROW_ERROR_LABEL(finally, code, "warmup: s2n_config_new_minimal failed");
+	if (cfg->cipher_preferences)
+		CHECK_S2N(finally, code, s2n_config_set_cipher_preferences(client_config, cfg->cipher_preferences));
+	CHECK_S2N(finally, code, s2n_config_disable_x509_verification(client_config));	// It's talking to itself
+
+	client = s2n_connection_new(S2N_CLIENT);
+	server = s2n_connection_new(S2N_SERVER);
+	if (client == NULL || server == NULL) THROW_ERROR_LABEL(finally, code, "warmup: s2n_connection_new failed");
+	CHECK_S2N(finally, code, s2n_connection_set_config(client, client_config));
+	CHECK_S2N(finally, code, s2n_connection_set_config(server, cfg->config));
+	CHECK_S2N(finally, code, s2n_connection_set_fd(client, sv[0]));
+	CHECK_S2N(finally, code, s2n_connection_set_fd(server, sv[1]));
+
+	for (int i=0; i<WARMUP_MAX_ROUNDS && !(client_done && server_done); i++) {
+		if (pump(client, &client_done) == -1 || pump(server, &server_done) == -1)
+			THROW_PRINTF_LABEL(finally, code, "warmup handshake failed: %s", s2n_strerror(s2n_errno, "EN"));
+	}
+	if (!(client_done && server_done)) THROW_ERROR_LABEL(finally, code, "warmup handshake didn't complete");
+
+	// And a record each way, for the bulk cipher
+	if (s2n_send(client, &byte, 1, &blocked) != 1 || s2n_recv(server, &byte, 1, &blocked) != 1 ||
+		s2n_send(server, &byte, 1, &blocked) != 1 || s2n_recv(client, &byte, 1, &blocked) != 1)
+		THROW_PRINTF_LABEL(finally, code, "warmup record exchange failed: %s", s2n_strerror(s2n_errno, "EN"));
+
+finally:
+	if (client) s2n_connection_free(client);
+	if (server) s2n_connection_free(server);
+	if (client_config) s2n_config_free(client_config);
+	if (sv[0] != -1) close(sv[0]);
+	if (sv[1] != -1) close(sv[1]);
+	return code;
+}
+
+//>>>
+static int warmup_thread(Tcl_Interp* interp) //<<<
+{
+	// What every connection in this thread will need, whatever its config
+	int						code = TCL_OK;
+	struct s2n_connection*	con = NULL;
+
+	con = s2n_connection_new(S2N_CLIENT);		// Seeds the thread's DRBGs, loads the default policy
+	if (con == NULL) {
+		Tcl_SetErrorCode(interp, "S2N", s2n_strerror_name(s2n_errno), NULL);
+		THROW_PRINTF_LABEL(finally, code, "warmup: s2n_connection_new failed: %s", s2n_strerror(s2n_errno, "EN"));
+	}
+
+finally:
+	if (con) s2n_connection_free(con);
+	if (code == TCL_OK) t_warmed = 1;
+	return code;
+}
+
+//>>>
+int warmup_init(Tcl_Interp* interp) //<<<
+{
+	// Called from S2n_Init: warm the thread up if the environment asks for it
+	const char*	env = getenv("S2N_WARMUP");
+
+	if (env == NULL || env[0] == 0 || strcmp(env, "0") == 0 || t_warmed) return TCL_OK;
+	return warmup_thread(interp);
+}
+
+//>>>
+OBJCMD(warmup_cmd) //<<<
+{
+	int			code = TCL_OK;
+	const int64_t	start = mono_usec();
+	int			configs = 0;
+	int			handshakes = 0;
+	Tcl_Obj*	res = NULL;
+
+	if ((objc-1) % 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "?-config config ...?");
+		code = TCL_ERROR;
+		goto finally;
+	}
+
+	TEST_OK_LABEL(finally, code, warmup_thread(interp));
+
+	for (int i=1; i<objc; i+=2) {
+		static const char* opts[] = {"-config", NULL};
+		int					idx;
+		struct config_cx*	cfg = NULL;
+
+		TEST_OK_LABEL(finally, code, Tcl_GetIndexFromObj(interp, objv[i], opts, "option", TCL_EXACT, &idx));
+		TEST_OK_LABEL(finally, code, get_config_cx_from_obj(interp, objv[i+1], &cfg));	// Builds it
+		configs++;
+		if (cfg->certs_count) {
+			TEST_OK_LABEL(finally, code, self_handshake(interp, cfg));
+			handshakes++;
+		}
+	}
+
+	replace_tclobj(&res, Tcl_NewDictObj());
+	TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, res, Tcl_NewStringObj("configs", -1),		Tcl_NewIntObj(configs)));
+	TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, res, Tcl_NewStringObj("handshakes", -1),	Tcl_NewIntObj(handshakes)));
+	TEST_OK_LABEL(finally, code, Tcl_DictObjPut(interp, res, Tcl_NewStringObj("usec", -1),		Tcl_NewWideIntObj(mono_usec() - start)));
+	Tcl_SetObjResult(interp, res);
+
+finally:
+	replace_tclobj(&res, NULL);
+	return code;
+}
+
+//>>>
+
+// vim: foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4
@@ -8,3 +8,179 @@ package require s2n
 
 tcl::tm::path add [file join [file dirname [info script]] ../local/lib/tcl8/site-tcl]
 
+# Fixtures for tests that need a peer <<<
+# A TLS server in its own thread (so that blocking clients can't deadlock
+# against it), doing the server side of each handshake with s2n::push -role
+# server on the sockets it accepts, and echoing by default.  Clients made with
+# tls_client trust its self-signed certificate.
+tcltest::testConstraint tls_server [expr {
+	![catch {package require Thread}] && [auto_execok openssl] ne ""
+}]
+
+namespace eval ::tlsfixture {
+	variable certs	{}
+	variable tid
+	variable idle_listen
+	variable idle_peers	{}
+
+	variable server_script {
+		proc accept {chan args} { #<<<
+			chan configure $chan -blocking 0
+			s2n::push $chan -role server -config $::config
+			chan configure $chan -translation binary -buffering none
+			chan event $chan readable [list readable $chan]
+		}
+
+		#>>>
+		proc readable chan { #<<<
+			if {[catch {read $chan} data] || [eof $chan]} {
+				close $chan
+				return
+			}
+			if {$data ne ""} {{*}$::onread $chan $data}
+		}
+
+		#>>>
+		proc echo {chan data} {puts -nonewline $chan $data}
+
+		proc listen {config onread} { #<<<
+			set ::config	$config
+			set ::onread	$onread
+			set ::listen	[socket -server accept -myaddr 127.0.0.1 0]
+			lindex [chan configure $::listen -sockname] 2
+		}
+
+		#>>>
+	}
+}
+
+proc tls_cert {{name localhost} args} { #<<<
+	# Returns {cert_pem key_pem} for a self-signed certificate for name, with
+	# name and args as its DNS names, generated once per run
+	set names	[list $name {*}$args]
+	if {![dict exists $::tlsfixture::certs $names]} {
+		set dir	[tcltest::makeDirectory tls_cert]
+		try {
+			exec openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes \
+				-keyout [file join $dir key.pem] -out [file join $dir cert.pem] -days 1 \
+				-subj /CN=$name -addext subjectAltName=[join [lmap n $names {string cat DNS: $n}] ,] 2>/dev/null
+			dict set ::tlsfixture::certs $names [lmap f {cert.pem key.pem} {
+				set h	[open [file join $dir $f]]
+				try {read $h} finally {close $h}
+			}]
+		} finally {
+			tcltest::removeDirectory tls_cert
+		}
+	}
+	dict get $::tlsfixture::certs $names
+}
+
+#>>>
+proc s2n_thread {} { #<<<
+	# Returns a new (preserved) thread with the package loaded as it is here
+	set tid	[thread::create -preserved]
+	thread::send $tid [list set ::auto_path $::auto_path]
+	set ver	[package present s2n]
+	thread::send $tid [list package ifneeded s2n $ver [package ifneeded s2n $ver]]
+	thread::send $tid {package require s2n}
+	set tid
+}
+
+#>>>
+proc tls_server args { #<<<
+	# Starts the server thread and returns its port.  Options:
+	#	-config	the server's config, default the localhost certificate
+	#	-script	evaluated in the server thread first, to define handlers
+	#	-onread	command prefix called with chan and data for what each
+	#			connection reads, default echo
+	tls_server_stop
+	set config	[dict create certificates [list [tls_cert]]]
+	set script	{}
+	set onread	echo
+	foreach {k v} $args {
+		switch -- $k {
+			-config	{set config $v}
+			-script	{set script $v}
+			-onread	{set onread $v}
+			default	{error "bad tls_server option \"$k\""}
+		}
+	}
+
+	set tid	[s2n_thread]
+	set ::tlsfixture::tid	$tid
+	thread::send $tid $::tlsfixture::server_script
+	thread::send $tid $script
+	thread::send $tid [list listen $config $onread]
+}
+
+#>>>
+proc tls_server_eval script { #<<<
+	thread::send $::tlsfixture::tid $script
+}
+
+#>>>
+proc tls_server_stop {} { #<<<
+	if {[info exists ::tlsfixture::tid]} {
+		thread::release $::tlsfixture::tid
+		unset ::tlsfixture::tid
+	}
+}
+
+#>>>
+proc tls_client {port args} { #<<<
+	# An s2n::socket to the tls_server on port, args are more options for it
+	s2n::socket -config [list trust_pem [lindex [tls_cert] 0]] -servername localhost {*}$args 127.0.0.1 $port
+}
+
+#>>>
+proc tls_handshake {chan {timeout 5000}} { #<<<
+	# Runs the event loop until chan (created with -async) completes its
+	# handshake, and leaves it non-blocking
+	chan configure $chan -blocking 0
+	set deadline	[expr {[clock milliseconds] + $timeout}]
+	while {[dict get [chan configure $chan -stats] handshake_usec] < 0} {
+		if {[clock milliseconds] > $deadline} {error "handshake on $chan timed out"}
+		chan event $chan writable {set ::tlsfixture::wake 1}
+		set id	[after 10 {set ::tlsfixture::wake 1}]
+		vwait ::tlsfixture::wake
+		after cancel $id
+	}
+	chan event $chan writable {}
+}
+
+#>>>
+proc tls_wait {chan event {timeout 2000}} { #<<<
+	# Runs the event loop until chan is readable or writable, returns 0 on timeout
+	chan event $chan $event {set ::tlsfixture::wake 1}
+	set id	[after $timeout {set ::tlsfixture::wake 0}]
+	vwait ::tlsfixture::wake
+	after cancel $id
+	chan event $chan $event {}
+	set ::tlsfixture::wake
+}
+
+#>>>
+proc idle_server {} { #<<<
+	# A plain TCP server that accepts and never answers, for looking at
+	# connections stuck partway through their handshakes.  Returns its port.
+	idle_server_stop
+	set ::tlsfixture::idle_listen	[socket -server [list apply {{chan args} {
+		lappend ::tlsfixture::idle_peers $chan
+	}}] -myaddr 127.0.0.1 0]
+	lindex [chan configure $::tlsfixture::idle_listen -sockname] 2
+}
+
+#>>>
+proc idle_server_stop {} { #<<<
+	foreach chan $::tlsfixture::idle_peers {close $chan}
+	set ::tlsfixture::idle_peers	{}
+	if {[info exists ::tlsfixture::idle_listen]} {
+		close $::tlsfixture::idle_listen
+		unset ::tlsfixture::idle_listen
+	}
+}
+
+#>>>
+# Fixtures for tests that need a peer >>>
+
+# vim: ft=tcl foldmethod=marker foldmarker=<<<,>>> ts=4 shiftwidth=4